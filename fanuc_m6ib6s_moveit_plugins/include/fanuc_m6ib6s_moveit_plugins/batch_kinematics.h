@@ -0,0 +1,38 @@
+#ifndef FANUC_M6IB6S_MOVEIT_PLUGINS_BATCH_KINEMATICS_H
+#define FANUC_M6IB6S_MOVEIT_PLUGINS_BATCH_KINEMATICS_H
+
+#include <cstddef>
+
+namespace fanuc_m6ib6s_manipulator
+{
+/**
+ * @brief Batch IK query of the IKFast plugin, reached from the group's solver instance with
+ * dynamic_cast<const BatchKinematics*>(joint_model_group->getSolverInstance().get())
+ */
+class BatchKinematics
+{
+public:
+  virtual ~BatchKinematics()
+  {
+  }
+
+  /**
+   * @brief Given a batch of poses of the end-effector, compute all the joint angles within limits that reach them
+   *
+   * The query keeps its own state on the stack and can be called from several threads at once. The generated IKFast
+   * solver still builds a small vector for each solution it finds, so the heap is not fully avoided.
+   *
+   * @param poses n_poses poses of the tip frame in the base frame, 7 values each: x, y, z, qx, qy, qz, qw
+   * @param n_poses the number of poses
+   * @param solutions buffer of max_solutions solutions of getJointNames().size() values each, filled pose by pose
+   * @param max_solutions the capacity of solutions, the solutions that do not fit are dropped
+   * @param solution_offsets n_poses + 1 entries, the solutions of pose i are [solution_offsets[i],
+   *                         solution_offsets[i + 1]) (so pose i is reachable when the two differ)
+   * @return the number of solutions written
+   */
+  virtual std::size_t getPositionIKBatch(const double* poses, std::size_t n_poses, double* solutions,
+                                         std::size_t max_solutions, std::size_t* solution_offsets) const = 0;
+};
+}  // namespace fanuc_m6ib6s_manipulator
+
+#endif  // FANUC_M6IB6S_MOVEIT_PLUGINS_BATCH_KINEMATICS_H
@@ -48,11 +48,15 @@
 #include <tf2_kdl/tf2_kdl.h>
 #include <tf2_eigen/tf2_eigen.h>
 #include <eigen_conversions/eigen_kdl.h>
+#include <fanuc_m6ib6s_moveit_plugins/batch_kinematics.h>
 
 using namespace moveit::core;
 
 // Need a floating point tolerance when checking joint limits, in case the joint starts at limit
 const double LIMIT_TOLERANCE = .0000001;
+// Capacity of the fixed size solution buffers, a 6 dof Transform6D solver returns at most 16 solutions
+const size_t MAX_IK_SOLUTIONS = 32;
+const size_t MAX_IK_JOINTS = 8;
 /// \brief Search modes for searchPositionIK(), see there
 enum SEARCH_MODE
 {
@@ -151,7 +155,86 @@ struct LimitObeyingSol
 // Code generated by IKFast56/61
 #include "fanuc_m6ib6s_manipulator_ikfast_solver.cpp"
 
-class IKFastKinematicsPlugin : public kinematics::KinematicsBase
+/// \brief A solution stored as its joint values, free parameters of infinite solution sets set to 0
+class FlatIkSolution : public IkSolutionBase<IkReal>
+{
+public:
+  IkReal values[MAX_IK_JOINTS];
+  int dof;
+
+  void GetSolution(IkReal* solution, const IkReal* /*freevalues*/) const override
+  {
+    std::copy(values, values + dof, solution);
+  }
+
+  const std::vector<int>& GetFree() const override
+  {
+    return free_;
+  }
+
+  int GetDOF() const override
+  {
+    return dof;
+  }
+
+private:
+  std::vector<int> free_;  // always empty
+};
+
+/// \brief Solution list of fixed capacity, so that it can live on the stack. Solutions beyond the capacity are dropped.
+class FlatIkSolutionList : public IkSolutionListBase<IkReal>
+{
+public:
+  FlatIkSolutionList() : size_(0)
+  {
+  }
+
+  size_t AddSolution(const std::vector<IkSingleDOFSolutionBase<IkReal> >& vinfos, const std::vector<int>& vfree) override
+  {
+    if (size_ == MAX_IK_SOLUTIONS || vinfos.size() > MAX_IK_JOINTS)
+      return size_;
+
+    FlatIkSolution& solution = solutions_[size_];
+    solution.dof = vinfos.size();
+
+    for (size_t i = 0; i < vinfos.size(); ++i)
+    {
+      // same as IkSolution::GetSolution with all free values at 0
+      IkReal value = vinfos[i].foffset;
+      if (vinfos[i].freeind >= 0)
+      {
+        if (value > IkReal(3.14159265358979))
+          value -= IkReal(6.28318530717959);
+        else if (value < IkReal(-3.14159265358979))
+          value += IkReal(6.28318530717959);
+      }
+      solution.values[i] = value;
+    }
+
+    return size_++;
+  }
+
+  const IkSolutionBase<IkReal>& GetSolution(size_t index) const override
+  {
+    return solutions_[index];
+  }
+
+  size_t GetNumSolutions() const override
+  {
+    return size_;
+  }
+
+  void Clear() override
+  {
+    size_ = 0;
+  }
+
+private:
+  FlatIkSolution solutions_[MAX_IK_SOLUTIONS];
+  size_t size_;
+};
+
+class IKFastKinematicsPlugin : public kinematics::KinematicsBase, public BatchKinematics
 {
   std::vector<std::string> joint_names_;
   std::vector<double> joint_min_vector_;
@@ -304,6 +387,12 @@ public:
   bool getPositionFK(const std::vector<std::string>& link_names, const std::vector<double>& joint_angles,
                      std::vector<geometry_msgs::Pose>& poses) const override;
 
+  /**
+   * @brief See BatchKinematics::getPositionIKBatch, only solvers without free parameters are supported
+   */
+  size_t getPositionIKBatch(const double* poses, size_t n_poses, double* solutions, size_t max_solutions,
+                            size_t* solution_offsets) const override;
+
   /**
    * @brief Sets the discretization value for the redundant joint.
    *
@@ -342,6 +431,21 @@ private:
   void getSolution(const IkSolutionList<IkReal>& solutions, const std::vector<double>& ik_seed_state, int i,
                    std::vector<double>& solution) const;
 
+  /**
+   * @brief Solves for a pose of the tip in the base frame (Transform6D solvers without free parameters only)
+   *
+   * Writes up to max_solutions solutions within the joint limits to solutions, rotated 360° to be near ik_seed_state
+   * where possible if it is not null.
+   * @return The number of solutions written
+   */
+  size_t solveWithinLimits(const Eigen::Isometry3d& ik_pose, const double* ik_seed_state, double* solutions,
+                           size_t max_solutions) const;
+
+  /**
+   * @brief Moves every joint of the solution into its limits by +/- 2 * pi, and near the seed if it is not null
+   */
+  void fitToLimits(double* solution, const double* ik_seed_state) const;
+
   /**
    * @brief If the value is outside of min/max then it tries to +/- 2 * pi to put the value into the range
    */
@@ -461,6 +565,12 @@ bool IKFastKinematicsPlugin::initialize(const moveit::core::RobotModel& robot_mo
     link = link->getParentLinkModel();
   }
 
+  if (num_joints_ > MAX_IK_JOINTS)
+  {
+    ROS_FATAL_NAMED(name_, "IKFast solver has %zd joints, at most %zd are supported", num_joints_, MAX_IK_JOINTS);
+    return false;
+  }
+
   if (joint_names_.size() != num_joints_)
   {
     ROS_FATAL_NAMED(name_, "Joint numbers of RobotModel (%zd) and IKFast solver (%zd) do not match",
@@ -634,13 +744,7 @@ void IKFastKinematicsPlugin::getSolution(const IkSolutionList<IkReal>& solutions
   std::vector<IkReal> vsolfree(sol.GetFree().size());
   sol.GetSolution(&solution[0], vsolfree.size() > 0 ? &vsolfree[0] : nullptr);
 
-  for (std::size_t joint_id = 0; joint_id < num_joints_; ++joint_id)
-  {
-    if (joint_has_limits_vector_[joint_id])
-    {
-      solution[joint_id] = enforceLimits(solution[joint_id], joint_min_vector_[joint_id], joint_max_vector_[joint_id]);
-    }
-  }
+  fitToLimits(&solution[0], nullptr);
 }
 
 void IKFastKinematicsPlugin::getSolution(const IkSolutionList<IkReal>& solutions,
@@ -655,12 +759,20 @@ void IKFastKinematicsPlugin::getSolution(const IkSolutionList<IkReal>& solutions
   std::vector<IkReal> vsolfree(sol.GetFree().size());
   sol.GetSolution(&solution[0], vsolfree.size() > 0 ? &vsolfree[0] : nullptr);
 
+  fitToLimits(&solution[0], &ik_seed_state[0]);
+}
+
+void IKFastKinematicsPlugin::fitToLimits(double* solution, const double* ik_seed_state) const
+{
   // rotate joints by +/-360° where it is possible and useful
   for (std::size_t i = 0; i < num_joints_; ++i)
   {
     if (joint_has_limits_vector_[i])
     {
       solution[i] = enforceLimits(solution[i], joint_min_vector_[i], joint_max_vector_[i]);
+      if (!ik_seed_state)
+        continue;
+
       double signed_distance = solution[i] - ik_seed_state[i];
       while (signed_distance > M_PI && solution[i] - 2 * M_PI > (joint_min_vector_[i] - LIMIT_TOLERANCE))
       {
@@ -837,11 +949,29 @@ bool IKFastKinematicsPlugin::searchPositionIK(const geometry_msgs::Pose& ik_pose
   {
     ROS_DEBUG_STREAM_NAMED(name_, "No need to search since no free params/redundant joints");
 
-    std::vector<geometry_msgs::Pose> ik_poses(1, ik_pose);
-    std::vector<std::vector<double>> solutions;
-    kinematics::KinematicsResult kinematic_result;
-    // Find all IK solutions within joint limits
-    if (!getPositionIK(ik_poses, ik_seed_state, solutions, kinematic_result, options))
+    if (!initialized_)
+    {
+      ROS_ERROR_NAMED(name_, "kinematics not active");
+      error_code.val = moveit_msgs::MoveItErrorCodes::NO_IK_SOLUTION;
+      return false;
+    }
+
+    if (ik_seed_state.size() < num_joints_)
+    {
+      ROS_ERROR_STREAM_NAMED(name_, "ik_seed_state only has " << ik_seed_state.size()
+                                                              << " entries, this ikfast solver requires " << num_joints_);
+      error_code.val = moveit_msgs::MoveItErrorCodes::NO_IK_SOLUTION;
+      return false;
+    }
+
+    // Find all IK solutions within joint limits, on the stack
+    Eigen::Isometry3d ik_eigen_pose;
+    tf2::fromMsg(ik_pose, ik_eigen_pose);
+
+    double solutions[MAX_IK_SOLUTIONS * MAX_IK_JOINTS];
+    size_t numsol = solveWithinLimits(ik_eigen_pose, &ik_seed_state[0], solutions, MAX_IK_SOLUTIONS);
+
+    if (numsol == 0)
     {
       ROS_DEBUG_STREAM_NAMED(name_, "No solution whatsoever");
       error_code.val = moveit_msgs::MoveItErrorCodes::NO_IK_SOLUTION;
@@ -849,28 +979,31 @@ bool IKFastKinematicsPlugin::searchPositionIK(const geometry_msgs::Pose& ik_pose
     }
 
     // sort solutions by their distance to the seed
-    std::vector<LimitObeyingSol> solutions_obey_limits;
-    for (std::size_t i = 0; i < solutions.size(); ++i)
+    double dist_from_seed[MAX_IK_SOLUTIONS];
+    size_t order[MAX_IK_SOLUTIONS];
+    for (std::size_t i = 0; i < numsol; ++i)
     {
-      double dist_from_seed = 0.0;
-      for (std::size_t j = 0; j < ik_seed_state.size(); ++j)
+      dist_from_seed[i] = 0.0;
+      for (std::size_t j = 0; j < num_joints_; ++j)
       {
-        dist_from_seed += fabs(ik_seed_state[j] - solutions[i][j]);
+        dist_from_seed[i] += fabs(ik_seed_state[j] - solutions[i * num_joints_ + j]);
       }
 
-      solutions_obey_limits.push_back({ solutions[i], dist_from_seed });
+      order[i] = i;
     }
-    std::sort(solutions_obey_limits.begin(), solutions_obey_limits.end());
+    std::sort(order, order + numsol,
+              [&dist_from_seed](size_t a, size_t b) { return dist_from_seed[a] < dist_from_seed[b]; });
 
     // check for collisions if a callback is provided
     if (!solution_callback.empty())
     {
-      for (std::size_t i = 0; i < solutions_obey_limits.size(); ++i)
+      for (std::size_t i = 0; i < numsol; ++i)
       {
-        solution_callback(ik_pose, solutions_obey_limits[i].value, error_code);
+        const double* sol = solutions + order[i] * num_joints_;
+        solution.assign(sol, sol + num_joints_);
+        solution_callback(ik_pose, solution, error_code);
         if (error_code.val == moveit_msgs::MoveItErrorCodes::SUCCESS)
         {
-          solution = solutions_obey_limits[i].value;
           ROS_DEBUG_STREAM_NAMED(name_, "Solution passes callback");
           return true;
         }
@@ -881,7 +1014,8 @@ bool IKFastKinematicsPlugin::searchPositionIK(const geometry_msgs::Pose& ik_pose
     }
     else
     {
-      solution = solutions_obey_limits[0].value;
+      const double* sol = solutions + order[0] * num_joints_;
+      solution.assign(sol, sol + num_joints_);
       error_code.val = moveit_msgs::MoveItErrorCodes::SUCCESS;
       return true;  // no collision check callback provided
     }
@@ -1087,6 +1221,44 @@ bool IKFastKinematicsPlugin::getPositionIK(const geometry_msgs::Pose& ik_pose, c
     }
   }
 
+  if (free_params_.empty())
+  {
+    Eigen::Isometry3d ik_eigen_pose;
+    tf2::fromMsg(ik_pose, ik_eigen_pose);
+
+    double solutions[MAX_IK_SOLUTIONS * MAX_IK_JOINTS];
+    size_t numsol = solveWithinLimits(ik_eigen_pose, &ik_seed_state[0], solutions, MAX_IK_SOLUTIONS);
+    ROS_DEBUG_STREAM_NAMED(name_, "Found " << numsol << " solutions within limits from IKFast");
+
+    // the solution closest to ik_seed_state
+    size_t best = 0;
+    double best_dist = -1.0;
+    for (std::size_t s = 0; s < numsol; ++s)
+    {
+      double dist_from_seed = 0.0;
+      for (std::size_t i = 0; i < num_joints_; ++i)
+      {
+        dist_from_seed += fabs(ik_seed_state[i] - solutions[s * num_joints_ + i]);
+      }
+
+      if (best_dist < 0 || dist_from_seed < best_dist)
+      {
+        best = s;
+        best_dist = dist_from_seed;
+      }
+    }
+
+    if (numsol > 0)
+    {
+      solution.assign(solutions + best * num_joints_, solutions + (best + 1) * num_joints_);
+      error_code.val = moveit_msgs::MoveItErrorCodes::SUCCESS;
+      return true;
+    }
+
+    error_code.val = moveit_msgs::MoveItErrorCodes::NO_IK_SOLUTION;
+    return false;
+  }
+
   std::vector<double> vfree(free_params_.size());
   for (std::size_t i = 0; i < free_params_.size(); ++i)
   {
@@ -1305,6 +1477,79 @@ bool IKFastKinematicsPlugin::getPositionIK(const std::vector<geometry_msgs::Pose
   return false;
 }
 
+size_t IKFastKinematicsPlugin::solveWithinLimits(const Eigen::Isometry3d& ik_pose, const double* ik_seed_state,
+                                                 double* solutions, size_t max_solutions) const
+{
+  Eigen::Isometry3d chain_pose = ik_pose;
+  if (tip_transform_required_)
+    chain_pose = chain_pose * group_tip_to_chain_tip_;
+  if (base_transform_required_)
+    chain_pose = chain_base_to_group_base_ * chain_pose;
+
+  // IKFast wants the rotation row major
+  IkReal trans[3], vals[9];
+  for (int i = 0; i < 3; ++i)
+  {
+    trans[i] = chain_pose.translation()[i];
+    for (int j = 0; j < 3; ++j)
+      vals[3 * i + j] = chain_pose.linear()(i, j);
+  }
+
+  FlatIkSolutionList ik_solutions;
+  ComputeIk(trans, vals, nullptr, ik_solutions);
+
+  size_t n_written = 0;
+  for (size_t s = 0; s < ik_solutions.GetNumSolutions() && n_written < max_solutions; ++s)
+  {
+    double* sol = solutions + n_written * num_joints_;
+    ik_solutions.GetSolution(s).GetSolution(sol, nullptr);
+    fitToLimits(sol, ik_seed_state);
+
+    bool obeys_limits = true;
+    for (size_t i = 0; i < num_joints_ && obeys_limits; ++i)
+    {
+      // Add tolerance to limit check
+      obeys_limits = !joint_has_limits_vector_[i] || ((sol[i] >= (joint_min_vector_[i] - LIMIT_TOLERANCE)) &&
+                                                       (sol[i] <= (joint_max_vector_[i] + LIMIT_TOLERANCE)));
+    }
+
+    if (obeys_limits)
+      ++n_written;
+  }
+
+  return n_written;
+}
+
+size_t IKFastKinematicsPlugin::getPositionIKBatch(const double* poses, size_t n_poses, double* solutions,
+                                                  size_t max_solutions, size_t* solution_offsets) const
+{
+  solution_offsets[0] = 0;
+
+  bool supported = initialized_ && free_params_.empty() && GetIkType() == IKP_Transform6D;
+  if (!supported)
+    ROS_ERROR_ONCE_NAMED(name_, "Batch IK needs an initialized Transform6D solver without free parameters");
+
+  size_t n_written = 0;
+  for (size_t p = 0; p < n_poses; ++p)
+  {
+    if (supported && n_written < max_solutions)
+    {
+      const double* pose = poses + 7 * p;
+
+      Eigen::Isometry3d ik_pose;
+      ik_pose.linear() = Eigen::Quaterniond(pose[6], pose[3], pose[4], pose[5]).normalized().toRotationMatrix();
+      ik_pose.translation() = Eigen::Vector3d(pose[0], pose[1], pose[2]);
+      ik_pose.makeAffine();
+
+      n_written += solveWithinLimits(ik_pose, nullptr, solutions + n_written * num_joints_, max_solutions - n_written);
+    }
+
+    solution_offsets[p + 1] = n_written;
+  }
+
+  return n_written;
+}
+
 bool IKFastKinematicsPlugin::sampleRedundantJoint(kinematics::DiscretizationMethod method,
                                                   std::vector<double>& sampled_joint_vals) const
 {
@@ -0,0 +1,281 @@
+/*
+ * Offline reachability map of the fanuc_m6ib6s manipulator, made with the batch IK query of the IKFast plugin.
+ *
+ * Every voxel of a box of the planning frame gets the view directions of the group tip (the camera optical
+ * frame, z forward) that have an IK solution inside the joint limits and the joint_3 constraint of the
+ * exploration action, for at least one of ~rolls rolls around the direction. The result is written as a
+ * smobex_explorer/reachability_map.h file, that the explorers map read only to reject unreachable views.
+ *
+ * The plugin is loaded from robot_description_kinematics, so the group must use
+ * fanuc_m6ib6s_manipulator/IKFastKinematicsPlugin.
+ *
+ * rosrun fanuc_m6ib6s_moveit_plugins fanuc_m6ib6s_manipulator_reachability_map_generator _output:=reach.map
+ */
+
+#include <ros/ros.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/robot_state/robot_state.h>
+#include <Eigen/Geometry>
+
+#include <fanuc_m6ib6s_moveit_plugins/batch_kinematics.h>
+#include <smobex_explorer/reachability_map.h>
+
+namespace fanuc_m6ib6s_manipulator
+{
+// a 6R arm has at most 8 IK solutions per pose
+const size_t MAX_SOLUTIONS_PER_POSE = 8;
+
+struct JointLimits
+{
+  std::vector<double> min;
+  std::vector<double> max;
+};
+
+// The batch solutions already are within the joint limits of the model, joints that turn further are also tried
+// one turn away for the narrower limits of the exploration
+bool withinLimits(const double* solution, const JointLimits& limits)
+{
+  for (size_t joint = 0; joint < limits.min.size(); ++joint)
+  {
+    bool within = false;
+
+    for (int turn = -1; turn <= 1 && !within; ++turn)
+    {
+      double value = solution[joint] + turn * 2 * M_PI;
+      within = value >= limits.min[joint] - 1e-7 && value <= limits.max[joint] + 1e-7;
+    }
+
+    if (!within)
+      return false;
+  }
+
+  return true;
+}
+
+// Tip pose of the solver, as x y z qx qy qz qw in its base frame, for the group tip at position looking along z
+// with the given roll around it
+void tipPose(const Eigen::Vector3d& position, const Eigen::Vector3d& z, double roll,
+             const Eigen::Isometry3d& solver_base_from_world, const Eigen::Isometry3d& group_tip_to_solver_tip,
+             double* pose)
+{
+  Eigen::Vector3d a = z.unitOrthogonal();
+  Eigen::Vector3d x = cos(roll) * a + sin(roll) * z.cross(a);
+
+  Eigen::Isometry3d group_tip = Eigen::Isometry3d::Identity();
+  group_tip.linear().col(0) = x;
+  group_tip.linear().col(1) = z.cross(x);
+  group_tip.linear().col(2) = z;
+  group_tip.translation() = position;
+
+  Eigen::Isometry3d solver_tip = solver_base_from_world * group_tip * group_tip_to_solver_tip;
+  Eigen::Quaterniond rotation(solver_tip.linear());
+
+  pose[0] = solver_tip.translation().x();
+  pose[1] = solver_tip.translation().y();
+  pose[2] = solver_tip.translation().z();
+  pose[3] = rotation.x();
+  pose[4] = rotation.y();
+  pose[5] = rotation.z();
+  pose[6] = rotation.w();
+}
+}  // namespace fanuc_m6ib6s_manipulator
+
+using namespace fanuc_m6ib6s_manipulator;
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "fanuc_m6ib6s_manipulator_reachability_map_generator");
+  ros::NodeHandle private_nh("~");
+
+  std::string group_name = "manipulator";
+  std::string output = "reachability.map";
+  double resolution = 0.05;
+  int n_directions = 64;
+  int n_rolls = 8;
+  // the path constraint of the exploration action, degrees around 0
+  double joint_3_tolerance_below = 60;
+  double joint_3_tolerance_above = 75;
+
+  private_nh.getParam("group", group_name);
+  private_nh.getParam("output", output);
+  private_nh.getParam("resolution", resolution);
+  private_nh.getParam("directions", n_directions);
+  private_nh.getParam("rolls", n_rolls);
+  private_nh.getParam("joint_3_tolerance_below", joint_3_tolerance_below);
+  private_nh.getParam("joint_3_tolerance_above", joint_3_tolerance_above);
+
+  robot_model_loader::RobotModelLoader model_loader("robot_description");
+  moveit::core::RobotModelConstPtr model = model_loader.getModel();
+
+  if (!model)
+  {
+    ROS_FATAL("Could not load the robot model");
+    return 1;
+  }
+
+  const moveit::core::JointModelGroup* group = model->getJointModelGroup(group_name);
+
+  if (!group || group->getLinkModelNames().empty())
+  {
+    ROS_FATAL_STREAM("Unknown planning group: " << group_name);
+    return 1;
+  }
+
+  kinematics::KinematicsBaseConstPtr solver = group->getSolverInstance();
+  const BatchKinematics* batch_solver = dynamic_cast<const BatchKinematics*>(solver.get());
+
+  if (!batch_solver)
+  {
+    ROS_FATAL_STREAM("The kinematics solver of " << group_name << " is not the fanuc_m6ib6s IKFast plugin");
+    return 1;
+  }
+
+  // limits in the joint order of the solutions
+  std::vector<const moveit::core::JointModel*> joints;
+
+  for (const std::string& name : solver->getJointNames())
+    joints.push_back(model->getJointModel(name));
+
+  JointLimits limits;
+
+  for (size_t joint = 0; joint < joints.size(); ++joint)
+  {
+    const moveit::core::VariableBounds& bounds = joints[joint]->getVariableBounds()[0];
+
+    limits.min.push_back(bounds.position_bounded_ ? bounds.min_position_ : -2 * M_PI);
+    limits.max.push_back(bounds.position_bounded_ ? bounds.max_position_ : 2 * M_PI);
+
+    if (joints[joint]->getName() == "joint_3")
+    {
+      limits.min.back() = std::max(limits.min.back(), -joint_3_tolerance_below * M_PI / 180);
+      limits.max.back() = std::min(limits.max.back(), joint_3_tolerance_above * M_PI / 180);
+    }
+
+    ROS_INFO_STREAM(joints[joint]->getName() << " " << limits.min.back() << " " << limits.max.back());
+  }
+
+  // the fixed transforms between the map frames and the solver frames
+  moveit::core::RobotState state(model);
+  state.setToDefaultValues();
+  state.update();
+
+  std::string group_tip_frame = group->getLinkModelNames().back();
+  private_nh.getParam("tip_frame", group_tip_frame);
+
+  Eigen::Isometry3d solver_base_from_world = state.getGlobalLinkTransform(solver->getBaseFrame()).inverse();
+  Eigen::Isometry3d group_tip_to_solver_tip =
+      state.getGlobalLinkTransform(group_tip_frame).inverse() * state.getGlobalLinkTransform(solver->getTipFrame());
+
+  // the tip is never further from the first joint than the links put end to end
+  const moveit::core::LinkModel* first_link = joints.front()->getChildLinkModel();
+  Eigen::Vector3d shoulder = state.getGlobalLinkTransform(first_link).translation();
+  double reach = 0;
+
+  for (const moveit::core::LinkModel* link = model->getLinkModel(group_tip_frame); link && link != first_link;
+       link = link->getParentLinkModel())
+    reach += link->getJointOriginTransform().translation().norm();
+
+  double min_x = shoulder.x() - reach, min_y = shoulder.y() - reach, min_z = shoulder.z() - reach;
+  double max_x = shoulder.x() + reach, max_y = shoulder.y() + reach, max_z = shoulder.z() + reach;
+
+  private_nh.getParam("min_x", min_x);
+  private_nh.getParam("min_y", min_y);
+  private_nh.getParam("min_z", min_z);
+  private_nh.getParam("max_x", max_x);
+  private_nh.getParam("max_y", max_y);
+  private_nh.getParam("max_z", max_z);
+
+  float origin[3] = { (float)min_x, (float)min_y, (float)min_z };
+
+  reachabilityMap map;
+  map.create(origin, (int)ceil((max_x - min_x) / resolution), (int)ceil((max_y - min_y) / resolution),
+             (int)ceil((max_z - min_z) / resolution), resolution, n_directions, model->getModelFrame());
+
+  ROS_INFO_STREAM("Sweeping " << map.sizeX() << "x" << map.sizeY() << "x" << map.sizeZ() << " voxels x "
+                              << map.nDirections() << " directions x " << n_rolls << " rolls, reach " << reach
+                              << " m from " << first_link->getName() << " in " << model->getModelFrame());
+
+  ros::WallTime start = ros::WallTime::now();
+  size_t n_reachable = 0;
+
+#pragma omp parallel for schedule(dynamic) reduction(+ : n_reachable)
+  for (int iz = 0; iz < map.sizeZ(); ++iz)
+  {
+    // one batch per roll with the directions of the voxel not reached by the previous rolls
+    size_t n_joints = joints.size();
+    std::vector<Eigen::Vector3d> directions(map.nDirections());
+    std::vector<uint32_t> pending(map.nDirections());
+    std::vector<double> poses(7 * map.nDirections());
+    std::vector<double> solutions(MAX_SOLUTIONS_PER_POSE * map.nDirections() * n_joints);
+    std::vector<size_t> solution_offsets(map.nDirections() + 1);
+
+    for (uint32_t bin = 0; bin < map.nDirections(); ++bin)
+    {
+      map.direction(bin, directions[bin].x(), directions[bin].y(), directions[bin].z());
+      directions[bin].normalize();
+    }
+
+    for (int iy = 0; iy < map.sizeY(); ++iy)
+    {
+      for (int ix = 0; ix < map.sizeX(); ++ix)
+      {
+        Eigen::Vector3d position;
+        map.voxelCenter(ix, iy, iz, position.x(), position.y(), position.z());
+
+        if ((position - shoulder).norm() > reach + resolution)
+          continue;
+
+        size_t n_pending = map.nDirections();
+
+        for (uint32_t bin = 0; bin < map.nDirections(); ++bin)
+          pending[bin] = bin;
+
+        for (int roll = 0; roll < n_rolls && n_pending > 0; ++roll)
+        {
+          for (size_t p = 0; p < n_pending; ++p)
+            tipPose(position, directions[pending[p]], 2 * M_PI * roll / n_rolls, solver_base_from_world,
+                    group_tip_to_solver_tip, &poses[7 * p]);
+
+          size_t capacity = MAX_SOLUTIONS_PER_POSE * n_pending;
+
+          if (batch_solver->getPositionIKBatch(poses.data(), n_pending, solutions.data(), capacity,
+                                               solution_offsets.data()) == capacity)
+            ROS_WARN_ONCE("The IK solution buffer filled up, some views may be missed");
+
+          // keep the directions without a solution within the exploration limits for the next roll
+          size_t n_left = 0;
+
+          for (size_t p = 0; p < n_pending; ++p)
+          {
+            bool reached = false;
+
+            for (size_t s = solution_offsets[p]; s < solution_offsets[p + 1] && !reached; ++s)
+              reached = withinLimits(&solutions[s * n_joints], limits);
+
+            if (reached)
+            {
+              map.set(ix, iy, iz, pending[p]);
+              n_reachable++;
+            }
+            else
+              pending[n_left++] = pending[p];
+          }
+
+          n_pending = n_left;
+        }
+      }
+    }
+  }
+
+  ROS_INFO_STREAM(n_reachable << " reachable voxel directions in " << (ros::WallTime::now() - start).toSec() << " s");
+
+  if (!map.save(output))
+  {
+    ROS_FATAL_STREAM("Could not write " << output);
+    return 1;
+  }
+
+  ROS_INFO_STREAM("Reachability map written to " << output);
+
+  return 0;
+}
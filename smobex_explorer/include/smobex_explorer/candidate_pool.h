@@ -0,0 +1,278 @@
+#ifndef SMOBEX_EXPLORER_CANDIDATE_POOL
+#define SMOBEX_EXPLORER_CANDIDATE_POOL
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <tf/tf.h>
+
+#include <smobex_explorer/explorer.h>
+
+// the scored candidate views kept from one iteration to the next. after the maps changed, update() only ray casts
+// again the candidates whose frustum overlaps the box of the voxels that changed (evaluatePose::takeChangedBox),
+// since elsewhere nothing they see changed, and all of them when the maps were replaced. those are rescored in
+// descending order of their upper bound (evaluatePose::evalPoseBounds), once rescore_top_k of them have exact
+// scores the ones whose bound can not beat them keep it and are rescored on a later update
+class candidatePool
+{
+public:
+	struct candidate
+	{
+		tf::Pose pose;
+		float score;
+		// box around the frustum
+		octomap::point3d frustum_min, frustum_max;
+		// the score is only a bound, it waits for a rescore
+		bool stale;
+	};
+
+	std::vector<candidate> candidates;
+	size_t max_size;
+	// 0 rescores every candidate in the changed region
+	size_t rescore_top_k;
+
+	// of the last update()
+	size_t n_stale;
+	size_t n_rescored;
+
+	candidatePool(size_t _max_size = 300)
+	{
+		max_size = _max_size;
+		rescore_top_k = 0;
+		n_stale = 0;
+		n_rescored = 0;
+	}
+
+	size_t size() const
+	{
+		return candidates.size();
+	}
+
+	void clear()
+	{
+		candidates.clear();
+	}
+
+	// scores the poses and keeps them. the scores in the order of poses
+	std::vector<float> add(const std::vector<tf::Pose> &poses, evaluatePose &evaluator)
+	{
+		std::vector<float> scores = evaluator.evalPoses(poses);
+
+		for (size_t idx = 0; idx < poses.size(); idx++)
+		{
+			candidate one_candidate;
+
+			one_candidate.pose = poses[idx];
+			one_candidate.score = scores[idx];
+			one_candidate.stale = false;
+			frustumBox(evaluator, poses[idx], one_candidate.frustum_min, one_candidate.frustum_max);
+
+			candidates.push_back(std::move(one_candidate));
+		}
+
+		trim();
+
+		return scores;
+	}
+
+	// brings the scores to the current maps of evaluator
+	void update(evaluatePose &evaluator)
+	{
+		evaluator.checkOctrees();
+
+		n_stale = 0;
+		n_rescored = 0;
+
+		double resolution = evaluator.octree->getResolution();
+
+		octomap::point3d changed_min, changed_max;
+		bool complete = evaluator.takeChangedBox(changed_min, changed_max);
+
+		// the voxels are boxes, not points
+		octomap::point3d pad(resolution, resolution, resolution);
+		changed_min -= pad;
+		changed_max += pad;
+
+		std::vector<size_t> order;
+		std::vector<tf::Pose> stale_poses;
+
+		for (size_t idx = 0; idx < candidates.size(); idx++)
+		{
+			if (!complete || candidates[idx].stale || overlaps(candidates[idx], changed_min, changed_max))
+			{
+				candidates[idx].stale = true;
+				order.push_back(idx);
+				stale_poses.push_back(candidates[idx].pose);
+			}
+		}
+
+		n_stale = order.size();
+
+		// a stale score is the bound until it is rescored
+		std::vector<float> stale_bounds = evaluator.evalPoseBounds(stale_poses);
+		std::vector<float> bounds(candidates.size());
+
+		for (size_t idx = 0; idx < candidates.size(); idx++)
+		{
+			bounds[idx] = candidates[idx].score;
+		}
+
+		for (size_t k = 0; k < order.size(); k++)
+		{
+			bounds[order[k]] = candidates[order[k]].score = stale_bounds[k];
+		}
+
+		std::sort(order.begin(), order.end(), evaluatePose::compareValueIndex(bounds));
+
+		int n_threads = 1;
+#ifdef _OPENMP
+		n_threads = omp_get_max_threads();
+#endif
+
+		// min heap of the best rescored scores
+		std::vector<float> best_scores;
+		size_t top_k = rescore_top_k > 0 ? rescore_top_k : order.size();
+		size_t next = 0;
+
+		while (next < order.size())
+		{
+			if (best_scores.size() >= top_k && bounds[order[next]] <= best_scores.front())
+			{
+				break;
+			}
+
+			// one candidate per thread between two threshold updates
+			size_t batch_end = std::min(order.size(), next + (rescore_top_k > 0 ? n_threads : order.size()));
+
+			std::vector<tf::Pose> poses;
+
+			for (size_t k = next; k < batch_end; k++)
+			{
+				poses.push_back(candidates[order[k]].pose);
+			}
+
+			std::vector<float> scores = evaluator.evalPoses(poses);
+
+			for (size_t k = 0; k < poses.size(); k++)
+			{
+				candidate &one_candidate = candidates[order[next + k]];
+
+				one_candidate.score = scores[k];
+				one_candidate.stale = false;
+
+				best_scores.push_back(scores[k]);
+				std::push_heap(best_scores.begin(), best_scores.end(), std::greater<float>());
+
+				if (best_scores.size() > top_k)
+				{
+					std::pop_heap(best_scores.begin(), best_scores.end(), std::greater<float>());
+					best_scores.pop_back();
+				}
+			}
+
+			n_rescored += poses.size();
+			next = batch_end;
+		}
+	}
+
+	// takes the candidate at pose out, the view that was taken or one that did not plan
+	bool erase(const tf::Pose &pose)
+	{
+		for (size_t idx = 0; idx < candidates.size(); idx++)
+		{
+			if (candidates[idx].pose.getOrigin().distance2(pose.getOrigin()) < 1e-8 &&
+				fabs(candidates[idx].pose.getRotation().dot(pose.getRotation())) > 1 - 1e-6)
+			{
+				candidates.erase(candidates.begin() + idx);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// keeps the max_size best, and only the ones that still see something
+	void trim()
+	{
+		std::vector<candidate> kept;
+		std::vector<float> scores(candidates.size());
+		std::vector<size_t> order;
+
+		for (size_t idx = 0; idx < candidates.size(); idx++)
+		{
+			scores[idx] = candidates[idx].score;
+
+			if (scores[idx] > 0)
+			{
+				order.push_back(idx);
+			}
+		}
+
+		size_t n_kept = std::min(order.size(), max_size);
+
+		std::partial_sort(order.begin(), order.begin() + n_kept, order.end(), evaluatePose::compareValueIndex(scores));
+
+		kept.reserve(n_kept);
+
+		for (size_t k = 0; k < n_kept; k++)
+		{
+			kept.push_back(std::move(candidates[order[k]]));
+		}
+
+		candidates.swap(kept);
+	}
+
+private:
+	static bool overlaps(const candidate &one_candidate, const octomap::point3d &box_min,
+						 const octomap::point3d &box_max)
+	{
+		for (unsigned i = 0; i < 3; i++)
+		{
+			if (one_candidate.frustum_max(i) < box_min(i) || one_candidate.frustum_min(i) > box_max(i))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// the apex and the far corners, or the whole range sphere for fields of view too wide for corners
+	static void frustumBox(const evaluatePose &evaluator, const tf::Pose &pose, octomap::point3d &box_min,
+						   octomap::point3d &box_max)
+	{
+		tf::Vector3 origin = pose.getOrigin();
+		float range = evaluator.max_range;
+
+		if (evaluator.width_FOV >= 0.95 * M_PI || evaluator.height_FOV >= 0.95 * M_PI)
+		{
+			box_min = octomap::pointTfToOctomap(origin - tf::Vector3(range, range, range));
+			box_max = octomap::pointTfToOctomap(origin + tf::Vector3(range, range, range));
+			return;
+		}
+
+		tf::Matrix3x3 basis = pose.getBasis();
+		tf::Vector3 half_width = basis.getColumn(0) * tan(evaluator.width_FOV / 2) * range;
+		tf::Vector3 half_height = basis.getColumn(1) * tan(evaluator.height_FOV / 2) * range;
+		tf::Vector3 far_center = origin + basis.getColumn(2) * range;
+
+		box_min = box_max = octomap::pointTfToOctomap(origin);
+
+		for (int sx = -1; sx <= 1; sx += 2)
+		{
+			for (int sy = -1; sy <= 1; sy += 2)
+			{
+				octomap::point3d corner = octomap::pointTfToOctomap(far_center + sx * half_width + sy * half_height);
+
+				for (unsigned i = 0; i < 3; i++)
+				{
+					box_min(i) = std::min(box_min(i), corner(i));
+					box_max(i) = std::max(box_max(i), corner(i));
+				}
+			}
+		}
+	}
+};
+
+#endif // SMOBEX_EXPLORER_CANDIDATE_POOL
@@ -0,0 +1,336 @@
+#ifndef SMOBEX_EXPLORER_CROSS_ENTROPY_VIEW_SEARCH
+#define SMOBEX_EXPLORER_CROSS_ENTROPY_VIEW_SEARCH
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include <tf/tf.h>
+
+#include <smobex_explorer/view_sampler.h>
+
+// cross entropy search of the best view with a fixed number of evaluations. the first batch comes from the
+// view sampler around every observation point, then every round keeps the elite_fraction best views scored so
+// far, fits one gaussian per observation point to its elites (position, and view direction as a mean direction
+// with an angular spread) and draws the next batch from them, as many views from each one as it has elites.
+// points without elites get no more views, the spreads are smoothed and kept above a floor so one lucky
+// view does not collapse the search
+class crossEntropyViewSearch
+{
+public:
+	// the scores of a batch of views, < 0 for views that were not scored
+	typedef std::function<std::vector<float>(const std::vector<tf::Pose> &)> evaluator;
+
+	// asked after every round when set, true ends the search there (a deadline)
+	std::function<bool()> stop;
+
+	int rounds;
+	float elite_fraction;
+	// weight of the new fit against the last one
+	float smoothing;
+	float min_position_sigma;
+	float min_angle_sigma;
+
+	// every view scored, by batch
+	std::vector<tf::Pose> poses;
+	std::vector<float> scores;
+	// index of the observation point each view was drawn for
+	std::vector<int> components;
+
+	crossEntropyViewSearch(int _rounds = 4, float _elite_fraction = 0.2)
+	{
+		rounds = _rounds;
+		elite_fraction = _elite_fraction;
+		smoothing = 0.7;
+		min_position_sigma = 0.02;
+		min_angle_sigma = 2 * M_PI / 180;
+
+		rng.seed(std::random_device()());
+	}
+
+	// up to budget evaluations of views of the centers, in rounds batches. index of the best view, -1 if none
+	int search(viewSampler &sampler, const std::vector<tf::Point> &centers, size_t budget, const evaluator &evaluate)
+	{
+		poses.clear();
+		scores.clear();
+		components.clear();
+
+		if (centers.empty() || budget == 0)
+		{
+			return -1;
+		}
+
+		int n_rounds = std::max(rounds, 1);
+		size_t batch_size = std::max<size_t>(budget / n_rounds, 1);
+
+		// the first batch takes what the others do not
+		size_t first_batch = budget - batch_size * (n_rounds - 1);
+		size_t views_per_center = std::max<size_t>(first_batch / centers.size(), 1);
+
+		std::vector<std::vector<tf::Pose> > center_views;
+		sampler.sample(centers, views_per_center, center_views);
+
+		std::vector<tf::Pose> batch;
+		std::vector<int> batch_components;
+
+		for (size_t center_idx = 0; center_idx < centers.size(); center_idx++)
+		{
+			batch.insert(batch.end(), center_views[center_idx].begin(), center_views[center_idx].end());
+			batch_components.insert(batch_components.end(), center_views[center_idx].size(), center_idx);
+		}
+
+		std::vector<viewGaussian> gaussians(centers.size());
+
+		for (size_t center_idx = 0; center_idx < centers.size(); center_idx++)
+		{
+			gaussians[center_idx].reset(centers[center_idx], sampler.r_max);
+		}
+
+		for (int round = 0; round < n_rounds && !batch.empty(); round++)
+		{
+			std::vector<float> batch_scores = evaluate(batch);
+
+			poses.insert(poses.end(), batch.begin(), batch.end());
+			scores.insert(scores.end(), batch_scores.begin(), batch_scores.end());
+			components.insert(components.end(), batch_components.begin(), batch_components.end());
+
+			if (round == n_rounds - 1 || poses.size() >= budget || (stop && stop()))
+			{
+				break;
+			}
+
+			size_t next_size = std::min(batch_size, budget - poses.size());
+
+			fit(gaussians, centers.size(), batch_size);
+			draw(gaussians, sampler, next_size, batch, batch_components);
+		}
+
+		int best = -1;
+
+		for (size_t idx = 0; idx < scores.size(); idx++)
+		{
+			if (scores[idx] >= 0 && (best < 0 || scores[idx] > scores[best]))
+			{
+				best = idx;
+			}
+		}
+
+		return best;
+	}
+
+private:
+	struct viewGaussian
+	{
+		tf::Vector3 position_mean, position_sigma;
+		tf::Vector3 direction_mean;
+		double angle_sigma;
+		int n_elites;
+
+		// the whole shell, looking in
+		void reset(const tf::Point &center, double radius)
+		{
+			position_mean = center;
+			position_sigma.setValue(radius, radius, radius);
+			direction_mean.setValue(0, 0, -1);
+			angle_sigma = M_PI;
+			n_elites = 0;
+		}
+	};
+
+	std::mt19937 rng;
+
+	static tf::Vector3 viewDirection(const tf::Pose &pose)
+	{
+		return pose.getBasis().getColumn(2);
+	}
+
+	void fit(std::vector<viewGaussian> &gaussians, size_t n_components, size_t batch_size)
+	{
+		std::vector<size_t> order;
+
+		for (size_t idx = 0; idx < scores.size(); idx++)
+		{
+			if (scores[idx] >= 0)
+			{
+				order.push_back(idx);
+			}
+		}
+
+		size_t n_elites = std::min(order.size(), std::max<size_t>(ceil(elite_fraction * batch_size), 2));
+
+		std::partial_sort(order.begin(), order.begin() + n_elites, order.end(),
+						  [this](size_t a, size_t b) { return scores[a] > scores[b]; });
+
+		std::vector<std::vector<size_t> > elites(n_components);
+
+		for (size_t k = 0; k < n_elites; k++)
+		{
+			elites[components[order[k]]].push_back(order[k]);
+		}
+
+		for (size_t component = 0; component < n_components; component++)
+		{
+			viewGaussian &gaussian = gaussians[component];
+			const std::vector<size_t> &members = elites[component];
+
+			bool first_fit = gaussian.angle_sigma >= M_PI;
+
+			gaussian.n_elites = members.size();
+
+			if (members.empty())
+			{
+				continue;
+			}
+
+			tf::Vector3 position_mean(0, 0, 0), direction_sum(0, 0, 0);
+
+			for (size_t k = 0; k < members.size(); k++)
+			{
+				position_mean += poses[members[k]].getOrigin();
+				direction_sum += viewDirection(poses[members[k]]);
+			}
+
+			position_mean /= members.size();
+
+			tf::Vector3 direction_mean =
+				direction_sum.length() > 1e-9 ? direction_sum.normalized() : viewDirection(poses[members[0]]);
+
+			tf::Vector3 position_var(0, 0, 0);
+			double angle_var = 0;
+
+			for (size_t k = 0; k < members.size(); k++)
+			{
+				tf::Vector3 offset = poses[members[k]].getOrigin() - position_mean;
+				position_var += offset * offset;
+
+				double angle = direction_mean.angle(viewDirection(poses[members[k]]));
+				angle_var += angle * angle;
+			}
+
+			position_var /= members.size();
+			angle_var /= members.size();
+
+			// the spread of one elite says nothing, it keeps the last one (or a quarter of the shell)
+			double weight = first_fit ? 1 : smoothing;
+
+			for (int i = 0; i < 3; i++)
+			{
+				double sigma =
+					members.size() > 1 ? sqrt(position_var[i]) : gaussian.position_sigma[i] / (first_fit ? 4 : 1);
+
+				gaussian.position_sigma[i] = std::max<double>(
+					weight * sigma + (1 - weight) * gaussian.position_sigma[i], min_position_sigma);
+			}
+
+			double angle_sigma = members.size() > 1 ? sqrt(angle_var) : (first_fit ? M_PI / 10 : gaussian.angle_sigma);
+
+			gaussian.angle_sigma =
+				std::max<double>(weight * angle_sigma + (1 - weight) * std::min(gaussian.angle_sigma, M_PI / 2),
+								 min_angle_sigma);
+
+			if (first_fit)
+			{
+				gaussian.position_mean = position_mean;
+				gaussian.direction_mean = direction_mean;
+			}
+			else
+			{
+				gaussian.position_mean = gaussian.position_mean.lerp(position_mean, weight);
+				gaussian.direction_mean = gaussian.direction_mean.lerp(direction_mean, weight);
+
+				if (gaussian.direction_mean.length() < 1e-9)
+				{
+					gaussian.direction_mean = direction_mean;
+				}
+
+				gaussian.direction_mean.normalize();
+			}
+		}
+	}
+
+	// n views from the gaussians, as many from each as it has elites. the sampler drops the views out of the
+	// workspace or reach, the view direction is checked against the reachability map at the point it looks at
+	void draw(const std::vector<viewGaussian> &gaussians, const viewSampler &sampler, size_t n,
+			  std::vector<tf::Pose> &batch, std::vector<int> &batch_components)
+	{
+		batch.clear();
+		batch_components.clear();
+
+		int total_elites = 0;
+
+		for (size_t component = 0; component < gaussians.size(); component++)
+		{
+			total_elites += gaussians[component].n_elites;
+		}
+
+		if (total_elites == 0)
+		{
+			return;
+		}
+
+		std::normal_distribution<double> normal(0, 1);
+		std::uniform_real_distribution<double> uniform(0, 1);
+
+		size_t assigned = 0;
+
+		for (size_t component = 0; component < gaussians.size(); component++)
+		{
+			const viewGaussian &gaussian = gaussians[component];
+
+			if (gaussian.n_elites == 0)
+			{
+				continue;
+			}
+
+			// the remainder to the last ones
+			assigned += gaussian.n_elites;
+			size_t n_component = n * assigned / total_elites - batch.size();
+
+			tf::Vector3 a = gaussian.direction_mean.cross(fabs(gaussian.direction_mean.z()) < 0.9 ? tf::Vector3(0, 0, 1) :
+																								  tf::Vector3(1, 0, 0));
+			a.normalize();
+			tf::Vector3 b = gaussian.direction_mean.cross(a);
+
+			size_t drawn = 0;
+
+			for (int try_idx = 0; try_idx < std::max(sampler.tries, 1) * (int)n_component && drawn < n_component;
+				 try_idx++)
+			{
+				tf::Point origin = gaussian.position_mean;
+
+				for (int i = 0; i < 3; i++)
+				{
+					origin[i] += gaussian.position_sigma[i] * normal(rng);
+				}
+
+				// a tangent step of gaussian length, as an angle
+				double step_a = gaussian.angle_sigma * normal(rng);
+				double step_b = gaussian.angle_sigma * normal(rng);
+				double angle = sqrt(step_a * step_a + step_b * step_b);
+
+				tf::Vector3 direction = gaussian.direction_mean;
+
+				if (angle > 1e-9)
+				{
+					tf::Vector3 tangent = (step_a * a + step_b * b) / angle;
+					direction = cos(angle) * gaussian.direction_mean + sin(angle) * tangent;
+				}
+
+				tf::Point target = origin + direction;
+
+				if (!sampler.accepted(origin, target))
+				{
+					continue;
+				}
+
+				batch.push_back(viewSampler::lookAt(origin, target, 2 * M_PI * uniform(rng)));
+				batch_components.push_back(component);
+				drawn++;
+			}
+		}
+	}
+};
+
+#endif // SMOBEX_EXPLORER_CROSS_ENTROPY_VIEW_SEARCH
@@ -0,0 +1,426 @@
+#ifndef SMOBEX_EXPLORER_DENSE_VOXEL_GRID
+#define SMOBEX_EXPLORER_DENSE_VOXEL_GRID
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <octomap/octomap.h>
+#include <ros/ros.h>
+
+// flat 3D grid with 2 bits per voxel (free/unknown/occupied), aligned with the OcTree keys, plus a 32 bit count
+// of the unknown cells before every word of 16 cells, so 4 bits per voxel in all.
+// built once per map snapshot over the exploration box (plus a margin), so the ray casting
+// and the unknown membership tests are array lookups instead of octree descents.
+// keys outside of the grid fall back to the octrees it was built from.
+class denseVoxelGrid
+{
+public:
+	enum cellState
+	{
+		cell_free = 0,
+		cell_unknown = 1,
+		cell_occupied = 2
+	};
+
+	octomap::OcTreeKey min_key;
+	int size_x, size_y, size_z;
+	double resolution;
+
+	// 16 cells per word
+	std::vector<uint32_t> words;
+
+	// unknown cells before every word, unknownId() is the rank of a cell among the unknown ones
+	std::vector<int32_t> word_ranks;
+	int32_t n_unknown;
+
+	// world coordinates of the lower corner of the first cell
+	octomap::point3d corner;
+
+	const octomap::OcTree *known_tree;
+	const octomap::OcTree *unknown_tree;
+
+	denseVoxelGrid()
+	{
+		size_x = size_y = size_z = 0;
+		n_unknown = 0;
+		resolution = 0;
+		known_tree = NULL;
+		unknown_tree = NULL;
+	}
+
+	bool empty() const
+	{
+		return words.empty();
+	}
+
+	void clear()
+	{
+		words.clear();
+		word_ranks.clear();
+		n_unknown = 0;
+		size_x = size_y = size_z = 0;
+		known_tree = NULL;
+		unknown_tree = NULL;
+	}
+
+	void build(const octomap::OcTree *known, const octomap::OcTree *unknown, const octomap::point3d &min_bbx,
+			   const octomap::point3d &max_bbx, double margin)
+	{
+		using namespace octomap;
+
+		known_tree = known;
+		unknown_tree = unknown;
+		resolution = known->getResolution();
+
+		point3d pad(margin, margin, margin);
+		OcTreeKey max_key;
+
+		if (!known->coordToKeyChecked(min_bbx - pad, min_key) || !known->coordToKeyChecked(max_bbx + pad, max_key))
+		{
+			ROS_WARN("Dense grid box out of the octree bounds, not using it.");
+			clear();
+			return;
+		}
+
+		size_x = max_key[0] - min_key[0] + 1;
+		size_y = max_key[1] - min_key[1] + 1;
+		size_z = max_key[2] - min_key[2] + 1;
+
+		words.assign(((size_t)size_x * size_y * size_z + 15) / 16, 0);
+
+		// unknown first, so occupied voxels win over a stale unknown map
+		if (unknown != NULL)
+		{
+			fillLeafs(unknown, min_key, max_key, false);
+		}
+
+		fillLeafs(known, min_key, max_key, true);
+
+		corner = known->keyToCoord(min_key) - point3d(1, 1, 1) * (0.5 * resolution);
+
+		assignUnknownIds();
+	}
+
+	// downsampled copy of fine, every cell covers 2^level fine cells per axis. a coarse cell is occupied if any of
+	// its fine cells is, otherwise unknown if any of them is. the coarse keys are the fine keys shifted by level,
+	// there are no octrees behind it so only keys inside of it can be looked up
+	void buildCoarse(const denseVoxelGrid &fine, unsigned level)
+	{
+		clear();
+
+		if (fine.empty())
+		{
+			return;
+		}
+
+		resolution = fine.resolution * (1 << level);
+
+		octomap::OcTreeKey max_key;
+
+		for (unsigned i = 0; i < 3; i++)
+		{
+			min_key[i] = fine.min_key[i] >> level;
+		}
+
+		max_key[0] = (fine.min_key[0] + fine.size_x - 1) >> level;
+		max_key[1] = (fine.min_key[1] + fine.size_y - 1) >> level;
+		max_key[2] = (fine.min_key[2] + fine.size_z - 1) >> level;
+
+		size_x = max_key[0] - min_key[0] + 1;
+		size_y = max_key[1] - min_key[1] + 1;
+		size_z = max_key[2] - min_key[2] + 1;
+
+		words.assign((cells() + 15) / 16, 0);
+
+		for (int z = 0; z < fine.size_z; z++)
+		{
+			for (int y = 0; y < fine.size_y; y++)
+			{
+				for (int x = 0; x < fine.size_x; x++)
+				{
+					uint8_t fine_state = fine.cell((size_t)x + (size_t)fine.size_x * (y + (size_t)fine.size_y * z));
+
+					if (fine_state == cell_free)
+					{
+						continue;
+					}
+
+					size_t idx = (size_t)(((fine.min_key[0] + x) >> level) - min_key[0]) +
+								 (size_t)size_x * ((((fine.min_key[1] + y) >> level) - min_key[1]) +
+												   (size_t)size_y * (((fine.min_key[2] + z) >> level) - min_key[2]));
+
+					if (fine_state > cell(idx))
+					{
+						setCell(idx, fine_state);
+					}
+				}
+			}
+		}
+
+		// lower corner of the coarse cell min_key, in the fine key space that is min_key << level
+		corner = fine.corner - octomap::point3d(fine.min_key[0] - (min_key[0] << level), fine.min_key[1] - (min_key[1] << level),
+												fine.min_key[2] - (min_key[2] << level)) *
+								   fine.resolution;
+
+		assignUnknownIds();
+	}
+
+	size_t cells() const
+	{
+		return (size_t)size_x * size_y * size_z;
+	}
+
+	inline bool contains(const octomap::OcTreeKey &key) const
+	{
+		return (unsigned)(key[0] - min_key[0]) < (unsigned)size_x && (unsigned)(key[1] - min_key[1]) < (unsigned)size_y &&
+			   (unsigned)(key[2] - min_key[2]) < (unsigned)size_z;
+	}
+
+	inline size_t index(const octomap::OcTreeKey &key) const
+	{
+		return (size_t)(key[0] - min_key[0]) + (size_t)size_x * ((key[1] - min_key[1]) + (size_t)size_y * (key[2] - min_key[2]));
+	}
+
+	inline uint8_t cell(size_t idx) const
+	{
+		return (words[idx >> 4] >> ((idx & 15) << 1)) & 3;
+	}
+
+	// the ids are not updated, assignUnknownIds() once after the changes
+	inline void setCell(size_t idx, uint8_t state)
+	{
+		uint32_t shift = (idx & 15) << 1;
+
+		words[idx >> 4] = (words[idx >> 4] & ~(3u << shift)) | ((uint32_t)state << shift);
+	}
+
+	// dense id in [0, n_unknown) of an unknown cell, for per-voxel bookkeeping in flat arrays. -1 for the others
+	inline int32_t unknownId(size_t idx) const
+	{
+		uint32_t word = words[idx >> 4];
+		uint32_t shift = (idx & 15) << 1;
+
+		if (((word >> shift) & 3) != cell_unknown)
+		{
+			return -1;
+		}
+
+		return word_ranks[idx >> 4] + __builtin_popcount(unknownMask(word) & ((1u << shift) - 1));
+	}
+
+	void assignUnknownIds()
+	{
+		word_ranks.resize(words.size());
+		n_unknown = 0;
+
+		for (size_t word_idx = 0; word_idx < words.size(); word_idx++)
+		{
+			word_ranks[word_idx] = n_unknown;
+			n_unknown += __builtin_popcount(unknownMask(words[word_idx]));
+		}
+	}
+
+	uint8_t state(const octomap::OcTreeKey &key) const
+	{
+		if (contains(key))
+		{
+			return cell(index(key));
+		}
+
+		if (known_tree == NULL)
+		{
+			return cell_free;
+		}
+
+		octomap::OcTreeNode *node = known_tree->search(key);
+
+		if (node != NULL && known_tree->isNodeOccupied(node))
+		{
+			return cell_occupied;
+		}
+
+		if (unknown_tree != NULL && unknown_tree->search(key) != NULL)
+		{
+			return cell_unknown;
+		}
+
+		return cell_free;
+	}
+
+	inline bool isUnknown(const octomap::OcTreeKey &key) const
+	{
+		if (contains(key))
+		{
+			return cell(index(key)) == cell_unknown;
+		}
+
+		return unknown_tree != NULL && unknown_tree->search(key) != NULL;
+	}
+
+	inline bool isOccupied(const octomap::OcTreeKey &key) const
+	{
+		if (contains(key))
+		{
+			return cell(index(key)) == cell_occupied;
+		}
+
+		if (known_tree == NULL)
+		{
+			return false;
+		}
+
+		octomap::OcTreeNode *node = known_tree->search(key);
+
+		return node != NULL && known_tree->isNodeOccupied(node);
+	}
+
+	// same traversal and results as OcTree::castRay(origin, direction, end, true, max_range)
+	bool castRay(const octomap::point3d &origin, const octomap::point3d &direction_in, octomap::point3d &end,
+				 double max_range) const
+	{
+		using namespace octomap;
+
+		OcTreeKey current_key;
+
+		if (!known_tree->coordToKeyChecked(origin, current_key))
+		{
+			return false;
+		}
+
+		if (isOccupied(current_key))
+		{
+			end = known_tree->keyToCoord(current_key);
+			return true;
+		}
+
+		point3d direction = direction_in.normalized();
+		bool max_range_set = (max_range > 0.0);
+
+		int step[3];
+		double t_max[3];
+		double t_delta[3];
+
+		for (unsigned i = 0; i < 3; i++)
+		{
+			if (direction(i) > 0.0)
+				step[i] = 1;
+			else if (direction(i) < 0.0)
+				step[i] = -1;
+			else
+				step[i] = 0;
+
+			if (step[i] != 0)
+			{
+				double voxel_border = known_tree->keyToCoord(current_key[i]);
+				voxel_border += double(step[i] * resolution * 0.5);
+
+				t_max[i] = (voxel_border - origin(i)) / direction(i);
+				t_delta[i] = resolution / fabs(direction(i));
+			}
+			else
+			{
+				t_max[i] = std::numeric_limits<double>::max();
+				t_delta[i] = std::numeric_limits<double>::max();
+			}
+		}
+
+		if (step[0] == 0 && step[1] == 0 && step[2] == 0)
+		{
+			return false;
+		}
+
+		double max_range_sq = max_range * max_range;
+
+		while (true)
+		{
+			unsigned dim;
+
+			if (t_max[0] < t_max[1])
+				dim = (t_max[0] < t_max[2]) ? 0 : 2;
+			else
+				dim = (t_max[1] < t_max[2]) ? 1 : 2;
+
+			if ((step[dim] < 0 && current_key[dim] == 0) || (step[dim] > 0 && current_key[dim] == 0xFFFF))
+			{
+				end = known_tree->keyToCoord(current_key);
+				return false;
+			}
+
+			current_key[dim] += step[dim];
+			t_max[dim] += t_delta[dim];
+
+			end = known_tree->keyToCoord(current_key);
+
+			if (max_range_set)
+			{
+				point3d delta = end - origin;
+
+				if (delta.x() * delta.x() + delta.y() * delta.y() + delta.z() * delta.z() > max_range_sq)
+				{
+					return false;
+				}
+			}
+
+			if (isOccupied(current_key))
+			{
+				return true;
+			}
+		}
+	}
+
+private:
+	// the low bit of every unknown (01) cell of a word, the padding cells of the last word are free
+	static inline uint32_t unknownMask(uint32_t word)
+	{
+		return word & ~(word >> 1) & 0x55555555u;
+	}
+
+	// marks every voxel covered by the leafs of tree inside [min, max], pruned leafs included
+	void fillLeafs(const octomap::OcTree *tree, const octomap::OcTreeKey &min, const octomap::OcTreeKey &max,
+				   bool known)
+	{
+		using namespace octomap;
+
+		unsigned max_depth = tree->getTreeDepth();
+
+		for (OcTree::leaf_bbx_iterator it = tree->begin_leafs_bbx(min, max), end = tree->end_leafs_bbx(); it != end; ++it)
+		{
+			uint8_t state = cell_unknown;
+
+			if (known)
+			{
+				state = tree->isNodeOccupied(*it) ? cell_occupied : cell_free;
+			}
+
+			// a leaf at depth d spans 2^(max_depth - d) keys per axis
+			int span = 1 << (max_depth - it.getDepth());
+			OcTreeKey first = tree->coordToKey(it.getCoordinate() - point3d(1, 1, 1) * (0.5 * (span - 1) * resolution));
+
+			int x_begin = std::max<int>(first[0], min[0]), x_end = std::min<int>(first[0] + span - 1, max[0]);
+			int y_begin = std::max<int>(first[1], min[1]), y_end = std::min<int>(first[1] + span - 1, max[1]);
+			int z_begin = std::max<int>(first[2], min[2]), z_end = std::min<int>(first[2] + span - 1, max[2]);
+
+			for (int z = z_begin; z <= z_end; z++)
+			{
+				for (int y = y_begin; y <= y_end; y++)
+				{
+					for (int x = x_begin; x <= x_end; x++)
+					{
+						size_t idx = index(OcTreeKey(x, y, z));
+
+						// free space never hides what the unknown map says
+						if (state != cell_free || cell(idx) != cell_unknown)
+						{
+							setCell(idx, state);
+						}
+					}
+				}
+			}
+		}
+	}
+};
+
+#endif // SMOBEX_EXPLORER_DENSE_VOXEL_GRID
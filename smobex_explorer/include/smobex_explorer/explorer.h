@@ -1,3 +1,6 @@
+#ifndef SMOBEX_EXPLORER_EXPLORER
+#define SMOBEX_EXPLORER_EXPLORER
+
 #include <geometry_msgs/Point.h>
 #include <geometry_msgs/PoseArray.h>
 #include <sensor_msgs/CameraInfo.h>
@@ -7,14 +10,16 @@
 #include <math.h>
 #include <ros/ros.h>
 #include <cmath>
+#include <functional>
+#include <unordered_map>
 
 #include <tf/LinearMath/Quaternion.h>
 #include <tf/LinearMath/Vector3.h>
 #include <tf/tf.h>
 #include <tf/transform_datatypes.h>
+#include <tf/transform_listener.h>
 #include <tf_conversions/tf_eigen.h>
 
-#include <pcl-1.8/pcl/filters/frustum_culling.h>
 #include <pcl/point_types.h>
 #include <pcl_ros/point_cloud.h>
 #include <pcl_ros/transforms.h>
@@ -35,6 +40,20 @@
 
 #include <colormap/colormap.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <smobex_explorer/dense_voxel_grid.h>
+#include <smobex_explorer/frustum_culler.h>
+#include <smobex_explorer/map_snapshot.h>
+#include <smobex_explorer/packet_ray_caster.h>
+#include <smobex_explorer/shared_octree_registry.h>
+#include <smobex_explorer/spherical_visibility_map.h>
+#include <smobex_explorer/unknown_bvh.h>
+#include <smobex_explorer/unknown_space_extractor.h>
+#include <smobex_explorer/unknown_voxel_table.h>
+
 // #include "Eigen/Core"
 // #include "Eigen/Geometry"
 
@@ -118,45 +137,43 @@ public:
 	}
 };
 
-class unknownVoxel
+inline bool compareVoxelDistance(unknownVoxel const &a, unknownVoxel const &b)
 {
+	return a.distance_to_camera > b.distance_to_camera;
+}
 
+// everything written while ray casting one pose
+class poseEvalScratch
+{
 public:
-	octomap::OcTreeKey key;
-	octomap::point3d center;
-	double distance_to_camera;
-	bool to_visit;
-	size_t map_key;
+	unknownVoxelTable unknown_voxels;
+	std::vector<size_t> visit_order;
+	std::vector<uint32_t> inside_ids;
+	pcl::PointCloud<pcl::PointXYZ> points_inside;
+	octomap::KeyRay ray_keys_before, ray_keys_after;
+
+	octomap::KeySet first_keys;
+	octomap::KeySet posterior_keys;
+	octomap::point3d_list ray_points_list;
+	bool record_rays;
 
-	unknownVoxel()
+	packetRayScratch packet;
+	std::vector<octomap::OcTreeKey> packet_targets;
+	std::vector<std::pair<float, uint32_t> > packet_order;
+
+	poseEvalScratch()
 	{
-		to_visit = true;
+		record_rays = false;
 	}
-
-	bool operator==(const unknownVoxel &rhs) const { return this->key == rhs.key; }
-	bool operator==(const octomap::OcTreeKey &rhs) const { return this->key == rhs; }
 };
 
-typedef std::map<size_t, unknownVoxel> map_type;
-
-bool compareVoxelDistance(unknownVoxel const &a, unknownVoxel const &b)
-{
-	return a.distance_to_camera > b.distance_to_camera;
-	// return a->second.distance_to_camera > b->second.distance_to_camera;
-}
-
-bool compareVoxelDistanceIterator(map_type::iterator const &a, map_type::iterator const &b)
-{
-	// return a.distance_to_camera > b.distance_to_camera;
-	return a->second.distance_to_camera > b->second.distance_to_camera;
-}
-
 class evaluatePose : public generatePose
 {
 public:
 	float score = 0;
 	std_msgs::ColorRGBA score_color;
 
+	// pixel based mode: one ray every step pixels of the depth image, 0 disables it
 	int step;
 	float min_range;
 	float max_range;
@@ -171,18 +188,106 @@ public:
 	octomap::KeySet first_keys;
 	octomap::KeySet posterior_keys;
 
+	// reused by every evalPose() call, evalPoses() keeps one per thread
+	poseEvalScratch scratch;
+	std::vector<poseEvalScratch> thread_scratch;
+
 	pcl::PointCloud<pcl::PointXYZ> rays_point_cloud_world;
 	pcl::PointCloud<pcl::PointXYZ> unknown_centers_pcl;
+	// morton ordered copy of the unknown centers and the tree over it, rebuilt by writeUnknownCloud
+	pointsSoA unknown_centers_soa;
+	mortonBVH unknown_bvh;
 
 	octomap::point3d min_bbx, max_bbx;
 
+	// flat copy of both octrees over the exploration box, rebuilt after every map write.
+	// the margin should cover the camera positions, evalPoses() only walks rays in packets from inside the grid
+	denseVoxelGrid dense_grid;
+	bool use_dense_grid = true;
+	bool dense_grid_stale = true;
+	double dense_grid_margin = 1.5;
+	bool use_packet_rays = true;
+
+	// coarse to fine: evalPosesCoarseToFine() scores every pose on a grid coarse_level octree depths above the leafs
+	// and only re-scores the best coarse_keep_ratio of them at full resolution (0 disables it)
+	int coarse_level = 0;
+	float coarse_keep_ratio = 0.2;
+	denseVoxelGrid coarse_grid;
+	pointsSoA coarse_centers;
+	mortonBVH coarse_bvh;
+	int coarse_grid_level = -1;
+
+	// incremental maps: refreshMaps() integrates the latest camera cloud into the octrees held here instead of
+	// downloading both full maps, which it only does every full_resync_period refreshes. the candidate pool of the
+	// action server needs it
+	bool incremental_maps = false;
+	int full_resync_period = 10;
+	int refreshes_since_resync = 0;
+	double sensor_max_range = -1;
+	octomap::KeySet last_changed_keys;
+	boost::shared_ptr<tf::TransformListener> tf_listener;
+	// unknown_centers_soa index of every unknown center, built on the first integration after writeUnknownCloud
+	std::unordered_map<octomap::OcTreeKey, uint32_t, octomap::OcTreeKey::KeyHash> unknown_center_index;
+	bool unknown_center_index_stale = true;
+	// the centers that left and joined the unknown set since the last takeUnknownChanges(), complete unless the
+	// unknown centers were rebuilt in between
+	pcl::PointCloud<pcl::PointXYZ> known_since_take, unknown_since_take;
+	bool unknown_changes_complete = false;
+	// the box of every voxel applyKnownKeys() changed since the last takeChangedBox(), whatever the change was.
+	// complete unless the maps were replaced in between
+	octomap::point3d changed_min = octomap::point3d(1e9, 1e9, 1e9);
+	octomap::point3d changed_max = octomap::point3d(-1e9, -1e9, -1e9);
+	bool changed_box_complete = false;
+	// set by predictView() until the real maps are back
+	bool maps_predicted = false;
+
+	// extract_unknown: the unknown tree and centers are computed here from the known tree, instead of read from
+	// /unknown_full_map and /unknown_pc, so all of them come from the same map
+	bool extract_unknown = false;
+	unknownSpaceExtractor unknown_extractor;
+
+	// map snapshots: when set, refreshMaps() swaps in the snapshots built in the background by the manager
+	// instead of downloading the maps itself. requestMaps() asks for one, the next refreshMaps() waits for it
+	mapSnapshotManager *snapshot_manager = NULL;
+	unsigned long map_version = 0;
+	unsigned long requested_map_version = 0;
+	double snapshot_timeout = 10;
+	// how long writeKnownOctomap() waits for the tree of a shared octomap server nodelet
+	double shared_map_timeout = 1;
+
 	evaluatePose(/*int _step,*/ float _min_range, float _max_range, float _width_FOV, float _height_FOV)
 	{
+		step = 0;
+		pix_width = 0;
+		pix_height = 0;
+		min_range = _min_range;
+		max_range = _max_range;
+		width_FOV = _width_FOV;
+		height_FOV = _height_FOV;
+
+		readParams();
+	}
+
+	evaluatePose(int _step, float _min_range, float _max_range, float _width_FOV, float _height_FOV)
+	{
+		pix_width = 0;
+		pix_height = 0;
 		min_range = _min_range;
 		max_range = _max_range;
 		width_FOV = _width_FOV;
 		height_FOV = _height_FOV;
 
+		setPixelStep(_step);
+
+		// rays_point_cloud.push_back(pcl::PointXYZ(-0.01, 0, 0.8));
+		// rays_point_cloud.push_back(pcl::PointXYZ(0.01, 0, 0.8));
+		// pcl_ros::transformPointCloud(rays_point_cloud, rays_point_cloud, view_pose);
+
+		readParams();
+	}
+
+	void readParams()
+	{
 		ros::param::get("x_max", max_bbx.x());
 		ros::param::get("y_max", max_bbx.y());
 		ros::param::get("z_max", max_bbx.z());
@@ -190,455 +295,1478 @@ public:
 		ros::param::get("x_min", min_bbx.x());
 		ros::param::get("y_min", min_bbx.y());
 		ros::param::get("z_min", min_bbx.z());
+
+		// in process with the octomap server the unknown space is extracted here from the shared tree, and both
+		// follow the camera clouds between two resyncs. the params still decide when they are set
+		if (sharedOctreeRegistry::instance().advertised("/octomap_full"))
+		{
+			extract_unknown = true;
+			incremental_maps = true;
+		}
+
+		ros::param::get("extract_unknown", extract_unknown);
+		unknown_extractor.setBox(min_bbx, max_bbx);
+
+		ros::param::get("dense_grid_margin", dense_grid_margin);
+		ros::param::get("coarse_level", coarse_level);
+		ros::param::get("coarse_keep_ratio", coarse_keep_ratio);
+
+		ros::param::get("incremental_maps", incremental_maps);
+		ros::param::get("full_resync_period", full_resync_period);
+		ros::param::get("sensor_max_range", sensor_max_range);
+		ros::param::get("snapshot_timeout", snapshot_timeout);
+		ros::param::get("shared_map_timeout", shared_map_timeout);
 	}
 
-	evaluatePose(int _step, float _min_range, float _max_range, float _width_FOV, float _height_FOV)
+	// (re)builds the ray directions of the pixel based mode, in the camera frame.
+	// evalPoses() uses the pixel based mode whenever _step > 0
+	void setPixelStep(int _step)
 	{
 		step = _step;
-		min_range = _min_range;
-		max_range = _max_range;
-		width_FOV = _width_FOV;
-		height_FOV = _height_FOV;
+
+		rays_point_cloud_world.clear();
+
+		if (step <= 0)
+		{
+			return;
+		}
+
+		if (pix_width <= 0 || pix_height <= 0)
+		{
+			ros::NodeHandle n;
+			sensor_msgs::CameraInfoConstPtr CamInfo;
+
+			CamInfo = ros::topic::waitForMessage<sensor_msgs::CameraInfo>("/camera/depth_registered/camera_info", n,
+																		  ros::Duration(10));
+
+			if (CamInfo != NULL)
+			{
+				pix_width = CamInfo->width;
+				pix_height = CamInfo->height;
+			}
+			else
+			{
+				ROS_WARN("No camera info received, assuming a 640x480 depth image.");
+
+				pix_width = 640;
+				pix_height = 480;
+			}
+		}
+
+		float delta_rad_w = width_FOV / pix_width;
+		float delta_rad_h = height_FOV / pix_height;
+
+		// generate the points of the camera rays
+		float rad_h = (M_PI - height_FOV) / 2;
+
+		for (int row_pix = 0; row_pix < pix_height; row_pix += step)
+		{
+			float rad_w = (M_PI - width_FOV) / 2;
+
+			for (int col_pix = 0; col_pix < pix_width; col_pix += step)
+			{
+				float x = 1 * sin(rad_h) * cos(rad_w);
+				float z = 1 * sin(rad_h) * sin(rad_w);
+				float y = 1 * cos(rad_h);
+
+				rays_point_cloud_world.push_back(pcl::PointXYZ(x, y, z));
+
+				rad_w += delta_rad_w * step;
+			}
+			rad_h += delta_rad_h * step;
+		}
+	}
+
+	// void writeKnownOctomapCallback(const octomap_msgs::OctomapConstPtr &map)
+	// {
+	//     using namespace octomap;
+
+	//     // ROS_INFO("I'm inside the callback");
+
+	//     AbstractOcTree *tree = NULL;
+
+	//     if (octree != NULL)
+	//     {
+	//         // ROS_INFO("DEBUG: Going to DEL OCTREE");
+	//         delete (octree);
+	//         // ROS_INFO("DEBUG: Octree DEL");
+	//     }
+
+	//     tree = msgToMap(*map);
+	//     octree = dynamic_cast<OcTree *>(tree);
+	// }
+
+	// void writeUnknownOctomapCallback(const octomap_msgs::OctomapConstPtr &map)
+	// {
+	//     using namespace octomap;
+
+	//     // ROS_INFO("I'm inside the callback");
+
+	//     AbstractOcTree *tree = NULL;
+
+	//     if (unknown_octree != NULL)
+	//     {
+	//         // ROS_INFO("DEBUG: Going to DEL OCTREE");
+	//         delete (unknown_octree);
+	//         // ROS_INFO("DEBUG: Octree DEL");
+	//     }
+
+	//     tree = msgToMap(*map);
+	//     unknown_octree = dynamic_cast<OcTree *>(tree);
+	// }
+
+	void writeKnownOctomap()
+	{
+		using namespace octomap;
+
+		ros::NodeHandle n;
+
+		AbstractOcTree *tree = NULL;
+
+		if (octree != NULL)
+		{
+			delete (octree);
+			octree = NULL;
+		}
+
+		dense_grid_stale = true;
+		markMapsReplaced();
+
+		// a shared octomap server nodelet in this process hands its tree over without serializing it
+		sharedOctreeRegistry &registry = sharedOctreeRegistry::instance();
+
+		if (registry.advertised("/octomap_full"))
+		{
+			registry.request("/octomap_full");
+			octree = registry.take("/octomap_full", ros::Duration(shared_map_timeout));
+
+			if (octree != NULL)
+			{
+				return;
+			}
+
+			ROS_WARN("No shared octree in time, reading /octomap_full.");
+		}
+
+		octomap_msgs::OctomapConstPtr map = ros::topic::waitForMessage<octomap_msgs::Octomap>("/octomap_full", n);
+		tree = msgToMap(*map);
+		octree = dynamic_cast<OcTree *>(tree);
+	}
+
+	void writeUnknownOctomap()
+	{
+		using namespace octomap;
+
+		if (extract_unknown)
+		{
+			if (octree == NULL)
+			{
+				writeKnownOctomap();
+			}
+
+			extractUnknownSpace();
+			return;
+		}
+
+		ros::NodeHandle n;
+
+		AbstractOcTree *tree = NULL;
+
+		if (unknown_octree != NULL)
+		{
+			delete (unknown_octree);
+		}
+
+		octomap_msgs::OctomapConstPtr map = ros::topic::waitForMessage<octomap_msgs::Octomap>("/unknown_full_map", n);
+		tree = msgToMap(*map);
+		unknown_octree = dynamic_cast<OcTree *>(tree);
+
+		dense_grid_stale = true;
+		markMapsReplaced();
+	}
+
+	void writeUnknownCloud()
+	{
+		// extracted along with the unknown tree
+		if (extract_unknown)
+		{
+			if (unknown_octree == NULL)
+			{
+				writeUnknownOctomap();
+			}
+
+			return;
+		}
 
 		ros::NodeHandle n;
-		sensor_msgs::CameraInfoConstPtr CamInfo;
 
-		CamInfo = ros::topic::waitForMessage<sensor_msgs::CameraInfo>("/camera/depth_registered/camera_info", n,
-																	  ros::Duration(10));
+		sensor_msgs::PointCloud2ConstPtr unknown_cloud =
+			ros::topic::waitForMessage<sensor_msgs::PointCloud2>("/unknown_pc", n);
+
+		pcl::fromROSMsg(*unknown_cloud, unknown_centers_pcl);
+		unknown_centers_soa.assign(unknown_centers_pcl);
+		unknown_bvh.build(unknown_centers_soa);
+		markUnknownRebuilt();
+	}
+
+	void writeUnknownCloud(sensor_msgs::PointCloud2ConstPtr unknown_cloud)
+	{
+		if (extract_unknown)
+		{
+			writeUnknownCloud();
+			return;
+		}
+
+		pcl::fromROSMsg(*unknown_cloud, unknown_centers_pcl);
+		unknown_centers_soa.assign(unknown_centers_pcl);
+		unknown_bvh.build(unknown_centers_soa);
+		markUnknownRebuilt();
+	}
+
+	// the unknown centers were replaced, not updated
+	void markUnknownRebuilt()
+	{
+		unknown_center_index_stale = true;
+
+		known_since_take.clear();
+		unknown_since_take.clear();
+		unknown_changes_complete = false;
+
+		markMapsReplaced();
+	}
+
+	// the maps were replaced, not updated, so the changes since the last takeChangedBox() are not known
+	void markMapsReplaced()
+	{
+		changed_min = octomap::point3d(1e9, 1e9, 1e9);
+		changed_max = octomap::point3d(-1e9, -1e9, -1e9);
+		changed_box_complete = false;
+	}
+
+	// the box of the voxel centers changed since the last call, empty (min above max) when none was. false when
+	// the maps were replaced in between or on the first call, then anything may have changed
+	bool takeChangedBox(octomap::point3d &box_min, octomap::point3d &box_max)
+	{
+		bool complete = changed_box_complete;
+
+		box_min = changed_min;
+		box_max = changed_max;
+
+		markMapsReplaced();
+		changed_box_complete = true;
+
+		return complete;
+	}
+
+	// the centers that left (now_known) and joined (now_unknown) the unknown set since the last call, so a
+	// consumer of the unknown cloud can follow it by the changes. false when they are not all there, after a
+	// rebuild of the unknown centers or on the first call, then the whole cloud has to be read again
+	bool takeUnknownChanges(pcl::PointCloud<pcl::PointXYZ> &now_known, pcl::PointCloud<pcl::PointXYZ> &now_unknown)
+	{
+		bool complete = unknown_changes_complete;
+
+		now_known.clear();
+		now_unknown.clear();
+		std::swap(now_known, known_since_take);
+		std::swap(now_unknown, unknown_since_take);
+
+		unknown_changes_complete = true;
+
+		return complete;
+	}
+
+	// the unknown tree and centers of the known tree held now
+	void extractUnknownSpace()
+	{
+		if (unknown_octree != NULL)
+		{
+			delete (unknown_octree);
+		}
+
+		unknown_octree = unknown_extractor.extract(*octree, unknown_centers_pcl);
+
+		unknown_centers_soa.assign(unknown_centers_pcl);
+		unknown_bvh.build(unknown_centers_soa);
+		markUnknownRebuilt();
+		dense_grid_stale = true;
+	}
+
+	// the unknown centers that are still unknown, like octomap_bounding_box publishes them on /unknown_pc
+	sensor_msgs::PointCloud2Ptr unknownCloudMsg(const std::string &frame_id) const
+	{
+		pcl::PointCloud<pcl::PointXYZ> cloud;
+		unknownCloud(cloud);
+
+		sensor_msgs::PointCloud2Ptr msg(new sensor_msgs::PointCloud2);
+		pcl::toROSMsg(cloud, *msg);
+		msg->header.frame_id = frame_id;
+		msg->header.stamp = ros::Time::now();
+
+		return msg;
+	}
+
+	void unknownCloud(pcl::PointCloud<pcl::PointXYZ> &cloud) const
+	{
+		cloud.clear();
+		cloud.reserve(unknown_centers_soa.size() - unknown_centers_soa.n_removed);
+
+		for (size_t idx = 0; idx < unknown_centers_soa.size(); idx++)
+		{
+			// integrateCloud() removes the centers seen since
+			if (!unknown_centers_soa.isRemoved(idx))
+			{
+				cloud.push_back(pcl::PointXYZ(unknown_centers_soa.x[idx], unknown_centers_soa.y[idx],
+											  unknown_centers_soa.z[idx]));
+			}
+		}
+	}
+
+	// brings the octrees and the unknown cloud up to date. downloads everything on the first call, every
+	// full_resync_period calls and when no camera cloud arrives, otherwise only integrates the latest camera cloud.
+	// unknown_cloud is used for the full resync when given
+	void refreshMaps(sensor_msgs::PointCloud2ConstPtr unknown_cloud = sensor_msgs::PointCloud2ConstPtr())
+	{
+		if (snapshot_manager != NULL)
+		{
+			// without a pending request the newest snapshot is taken only if it is already built
+			bool pending = requested_map_version > map_version;
+			unsigned long min_version = pending ? requested_map_version - 1 : map_version;
+
+			if (!useSnapshot(min_version, ros::Duration(pending ? snapshot_timeout : 0)) && pending)
+			{
+				ROS_WARN_STREAM("Map snapshot " << requested_map_version << " not ready, keeping version " << map_version);
+			}
+
+			// a predicted map is never kept as the real one, without a snapshot the maps are downloaded below
+			if (!maps_predicted)
+			{
+				return;
+			}
+
+			ROS_WARN("No map snapshot in place of the predicted maps, downloading them.");
+		}
+
+		// a predicted map is never integrated into, it is replaced
+		if (!incremental_maps || maps_predicted || octree == NULL || unknown_octree == NULL ||
+			refreshes_since_resync >= full_resync_period || !integrateCameraCloud())
+		{
+			maps_predicted = false;
+
+			writeKnownOctomap();
+			writeUnknownOctomap();
+
+			if (unknown_cloud)
+			{
+				writeUnknownCloud(unknown_cloud);
+			}
+			else
+			{
+				writeUnknownCloud();
+			}
+
+			refreshes_since_resync = 0;
+			return;
+		}
+
+		refreshes_since_resync++;
+	}
+
+	// asks the snapshot manager for maps taken from now on, for the next refreshMaps()
+	void requestMaps()
+	{
+		if (snapshot_manager != NULL)
+		{
+			requested_map_version = snapshot_manager->requestRefresh();
+		}
+	}
+
+	// swaps in the newest snapshot newer than min_version, the maps held until now go back to the manager
+	bool useSnapshot(unsigned long min_version, ros::Duration timeout)
+	{
+		mapSnapshotPtr snapshot = snapshot_manager->take(min_version, timeout);
+
+		if (!snapshot)
+		{
+			return false;
+		}
+
+		swapSnapshot(*snapshot);
+		snapshot_manager->recycle(snapshot);
+
+		return true;
+	}
+
+	// O(1): only pointers and buffers change hands
+	void swapSnapshot(mapSnapshot &snapshot)
+	{
+		std::swap(octree, snapshot.known_tree);
+		std::swap(unknown_octree, snapshot.unknown_tree);
+
+		unknown_centers_pcl.swap(snapshot.unknown_centers_pcl);
+		std::swap(unknown_centers_soa, snapshot.unknown_centers_soa);
+		std::swap(unknown_bvh, snapshot.unknown_bvh);
+		std::swap(dense_grid, snapshot.dense_grid);
+
+		dense_grid_stale = dense_grid.empty();
+		coarse_grid_level = -1;
+		markUnknownRebuilt();
+		maps_predicted = false;
+		map_version = snapshot.version;
+	}
+
+	// waits for one cloud on point_cloud_in and integrates it from the sensor pose at that time
+	bool integrateCameraCloud()
+	{
+		ros::NodeHandle n;
+
+		std::string cloud_topic = "/camera/depth_registered/points";
+		std::string fixed_frame = "/base_link";
+
+		ros::param::get("point_cloud_in", cloud_topic);
+		ros::param::get("fixed_frame_id", fixed_frame);
+
+		if (!tf_listener)
+		{
+			tf_listener.reset(new tf::TransformListener);
+		}
+
+		sensor_msgs::PointCloud2ConstPtr cloud_msg =
+			ros::topic::waitForMessage<sensor_msgs::PointCloud2>(cloud_topic, n, ros::Duration(5));
+
+		if (!cloud_msg)
+		{
+			ROS_WARN("No camera cloud on %s, downloading the full maps.", cloud_topic.c_str());
+			return false;
+		}
+
+		tf::StampedTransform sensor_transform;
+		pcl::PointCloud<pcl::PointXYZ> cloud, cloud_world;
+
+		try
+		{
+			tf_listener->waitForTransform(fixed_frame, cloud_msg->header.frame_id, cloud_msg->header.stamp, ros::Duration(1));
+			tf_listener->lookupTransform(fixed_frame, cloud_msg->header.frame_id, cloud_msg->header.stamp, sensor_transform);
+		}
+		catch (tf::TransformException &ex)
+		{
+			ROS_WARN("%s", ex.what());
+			return false;
+		}
+
+		pcl::fromROSMsg(*cloud_msg, cloud);
+		pcl_ros::transformPointCloud(cloud, cloud_world, sensor_transform);
+
+		integrateCloud(cloud_world, octomap::pointTfToOctomap(sensor_transform.getOrigin()));
+
+		return true;
+	}
+
+	// inserts a cloud (in the map frame) into the known octree. every voxel it changes is taken out of the unknown
+	// octree, the unknown cloud and the dense grid, so the cost follows the size of the cloud and not of the maps
+	void integrateCloud(const pcl::PointCloud<pcl::PointXYZ> &cloud, const octomap::point3d &sensor_origin)
+	{
+		using namespace octomap;
+
+		checkOctrees();
+
+		Pointcloud scan;
+
+		for (pcl::PointCloud<pcl::PointXYZ>::const_iterator it = cloud.begin(); it != cloud.end(); it++)
+		{
+			if (std::isfinite(it->x) && std::isfinite(it->y) && std::isfinite(it->z))
+			{
+				scan.push_back(it->x, it->y, it->z);
+			}
+		}
+
+		KeySet free_cells, occupied_cells;
+		octree->computeUpdate(scan, sensor_origin, free_cells, occupied_cells, sensor_max_range);
+
+		last_changed_keys.clear();
+
+		for (KeySet::iterator it = free_cells.begin(); it != free_cells.end(); it++)
+		{
+			if (occupied_cells.find(*it) == occupied_cells.end())
+			{
+				octree->updateNode(*it, false);
+				last_changed_keys.insert(*it);
+			}
+		}
+
+		for (KeySet::iterator it = occupied_cells.begin(); it != occupied_cells.end(); it++)
+		{
+			octree->updateNode(*it, true);
+			last_changed_keys.insert(*it);
+		}
+
+		applyKnownKeys(last_changed_keys);
+	}
+
+	// pipelined exploration: takes every unknown voxel the last evalPose() saw as free, as if that view was
+	// already taken. an optimistic guess, the next refreshMaps() replaces it with the real maps
+	void predictView()
+	{
+		using namespace octomap;
+
+		checkOctrees();
+
+		KeySet seen(first_keys);
+		seen.insert(posterior_keys.begin(), posterior_keys.end());
+
+		for (KeySet::iterator it = seen.begin(); it != seen.end(); it++)
+		{
+			octree->updateNode(*it, false);
+		}
+
+		applyKnownKeys(seen);
+		maps_predicted = true;
+	}
+
+	// brings the unknown tree, the unknown centers and the grids up to date after the known tree changed at changed
+	void applyKnownKeys(const octomap::KeySet &changed)
+	{
+		using namespace octomap;
+
+		if (unknown_center_index_stale)
+		{
+			unknown_center_index.clear();
+
+			for (size_t idx = 0; idx < unknown_centers_soa.size(); idx++)
+			{
+				if (unknown_centers_soa.isRemoved(idx))
+				{
+					continue;
+				}
+
+				unknown_center_index[unknown_octree->coordToKey(unknown_centers_soa.x[idx], unknown_centers_soa.y[idx],
+																unknown_centers_soa.z[idx])] = idx;
+			}
+
+			unknown_center_index_stale = false;
+		}
+
+		std::vector<OcTreeKey> now_known, now_unknown;
+		unknown_extractor.update(*octree, changed, *unknown_octree, now_known, now_unknown);
+
+		for (std::vector<OcTreeKey>::iterator it = now_known.begin(); it != now_known.end(); it++)
+		{
+			// the point keeps its place in the bvh, the queries skip it
+			std::unordered_map<OcTreeKey, uint32_t, OcTreeKey::KeyHash>::iterator center = unknown_center_index.find(*it);
+
+			if (center != unknown_center_index.end())
+			{
+				unknown_centers_soa.remove(center->second);
+
+				unknown_center_index.erase(center);
+			}
+
+			point3d known_center = unknown_octree->keyToCoord(*it);
+			known_since_take.push_back(pcl::PointXYZ(known_center.x(), known_center.y(), known_center.z()));
+		}
+
+		// appended, the bvh tests them apart until the next build
+		for (std::vector<OcTreeKey>::iterator it = now_unknown.begin(); it != now_unknown.end(); it++)
+		{
+			if (unknown_center_index.find(*it) == unknown_center_index.end())
+			{
+				point3d center = unknown_octree->keyToCoord(*it);
+
+				unknown_center_index[*it] = unknown_centers_soa.size();
+				unknown_centers_soa.push_back(center.x(), center.y(), center.z());
+				unknown_since_take.push_back(pcl::PointXYZ(center.x(), center.y(), center.z()));
+			}
+		}
+
+		for (KeySet::const_iterator it = changed.begin(); it != changed.end(); it++)
+		{
+			point3d changed_center = octree->keyToCoord(*it);
+
+			for (unsigned i = 0; i < 3; i++)
+			{
+				changed_min(i) = std::min(changed_min(i), changed_center(i));
+				changed_max(i) = std::max(changed_max(i), changed_center(i));
+			}
+
+			if (!dense_grid_stale && dense_grid.contains(*it))
+			{
+				OcTreeNode *node = octree->search(*it);
+				uint8_t state = denseVoxelGrid::cell_free;
+
+				if (node != NULL)
+				{
+					state = octree->isNodeOccupied(node) ? denseVoxelGrid::cell_occupied : denseVoxelGrid::cell_free;
+				}
+				else if (unknown_octree->search(*it) != NULL)
+				{
+					state = denseVoxelGrid::cell_unknown;
+				}
+
+				dense_grid.setCell(dense_grid.index(*it), state);
+			}
+		}
+
+		if (!dense_grid_stale && !dense_grid.empty())
+		{
+			dense_grid.assignUnknownIds();
+		}
+
+		coarse_grid_level = -1;
+	}
+
+	void checkOctrees()
+	{
+		while (snapshot_manager != NULL && (octree == NULL || unknown_octree == NULL) && ros::ok())
+		{
+			ROS_WARN("No OcTrees... Waiting for a map snapshot.");
+
+			useSnapshot(map_version, ros::Duration(snapshot_timeout));
+		}
+
+		while (octree == NULL || unknown_octree == NULL)
+		{
+			ROS_WARN("No OcTrees... Did you call the writting functions? Calling them automatically.");
+
+			writeKnownOctomap();
+			writeUnknownOctomap();
+		}
+
+		if (use_dense_grid && dense_grid_stale)
+		{
+			dense_grid.build(octree, unknown_octree, min_bbx, max_bbx, dense_grid_margin);
+			dense_grid_stale = false;
+			coarse_grid_level = -1;
+		}
+
+		if (coarse_level > 0 && coarse_grid_level != coarse_level)
+		{
+			buildCoarseGrid();
+		}
+	}
+
+	// the coarse grid and its unknown cell centers, from the dense grid
+	void buildCoarseGrid()
+	{
+		coarse_grid.buildCoarse(dense_grid, coarse_level);
+
+		pcl::PointCloud<pcl::PointXYZ> centers;
+		centers.reserve(coarse_grid.n_unknown);
+
+		for (int z = 0; z < coarse_grid.size_z; z++)
+		{
+			for (int y = 0; y < coarse_grid.size_y; y++)
+			{
+				for (int x = 0; x < coarse_grid.size_x; x++)
+				{
+					size_t idx = (size_t)x + (size_t)coarse_grid.size_x * (y + (size_t)coarse_grid.size_y * z);
+
+					if (coarse_grid.cell(idx) == denseVoxelGrid::cell_unknown)
+					{
+						centers.push_back(pcl::PointXYZ(coarse_grid.corner.x() + (x + 0.5) * coarse_grid.resolution,
+														coarse_grid.corner.y() + (y + 0.5) * coarse_grid.resolution,
+														coarse_grid.corner.z() + (z + 0.5) * coarse_grid.resolution));
+					}
+				}
+			}
+		}
+
+		coarse_centers.assign(centers);
+		coarse_bvh.build(coarse_centers);
+
+		coarse_grid_level = coarse_level;
+	}
+
+	bool castKnownRay(const octomap::point3d &origin, const octomap::point3d &direction, octomap::point3d &end) const
+	{
+		if (use_dense_grid && !dense_grid.empty())
+		{
+			return dense_grid.castRay(origin, direction, end, max_range);
+		}
+
+		return octree->castRay(origin, direction, end, true, max_range);
+	}
+
+	bool isUnknownKey(const octomap::OcTreeKey &key) const
+	{
+		if (use_dense_grid && !dense_grid.empty())
+		{
+			return dense_grid.isUnknown(key);
+		}
+
+		return unknown_octree->search(key) != NULL;
+	}
+
+	void evalPose()
+	{
+		checkOctrees();
+
+		scratch.record_rays = true;
+		castPoseRays(view_pose, scratch);
+
+		first_keys.swap(scratch.first_keys);
+		posterior_keys.swap(scratch.posterior_keys);
+		ray_points_list.swap(scratch.ray_points_list);
+
+		getScore();
+	}
+
+	// scores every pose against the same octrees, each thread with its own scratch state.
+	// voxel based unless a pixel step was set. view_pose, score and the key sets of this object are left untouched.
+	std::vector<float> evalPoses(const std::vector<tf::Pose> &poses)
+	{
+		checkOctrees();
+
+		std::vector<float> scores(poses.size(), 0);
+
+		int n_threads = 1;
+#ifdef _OPENMP
+		n_threads = omp_get_max_threads();
+#endif
+
+		if ((int)thread_scratch.size() < n_threads)
+		{
+			thread_scratch.resize(n_threads);
+		}
+
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)poses.size(); i++)
+		{
+			scores[i] = scorePose(poses[i], thread_scratch[threadId()]);
+		}
+
+		return scores;
+	}
+
+	// branch and bound version of evalPoses for when only the best top_k poses matter.
+	// the unknown voxels a ray of a pose can cross bound its score: those with the center inside of the frustum
+	// grown by the ray footprint (see cullFrustum). the poses are ray cast in descending bound order and the ones
+	// whose bound can not beat the top_k-th best score found so far are skipped with a score of -1
+	std::vector<float> evalPosesBounded(const std::vector<tf::Pose> &poses, size_t top_k)
+	{
+		checkOctrees();
+
+		std::vector<float> scores(poses.size(), -1);
+		std::vector<float> bounds = evalPoseBounds(poses);
+
+		int n_threads = 1;
+#ifdef _OPENMP
+		n_threads = omp_get_max_threads();
+#endif
+
+		std::vector<size_t> order(poses.size());
+
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+
+		std::sort(order.begin(), order.end(), compareValueIndex(bounds));
+
+		// min heap of the top_k best exact scores
+		std::vector<float> best_scores;
+		size_t next = 0;
+
+		top_k = std::max<size_t>(top_k, 1);
+
+		while (next < order.size())
+		{
+			if (best_scores.size() >= top_k && bounds[order[next]] <= best_scores.front())
+			{
+				break;
+			}
+
+			// one pose per thread between two threshold updates
+			size_t batch_end = std::min(order.size(), next + n_threads);
+
+#pragma omp parallel for schedule(dynamic)
+			for (int j = (int)next; j < (int)batch_end; j++)
+			{
+				scores[order[j]] = scorePose(poses[order[j]], thread_scratch[threadId()]);
+			}
+
+			for (; next < batch_end; next++)
+			{
+				best_scores.push_back(scores[order[next]]);
+				std::push_heap(best_scores.begin(), best_scores.end(), std::greater<float>());
+
+				if (best_scores.size() > top_k)
+				{
+					std::pop_heap(best_scores.begin(), best_scores.end(), std::greater<float>());
+					best_scores.pop_back();
+				}
+			}
+		}
+
+		ROS_INFO_STREAM("Ray cast " << next << " of " << poses.size() << " poses.");
+
+		return scores;
+	}
+
+	// an upper bound of the score of every pose, from the unknown voxels its rays could cross, without casting them
+	std::vector<float> evalPoseBounds(const std::vector<tf::Pose> &poses)
+	{
+		checkOctrees();
+
+		std::vector<float> bounds(poses.size(), 0);
+
+		// the center of a voxel a ray goes through is at most half a diagonal away from it
+		float footprint = sqrt(3.0) / 2 * octree->getResolution();
+
+		int n_threads = 1;
+#ifdef _OPENMP
+		n_threads = omp_get_max_threads();
+#endif
+
+		if ((int)thread_scratch.size() < n_threads)
+		{
+			thread_scratch.resize(n_threads);
+		}
+
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)poses.size(); i++)
+		{
+			std::vector<uint32_t> &inside_ids = thread_scratch[threadId()].inside_ids;
+
+			cullFrustum(poses[i], unknown_centers_soa, unknown_bvh, inside_ids, footprint);
+
+			// every counted voxel is among them, and is at most first and posterior seen
+			bounds[i] = computeScore(inside_ids.size(), inside_ids.size());
+		}
+
+		return bounds;
+	}
+
+	// scores every pose on the coarse grid, then only the best coarse_keep_ratio of them at full resolution
+	// (with scorePose, like evalPoses). the others get a score of -1, their coarse scores go to coarse_scores if given
+	std::vector<float> evalPosesCoarseToFine(const std::vector<tf::Pose> &poses, std::vector<float> *coarse_scores = NULL)
+	{
+		checkOctrees();
+
+		if (coarse_level <= 0 || coarse_grid.empty())
+		{
+			std::vector<float> scores = evalPoses(poses);
+
+			if (coarse_scores != NULL)
+			{
+				*coarse_scores = scores;
+			}
+
+			return scores;
+		}
+
+		std::vector<float> coarse(poses.size(), 0);
+		std::vector<float> scores(poses.size(), -1);
+
+		int n_threads = 1;
+#ifdef _OPENMP
+		n_threads = omp_get_max_threads();
+#endif
+
+		if ((int)thread_scratch.size() < n_threads)
+		{
+			thread_scratch.resize(n_threads);
+		}
+
+		// every coarse voxel stands for this many leafs
+		size_t leafs_per_cell = (size_t)1 << (3 * coarse_level);
+
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)poses.size(); i++)
+		{
+			poseEvalScratch &thread_state = thread_scratch[threadId()];
+
+			if (castGridPacket(poses[i], coarse_grid, coarse_centers, coarse_bvh, thread_state))
+			{
+				coarse[i] = computeScore(thread_state.packet.n_first * leafs_per_cell,
+										 thread_state.packet.n_posterior * leafs_per_cell);
+			}
+			else
+			{
+				// outside of the grid, there is no coarse shortcut for it
+				coarse[i] = scorePose(poses[i], thread_state);
+			}
+		}
+
+		std::vector<size_t> order(poses.size());
+
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+
+		size_t n_keep = std::min(poses.size(), (size_t)std::max(1.0f, ceilf(coarse_keep_ratio * poses.size())));
+
+		std::partial_sort(order.begin(), order.begin() + n_keep, order.end(), compareValueIndex(coarse));
+
+#pragma omp parallel for schedule(dynamic)
+		for (int j = 0; j < (int)n_keep; j++)
+		{
+			scores[order[j]] = scorePose(poses[order[j]], thread_scratch[threadId()]);
+		}
+
+		if (coarse_scores != NULL)
+		{
+			coarse_scores->swap(coarse);
+		}
+
+		return scores;
+	}
+
+	// score of one pose like evalPoses, only writes state
+	float scorePose(const tf::Pose &pose, poseEvalScratch &state) const
+	{
+		state.record_rays = false;
+
+		if (step > 0)
+		{
+			pcl::PointCloud<pcl::PointXYZ> &rays_point_cloud = state.points_inside;
+			pcl_ros::transformPointCloud(rays_point_cloud_world, rays_point_cloud, pose);
+
+			state.first_keys.clear();
+			state.posterior_keys.clear();
+
+			castPixelRays(pose, rays_point_cloud, 0, rays_point_cloud.size(), state);
+			removeFirstFromPosterior(state.first_keys, state.posterior_keys);
+		}
+		else if (castPoseRaysPacket(pose, state))
+		{
+			return computeScore(state.packet.n_first, state.packet.n_posterior);
+		}
+		else
+		{
+			castPoseRays(pose, state);
+		}
+
+		return computeScore(state.first_keys.size(), state.posterior_keys.size());
+	}
+
+	// sorts indexes by descending value
+	struct compareValueIndex
+	{
+		const std::vector<float> &values;
+
+		compareValueIndex(const std::vector<float> &_values) : values(_values) {}
+
+		bool operator()(size_t a, size_t b) const
+		{
+			return values[a] > values[b];
+		}
+	};
+
+	static int threadId()
+	{
+#ifdef _OPENMP
+		return omp_get_thread_num();
+#else
+		return 0;
+#endif
+	}
+
+	// voxel based ray casting of one pose. only reads the octrees and the unknown cloud,
+	// everything that is written lives in state, so it can run concurrently for different poses
+	void castPoseRays(const tf::Pose &pose, poseEvalScratch &state) const
+	{
+		using namespace octomap;
+		using namespace octomath;
+
+		Vector3 origin;
 
-		pix_width = CamInfo->width;
-		pix_height = CamInfo->height;
+		unknownVoxelTable &unknown_voxels = state.unknown_voxels;
+		std::vector<size_t> &visit_order = state.visit_order;
 
-		float delta_rad_w = width_FOV / pix_width;
-		float delta_rad_h = height_FOV / pix_height;
+		state.first_keys.clear();
+		state.posterior_keys.clear();
+		state.ray_points_list.clear();
 
-		float corner_rad_w = width_FOV / 2;
-		float corner_rad_h = height_FOV / 2;
+		collectFrustumVoxels(pose, state, origin);
 
-		// generate the points of the camera rays
-		float rad_h = (M_PI - height_FOV) / 2;
+		KeyRay &ray_keys_before = state.ray_keys_before;
+		KeyRay &ray_keys_after = state.ray_keys_after;
+		Vector3 voxel_center, end_point, direction;
 
-		for (int row_pix = 0; row_pix < pix_height; row_pix += step)
+		for (size_t idx = 0; idx < visit_order.size(); idx++)
 		{
-			float rad_w = (M_PI - width_FOV) / 2;
+			const unknownVoxel &voxel = unknown_voxels.voxels[visit_order[idx]];
 
-			for (int col_pix = 0; col_pix < pix_width; col_pix += step)
+			if (voxel.to_visit == false)
 			{
-				float x = 1 * sin(rad_h) * cos(rad_w);
-				float z = 1 * sin(rad_h) * sin(rad_w);
-				float y = 1 * cos(rad_h);
+				continue;
+			}
 
-				rays_point_cloud_world.push_back(pcl::PointXYZ(x, y, z));
+			voxel_center = unknown_octree->keyToCoord(voxel.key);
 
-				rad_w += delta_rad_w * step;
-			}
-			rad_h += delta_rad_h * step;
-		}
+			direction = voxel_center - origin;
+			bool occupied = castKnownRay(origin, direction, end_point);
 
-		// rays_point_cloud.push_back(pcl::PointXYZ(-0.01, 0, 0.8));
-		// rays_point_cloud.push_back(pcl::PointXYZ(0.01, 0, 0.8));
-		// pcl_ros::transformPointCloud(rays_point_cloud, rays_point_cloud, view_pose);
+			unknown_octree->computeRayKeys(origin, end_point, ray_keys_before);
 
-		ros::param::get("x_max", max_bbx.x());
-		ros::param::get("y_max", max_bbx.y());
-		ros::param::get("z_max", max_bbx.z());
+			bool first = true;
 
-		ros::param::get("x_min", min_bbx.x());
-		ros::param::get("y_min", min_bbx.y());
-		ros::param::get("z_min", min_bbx.z());
-	}
+			for (KeyRay::iterator it_key = ray_keys_before.begin(); it_key != ray_keys_before.end(); it_key++)
+			{
+				if (origin.distance(unknown_octree->keyToCoord(*it_key)) >= min_range && isUnknownKey(*it_key))
+				{
+					if (first)
+					{
+						state.first_keys.insert(*it_key);
+						first = false;
+					}
+					else
+					{
+						state.posterior_keys.insert(*it_key);
+					}
 
-	// void writeKnownOctomapCallback(const octomap_msgs::OctomapConstPtr &map)
-	// {
-	//     using namespace octomap;
+					if (state.record_rays)
+					{
+						state.ray_points_list.push_back(origin);
+						state.ray_points_list.push_back(end_point);
+					}
 
-	//     // ROS_INFO("I'm inside the callback");
+					unknown_voxels.markVisited(*it_key);
+				}
+			}
 
-	//     AbstractOcTree *tree = NULL;
+			if (occupied)
+			{
+				unknown_octree->computeRayKeys(end_point, voxel_center, ray_keys_after);
 
-	//     if (octree != NULL)
-	//     {
-	//         // ROS_INFO("DEBUG: Going to DEL OCTREE");
-	//         delete (octree);
-	//         // ROS_INFO("DEBUG: Octree DEL");
-	//     }
+				for (KeyRay::iterator it_key = ray_keys_after.begin(); it_key != ray_keys_after.end(); it_key++)
+				{
+					unknown_voxels.markVisited(*it_key);
+				}
+			}
+		}
+	}
 
-	//     tree = msgToMap(*map);
-	//     octree = dynamic_cast<OcTree *>(tree);
-	// }
+	// scores like castPoseRays, but the rays are walked 8 at a time straight to their targets through the dense grid
+	// and only counted, so the totals can differ by a few voxels. false when the grid can not be used for this pose, castPoseRays has to do it then
+	bool castPoseRaysPacket(const tf::Pose &pose, poseEvalScratch &state) const
+	{
+		if (!use_packet_rays || !use_dense_grid || dense_grid.empty())
+		{
+			return false;
+		}
 
-	// void writeUnknownOctomapCallback(const octomap_msgs::OctomapConstPtr &map)
-	// {
-	//     using namespace octomap;
+		return castGridPacket(pose, dense_grid, unknown_centers_soa, unknown_bvh, state);
+	}
 
-	//     // ROS_INFO("I'm inside the callback");
+	// packet ray casting of pose towards the given unknown centers (cell centers of grid) through grid
+	bool castGridPacket(const tf::Pose &pose, const denseVoxelGrid &grid, const pointsSoA &centers, const mortonBVH &bvh,
+						poseEvalScratch &state) const
+	{
+		using namespace octomap;
 
-	//     AbstractOcTree *tree = NULL;
+		packetRayScratch &packet = state.packet;
+		packetRayCaster caster(grid, packet);
 
-	//     if (unknown_octree != NULL)
-	//     {
-	//         // ROS_INFO("DEBUG: Going to DEL OCTREE");
-	//         delete (unknown_octree);
-	//         // ROS_INFO("DEBUG: Octree DEL");
-	//     }
+		point3d origin(pose.getOrigin().x(), pose.getOrigin().y(), pose.getOrigin().z());
 
-	//     tree = msgToMap(*map);
-	//     unknown_octree = dynamic_cast<OcTree *>(tree);
-	// }
+		caster.setOrigin(origin, min_range, max_range);
 
-	void writeKnownOctomap()
-	{
-		using namespace octomap;
+		if (!caster.originInside())
+		{
+			return false;
+		}
 
-		ros::NodeHandle n;
+		std::vector<uint32_t> &inside_ids = state.inside_ids;
+		cullFrustum(pose, centers, bvh, inside_ids);
 
-		AbstractOcTree *tree = NULL;
+		// farthest first, like the visit order of castPoseRays
+		std::vector<std::pair<float, uint32_t> > &order = state.packet_order;
+		order.resize(inside_ids.size());
 
-		if (octree != NULL)
+		for (size_t idx = 0; idx < inside_ids.size(); idx++)
 		{
-			delete (octree);
+			uint32_t id = inside_ids[idx];
+			point3d center(centers.x[id], centers.y[id], centers.z[id]);
+
+			order[idx] = std::make_pair(-(float)origin.distance(center), id);
 		}
 
-		octomap_msgs::OctomapConstPtr map = ros::topic::waitForMessage<octomap_msgs::Octomap>("/octomap_full", n);
-		tree = msgToMap(*map);
-		octree = dynamic_cast<OcTree *>(tree);
-	}
+		std::sort(order.begin(), order.end());
 
-	void writeUnknownOctomap()
-	{
-		using namespace octomap;
+		packet.reset(grid.n_unknown);
 
-		ros::NodeHandle n;
+		std::vector<OcTreeKey> &targets = state.packet_targets;
 
-		AbstractOcTree *tree = NULL;
+		// a target is skipped when an earlier packet already went through it
+		size_t idx = 0;
 
-		if (unknown_octree != NULL)
+		while (idx < order.size())
 		{
-			delete (unknown_octree);
-		}
+			targets.clear();
 
-		octomap_msgs::OctomapConstPtr map = ros::topic::waitForMessage<octomap_msgs::Octomap>("/unknown_full_map", n);
-		tree = msgToMap(*map);
-		unknown_octree = dynamic_cast<OcTree *>(tree);
-	}
+			while (idx < order.size() && (int)targets.size() < packetRayCaster::packet_size)
+			{
+				uint32_t id = order[idx++].second;
+				OcTreeKey key;
 
-	void writeUnknownCloud()
-	{
-		ros::NodeHandle n;
+				key[0] = grid.min_key[0] + (int)floor((centers.x[id] - grid.corner.x()) / grid.resolution);
+				key[1] = grid.min_key[1] + (int)floor((centers.y[id] - grid.corner.y()) / grid.resolution);
+				key[2] = grid.min_key[2] + (int)floor((centers.z[id] - grid.corner.z()) / grid.resolution);
 
-		sensor_msgs::PointCloud2ConstPtr unknown_cloud =
-			ros::topic::waitForMessage<sensor_msgs::PointCloud2>("/unknown_pc", n);
+				if (grid.contains(key) && !packet.isCovered(grid.unknownId(grid.index(key))))
+				{
+					targets.push_back(key);
+				}
+			}
 
-		pcl::fromROSMsg(*unknown_cloud, unknown_centers_pcl);
+			if (!targets.empty())
+			{
+				caster.cast(&targets[0], targets.size());
+			}
+		}
+
+		return true;
 	}
 
-	void writeUnknownCloud(sensor_msgs::PointCloud2ConstPtr unknown_cloud)
+	// indexes into unknown_centers_soa of the unknown centers inside the frustum of pose
+	void cullFrustum(const tf::Pose &pose, std::vector<uint32_t> &inside_ids) const
 	{
-		pcl::fromROSMsg(*unknown_cloud, unknown_centers_pcl);
+		cullFrustum(pose, unknown_centers_soa, unknown_bvh, inside_ids);
 	}
 
-	void evalPose()
+	// with a margin, the frustum is grown so that it takes every center closer than margin to the rays: the apex
+	// goes back until the side planes are margin further out, the near plane goes to the apex and the far plane
+	// margin past the last voxel a ray ends on
+	void cullFrustum(const tf::Pose &pose, const pointsSoA &centers, const mortonBVH &bvh,
+					 std::vector<uint32_t> &inside_ids, float margin = 0) const
 	{
-		using namespace octomap;
-		using namespace octomath;
+		// same camera as the old pcl::FrustumCulling setup: view along z, up along -y, right along x
+		tf::Matrix3x3 basis = pose.getBasis();
+		tf::Vector3 view = basis.getColumn(2);
+		tf::Vector3 up = -basis.getColumn(1);
+		tf::Vector3 right = basis.getColumn(0);
 
-		Vector3 origin;
+		float back = 0;
+		float near_distance = min_range;
+		float far_distance = max_range;
 
-		while (octree == NULL || unknown_octree == NULL)
+		if (margin > 0)
 		{
-			ROS_WARN("No OcTrees... Did you call the writting functions? Calling them automatically.");
-
-			writeKnownOctomap();
-			writeUnknownOctomap();
+			back = margin / sin(std::min(height_FOV, width_FOV) / 2);
+			near_distance = 0;
+			far_distance = back + max_range + octree->getResolution() + margin;
 		}
 
-		first_keys.clear();
-		posterior_keys.clear();
+		tf::Vector3 apex = pose.getOrigin() - back * view;
+
+		float camera_position[3] = {(float)apex.x(), (float)apex.y(), (float)apex.z()};
+		float camera_view[3] = {(float)view.x(), (float)view.y(), (float)view.z()};
+		float camera_up[3] = {(float)up.x(), (float)up.y(), (float)up.z()};
+		float camera_right[3] = {(float)right.x(), (float)right.y(), (float)right.z()};
+
+		frustumCuller fc;
+		fc.setCamera(camera_position, camera_view, camera_up, camera_right, height_FOV, width_FOV, near_distance,
+					 far_distance);
+
+		bvh.query(centers, fc, inside_ids);
+	}
+
+	// unknown voxels inside the frustum of pose, in state.unknown_voxels and sorted in state.visit_order
+	void collectFrustumVoxels(const tf::Pose &pose, poseEvalScratch &state, octomath::Vector3 &origin) const
+	{
+		using namespace octomap;
+		using namespace octomath;
 
-		Pose6D octo_pose = poseTfToOctomap(view_pose);
+		unknownVoxelTable &unknown_voxels = state.unknown_voxels;
+
+		Pose6D octo_pose = poseTfToOctomap(pose);
 
 		origin.x() = octo_pose.x();
 		origin.y() = octo_pose.y();
 		origin.z() = octo_pose.z();
 
-		if (octree != NULL && unknown_octree != NULL)
-		{
+		std::vector<uint32_t> &inside_ids = state.inside_ids;
+		cullFrustum(pose, inside_ids);
 
-			pcl::FrustumCulling<pcl::PointXYZ> fc;
-			fc.setInputCloud(unknown_centers_pcl.makeShared());
-			fc.setVerticalFOV(height_FOV * 180 / M_PI);
-			fc.setHorizontalFOV(width_FOV * 180 / M_PI);
-			fc.setNearPlaneDistance(min_range);
-			fc.setFarPlaneDistance(max_range);
+		unknown_voxels.clear();
+		unknown_voxels.reserve(inside_ids.size());
 
-			Eigen::Affine3d pose_origin_affine;
-			Eigen::Matrix4d pose_orig;
-			Eigen::Matrix4d cam2robot;
+		for (size_t idx = 0; idx < inside_ids.size(); idx++)
+		{
+			unknownVoxel a_voxel;
+
+			a_voxel.center = Vector3(unknown_centers_soa.x[inside_ids[idx]], unknown_centers_soa.y[inside_ids[idx]],
+									 unknown_centers_soa.z[inside_ids[idx]]);
+			a_voxel.key = unknown_octree->coordToKey(a_voxel.center);
+			a_voxel.distance_to_camera = origin.distance(a_voxel.center);
 
-			tf::poseTFToEigen(view_pose, pose_origin_affine);
+			unknown_voxels.insert(a_voxel);
+		}
 
-			pose_orig = pose_origin_affine.matrix();
+		unknown_voxels.sortByDistance(state.visit_order);
+	}
 
-			cam2robot << 0, 0, 1, 0, 0, -1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1;
+	// one 360 degrees visibility pass from origin: every unknown voxel between min_range and max_range is ray cast
+	// like in castPoseRays and binned by its direction. orientations at this origin are then scored by evalOrientation
+	void buildVisibilityMap(const octomap::point3d &origin, sphericalVisibilityMap &visibility)
+	{
+		using namespace octomap;
 
-			Eigen::Matrix4d pose_new_d = pose_orig * cam2robot;
-			Eigen::Matrix4f pose_new = pose_new_d.cast<float>();
+		checkOctrees();
 
-			fc.setCameraPose(pose_new);
+		visibility.clear(origin);
 
-			pcl::PointCloud<pcl::PointXYZ> points_inside;
-			fc.filter(points_inside);
+		unknownVoxelTable &unknown_voxels = scratch.unknown_voxels;
+		std::vector<size_t> &visit_order = scratch.visit_order;
 
-			std::vector<map_type::iterator> unknown_voxels;
-			map_type map_unknown_voxels;
+		scratch.first_keys.clear();
+		scratch.posterior_keys.clear();
 
-			// ROS_INFO_STREAM("N points unknown: " << points_inside.size());
+		unknown_voxels.clear();
+		unknown_voxels.reserve(unknown_centers_soa.size());
 
-			for (pcl::PointCloud<pcl::PointXYZ>::iterator it = points_inside.begin(); it != points_inside.end(); it++)
+		// the soa copy, it drops the centers that incremental updates made known
+		for (size_t idx = 0; idx < unknown_centers_soa.size(); idx++)
+		{
+			if (unknown_centers_soa.isRemoved(idx))
 			{
-				unknownVoxel a_voxel;
-				octomap::OcTreeKey::KeyHash hash;
-
-				a_voxel.key = unknown_octree->coordToKey(it->x, it->y, it->z);
-				a_voxel.center = Vector3(it->x, it->y, it->z);
-				a_voxel.distance_to_camera = origin.distance(Vector3(it->x, it->y, it->z));
-				a_voxel.map_key = hash(a_voxel.key);
+				continue;
+			}
 
-				map_unknown_voxels.insert(std::pair<size_t, unknownVoxel>(a_voxel.map_key, a_voxel));
+			unknownVoxel a_voxel;
 
-				map_type::iterator map_it = map_unknown_voxels.find(a_voxel.map_key);
+			a_voxel.center = point3d(unknown_centers_soa.x[idx], unknown_centers_soa.y[idx], unknown_centers_soa.z[idx]);
+			a_voxel.distance_to_camera = origin.distance(a_voxel.center);
 
-				unknown_voxels.push_back(map_it);
+			if (a_voxel.distance_to_camera < min_range || a_voxel.distance_to_camera > max_range)
+			{
+				continue;
 			}
 
-			std::sort(unknown_voxels.begin(), unknown_voxels.end(), compareVoxelDistanceIterator);
+			a_voxel.key = unknown_octree->coordToKey(a_voxel.center);
+
+			unknown_voxels.insert(a_voxel);
+		}
 
-			KeyRay ray_keys_before, ray_keys_after;
-			Vector3 voxel_center, end_point, direction;
+		unknown_voxels.sortByDistance(visit_order);
 
-			// ros::Time t = ros::Time::now();
-			// ros::Time t_for;
-			// ros::Duration d_for_total(0);
+		KeyRay &ray_keys_before = scratch.ray_keys_before;
+		KeyRay &ray_keys_after = scratch.ray_keys_after;
+		point3d voxel_center, end_point;
 
-			// t_for = ros::Time::now();
-			// double total1 = 0;
-			// double total2 = 0;
-			// double total3 = 0;
-			// double total4 = 0;
+		for (size_t idx = 0; idx < visit_order.size(); idx++)
+		{
+			const unknownVoxel &voxel = unknown_voxels.voxels[visit_order[idx]];
 
-			for (size_t idx = 0; idx < unknown_voxels.size(); idx++)
+			if (voxel.to_visit == false)
 			{
-				octomap::OcTreeKey::KeyHash hash;
+				continue;
+			}
 
-				if (map_unknown_voxels[unknown_voxels[idx]->second.map_key].to_visit == false)
-				{
-					continue;
-				}
+			voxel_center = unknown_octree->keyToCoord(voxel.key);
 
-				voxel_center = unknown_octree->keyToCoord(unknown_voxels[idx]->second.key);
+			bool occupied = castKnownRay(origin, voxel_center - origin, end_point);
 
-				direction = voxel_center - origin;
-				bool occupied = octree->castRay(origin, direction, end_point, true, max_range);
+			unknown_octree->computeRayKeys(origin, end_point, ray_keys_before);
 
-				unknown_octree->computeRayKeys(origin, end_point, ray_keys_before);
+			bool first = true;
 
-				bool first = true;
+			for (KeyRay::iterator it_key = ray_keys_before.begin(); it_key != ray_keys_before.end(); it_key++)
+			{
+				point3d key_center = unknown_octree->keyToCoord(*it_key);
 
-				// ros::Time tic, tic_inside;
-				for (KeyRay::iterator it_key = ray_keys_before.begin(); it_key != ray_keys_before.end(); it_key++)
+				if (origin.distance(key_center) >= min_range && isUnknownKey(*it_key))
 				{
+					if (first)
+					{
+						if (scratch.first_keys.insert(*it_key).second)
+						{
+							visibility.addFirst(key_center - origin);
+						}
 
-					// tic = ros::Time::now();
-					bool C1 = origin.distance(unknown_octree->keyToCoord(*it_key)) >= min_range;
-					// total1 += (ros::Time::now() - tic).toSec();
-
-					if (C1)
+						first = false;
+					}
+					else if (scratch.posterior_keys.insert(*it_key).second)
 					{
+						visibility.addPosterior(key_center - origin);
+					}
 
-						// tic = ros::Time::now();
-						bool C2 = unknown_octree->search(*it_key);
-						// total2 += (ros::Time::now() - tic).toSec();
+					unknown_voxels.markVisited(*it_key);
+				}
+			}
 
-						// tic = ros::Time::now();
-						if (C2)
-						{
+			if (occupied)
+			{
+				unknown_octree->computeRayKeys(end_point, voxel_center, ray_keys_after);
+
+				for (KeyRay::iterator it_key = ray_keys_after.begin(); it_key != ray_keys_after.end(); it_key++)
+				{
+					unknown_voxels.markVisited(*it_key);
+				}
+			}
+		}
 
-							if (first)
-							{
-								first_keys.insert(*it_key);
-								first = false;
-							}
-							else
-							{
-								posterior_keys.insert(*it_key);
-							}
+		visibility.integrate();
+	}
 
-							ray_points_list.push_back(origin);
-							ray_points_list.push_back(end_point);
+	// score of a camera at the origin of visibility looking along the z axis of orientation
+	float evalOrientation(const sphericalVisibilityMap &visibility, const tf::Quaternion &orientation) const
+	{
+		tf::Vector3 view_direction = tf::Matrix3x3(orientation).getColumn(2);
+		double n_first, n_posterior;
 
-							// tic_inside = ros::Time::now();
+		visibility.windowCounts(octomap::point3d(view_direction.x(), view_direction.y(), view_direction.z()), width_FOV,
+								height_FOV, n_first, n_posterior);
 
-							map_type::iterator map_it = map_unknown_voxels.find(hash(*it_key));
+		return computeScore((size_t)(n_first + 0.5), (size_t)(n_posterior + 0.5));
+	}
 
-							if (map_it != map_unknown_voxels.end())
-							{
-								map_it->second.to_visit = false;
-							}
+	void evalPosePixelBased()
+	{
+		using namespace octomap;
 
-							// total4 += (ros::Time::now() - tic_inside).toSec();
-						}
-					}
-					// total3 += (ros::Time::now() - tic).toSec();
-				}
-				// d_for_total += (ros::Time::now() - t_for);
+		checkOctrees();
 
-				if (occupied)
-				{
-					unknown_octree->computeRayKeys(end_point, voxel_center, ray_keys_after);
+		if (rays_point_cloud_world.empty())
+		{
+			ROS_WARN("No pixel rays... Did you set a step? Using every 10th pixel.");
 
-					for (KeyRay::iterator it_key = ray_keys_after.begin(); it_key != ray_keys_after.end(); it_key++)
-					{
-						map_type::iterator map_it = map_unknown_voxels.find(hash(*it_key));
+			setPixelStep(10);
+		}
 
-						if (map_it != map_unknown_voxels.end())
-						{
-							map_it->second.to_visit = false;
-						}
-					}
-				}
-			}
-			// ros::Duration d = ros::Time::now() - t;
-			// ROS_INFO_STREAM("for iterator: " << d_for_total.toSec());
-			// ROS_INFO_STREAM("1: " << total1);
-			// ROS_INFO_STREAM("2: " << total2);
-			// ROS_INFO_STREAM("3: " << total3);
-			// ROS_INFO_STREAM("4: " << total4);
-			// // ROS_INFO_STREAM("New for: " << d.toSec() << " secs. N points final: " << unknown_voxels.size());
+		pcl::PointCloud<pcl::PointXYZ> rays_point_cloud;
+		pcl_ros::transformPointCloud(rays_point_cloud_world, rays_point_cloud, view_pose);
 
-			// ROS_INFO_STREAM("Checked voxels: " << checked_voxels);
+		int n_start_points = rays_point_cloud.size();
 
-			getScore();
+		int n_threads = 1;
+#ifdef _OPENMP
+		n_threads = omp_get_max_threads();
+#endif
+
+		if ((int)thread_scratch.size() < n_threads)
+		{
+			thread_scratch.resize(n_threads);
 		}
-		else
+
+		for (size_t thread_id = 0; thread_id < thread_scratch.size(); thread_id++)
 		{
-			ROS_INFO("No OcTree.");
+			thread_scratch[thread_id].first_keys.clear();
+			thread_scratch[thread_id].posterior_keys.clear();
+			thread_scratch[thread_id].ray_points_list.clear();
+			thread_scratch[thread_id].record_rays = true;
 		}
-	}
 
-	void evalPosePixelBased()
-	{
-		using namespace octomap;
-		using namespace octomath;
+#pragma omp parallel
+		{
+			int thread_id = 0;
+			int n_used_threads = 1;
+#ifdef _OPENMP
+			thread_id = omp_get_thread_num();
+			n_used_threads = omp_get_num_threads();
+#endif
+			poseEvalScratch &thread_state = thread_scratch[thread_id];
+
+			// contiguous chunk of rays for each thread
+			int first_ray = (long)n_start_points * thread_id / n_used_threads;
+			int last_ray = (long)n_start_points * (thread_id + 1) / n_used_threads;
+
+			castPixelRays(view_pose, rays_point_cloud, first_ray, last_ray, thread_state);
+		}
 
-		Vector3 origin;
+		first_keys.clear();
+		posterior_keys.clear();
+		ray_points_list.clear();
 
-		while (octree == NULL || unknown_octree == NULL)
+		for (size_t thread_id = 0; thread_id < thread_scratch.size(); thread_id++)
 		{
-			ROS_WARN("No OcTrees... Did you call the writting functions? Calling them automatically.");
+			poseEvalScratch &thread_state = thread_scratch[thread_id];
 
-			writeKnownOctomap();
-			writeUnknownOctomap();
+			first_keys.insert(thread_state.first_keys.begin(), thread_state.first_keys.end());
+			posterior_keys.insert(thread_state.posterior_keys.begin(), thread_state.posterior_keys.end());
+			ray_points_list.splice(ray_points_list.end(), thread_state.ray_points_list);
+
+			thread_state.first_keys.clear();
+			thread_state.posterior_keys.clear();
 		}
 
-		first_keys.clear();
-		posterior_keys.clear();
+		removeFirstFromPosterior(first_keys, posterior_keys);
 
-		Pose6D octo_pose = poseTfToOctomap(view_pose);
+		getScore();
+	}
 
-		origin.x() = octo_pose.x();
-		origin.y() = octo_pose.y();
-		origin.z() = octo_pose.z();
+	// casts the rays [first_ray, last_ray) of rays_point_cloud (already in the world frame), adding the
+	// unknown keys they cross to state. only reads the octrees
+	void castPixelRays(const tf::Pose &pose, const pcl::PointCloud<pcl::PointXYZ> &rays_point_cloud, int first_ray,
+					   int last_ray, poseEvalScratch &state) const
+	{
+		using namespace octomap;
+		using namespace octomath;
 
-		pcl::PointCloud<pcl::PointXYZ> rays_point_cloud;
-		pcl_ros::transformPointCloud(rays_point_cloud_world, rays_point_cloud, view_pose);
+		Vector3 origin(pose.getOrigin().getX(), pose.getOrigin().getY(), pose.getOrigin().getZ());
+		KeyRay &ray_keys = state.ray_keys_before;
 
-		int n_start_points = rays_point_cloud.height * rays_point_cloud.width;
-		if (octree != NULL && unknown_octree != NULL)
+		for (int i = first_ray; i < last_ray; i++)
 		{
+			const pcl::PointXYZ &point = rays_point_cloud.at(i);
+			Vector3 start_point(point.x, point.y, point.z);
+			Vector3 direction, end_point;
 
-			ros::Duration d, d1;
-			ros::Time t;
-			ros::Time t1 = ros::Time::now();
-#pragma omp parallel for
-			for (size_t i = 0; i < n_start_points; i++)
-			{
-				KeyRay ray_keys;
-				pcl::PointXYZ point = rays_point_cloud.at(i);
-				Vector3 start_point, direction, end_point;
-
-				start_point.x() = point.x;
-				start_point.y() = point.y;
-				start_point.z() = point.z;
+			direction = start_point - origin;
 
-				direction = start_point - origin;
+			if (castKnownRay(origin, direction, end_point))
+			{
+				Vector3 hit_center = end_point;
+				octree->getRayIntersection(origin, direction, hit_center, end_point);
+			}
 
-				t = ros::Time::now();
-				octree->castRay(origin, direction, end_point, true, max_range);
-				d = ros::Time::now() - t;
-				ROS_INFO_STREAM("castRay: " << d.toSec() << "secs.");
+			start_point = origin + direction.normalized() * min_range;
 
-				start_point = origin + direction.normalized() * min_range;
+			if (origin.distance(start_point) < origin.distance(end_point))
+			{
+				unknown_octree->computeRayKeys(start_point, end_point, ray_keys);
 
-				t = ros::Time::now();
-				octree->getRayIntersection(origin, direction, end_point, end_point);
-				d = ros::Time::now() - t;
-				ROS_INFO_STREAM("getRayIntersection: " << d.toSec() << "secs.");
+				bool first = true;
 
-				if (origin.distance(start_point) < origin.distance(end_point))
+				for (KeyRay::iterator it = ray_keys.begin(); it != ray_keys.end(); it++)
 				{
-					t = ros::Time::now();
-					unknown_octree->computeRayKeys(start_point, end_point, ray_keys);
-					d = ros::Time::now() - t;
-					ROS_INFO_STREAM("computeRayKeys: " << d.toSec() << "secs.");
-
-					bool first = true;
-					t = ros::Time::now();
-					for (KeyRay::iterator it = ray_keys.begin(); it != ray_keys.end(); it++)
+					if (isUnknownKey(*it))
 					{
-						if (unknown_octree->search(*it))
+						if (first)
+						{
+							state.first_keys.insert(*it);
+							first = false;
+						}
+						else
 						{
-							if (first)
-							{
-								first_keys.insert(*it);
-								first = false;
-							}
-							else
-							{
-								posterior_keys.insert(*it);
-							}
+							state.posterior_keys.insert(*it);
 						}
 					}
-					d = ros::Time::now() - t;
-					ROS_INFO_STREAM("iterator: " << d.toSec() << "secs.");
-
-					t = ros::Time::now();
-					ray_points_list.push_back(start_point);
-					ray_points_list.push_back(end_point);
-					d = ros::Time::now() - t;
-					ROS_INFO_STREAM("pushBack: " << d.toSec() << "secs.");
 				}
-			}
-			d1 = ros::Time::now() - t1;
-			ROS_INFO_STREAM("#pragma took: " << d1.toSec() << "secs for " << n_start_points << " points.");
 
-			for (KeySet::iterator it = posterior_keys.begin(); it != posterior_keys.end(); it++)
-			{
-				if (first_keys.find(*it) != first_keys.end())
+				if (state.record_rays)
 				{
-					posterior_keys.erase(*it);
+					state.ray_points_list.push_back(start_point);
+					state.ray_points_list.push_back(end_point);
 				}
 			}
-
-			getScore();
 		}
+	}
 
-		else
+	static void removeFirstFromPosterior(const octomap::KeySet &first, octomap::KeySet &posterior)
+	{
+		for (octomap::KeySet::iterator it = posterior.begin(); it != posterior.end();)
 		{
-			ROS_INFO("No OcTree.");
+			if (first.find(*it) != first.end())
+			{
+				it = posterior.erase(it);
+			}
+			else
+			{
+				it++;
+			}
 		}
-	} 
+	}
 
 	void getScore()
+	{
+		score = computeScore(first_keys.size(), posterior_keys.size());
+
+		getColor();
+	}
+
+	float computeScore(size_t n_first, size_t n_posterior) const
 	{
 		using namespace octomap;
 
@@ -647,7 +1775,7 @@ public:
 
 		float weight = 0.5;
 
-		float found_volume = (first_keys.size() + posterior_keys.size() * weight) * one_volume;
+		float found_volume = (n_first + n_posterior * weight) * one_volume;
 
 		// third formula
 
@@ -660,17 +1788,19 @@ public:
 
 		float score_volume = outer_volume + inner_volume * weight;
 
-		score = found_volume / score_volume;
-
-		// class_colormap frustum_color("jet", 64, 1, true);
-		getColor();
+		return found_volume / score_volume;
 	}
 
 	void getColor()
+	{
+		score_color = scoreColor(score);
+	}
+
+	static std_msgs::ColorRGBA scoreColor(float a_score)
 	{
 		class_colormap frustum_color("jet", 64, 1, true);
 
-		score_color = frustum_color.color(score * 64);
+		return frustum_color.color(a_score * 64);
 	}
 
 	octomap::point3d_collection getDiscoveredCenters()
@@ -964,4 +2094,6 @@ public:
 
 		return text;
 	}
-};
\ No newline at end of file
+};
+
+#endif // SMOBEX_EXPLORER_EXPLORER
@@ -0,0 +1,290 @@
+#ifndef SMOBEX_EXPLORER_FRUSTUM_CULLER
+#define SMOBEX_EXPLORER_FRUSTUM_CULLER
+
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SMOBEX_FRUSTUM_AVX2
+#include <immintrin.h>
+#endif
+
+// structure of arrays copy of a point cloud, padded to a multiple of the block size with far away points
+class pointsSoA
+{
+public:
+	enum
+	{
+		block_size = 8
+	};
+
+	std::vector<float> x, y, z;
+	size_t n_points;
+
+	// points taken out by remove(), they keep their index
+	std::vector<uint8_t> removed;
+	size_t n_removed;
+
+	pointsSoA()
+	{
+		n_points = 0;
+		n_removed = 0;
+	}
+
+	void assign(const pcl::PointCloud<pcl::PointXYZ> &cloud)
+	{
+		n_points = cloud.size();
+
+		size_t padded = (n_points + block_size - 1) / block_size * block_size;
+
+		x.assign(padded, 1e9f);
+		y.assign(padded, 1e9f);
+		z.assign(padded, 1e9f);
+		removed.assign(padded, 0);
+		n_removed = 0;
+
+		for (size_t i = 0; i < n_points; i++)
+		{
+			x[i] = cloud.points[i].x;
+			y[i] = cloud.points[i].y;
+			z[i] = cloud.points[i].z;
+		}
+	}
+
+	size_t size() const
+	{
+		return n_points;
+	}
+
+	void push_back(float point_x, float point_y, float point_z)
+	{
+		if (n_points == x.size())
+		{
+			x.resize(n_points + block_size, 1e9f);
+			y.resize(n_points + block_size, 1e9f);
+			z.resize(n_points + block_size, 1e9f);
+			removed.resize(n_points + block_size, 0);
+		}
+
+		x[n_points] = point_x;
+		y[n_points] = point_y;
+		z[n_points] = point_z;
+		n_points++;
+	}
+
+	// the point goes far away like the padding, so no frustum test passes it, and the tree queries skip it
+	void remove(size_t i)
+	{
+		if (removed[i])
+		{
+			return;
+		}
+
+		removed[i] = 1;
+		n_removed++;
+
+		x[i] = y[i] = z[i] = 1e9f;
+	}
+
+	inline bool isRemoved(size_t i) const
+	{
+		return removed[i] != 0;
+	}
+};
+
+// frustum test of the camera model pcl::FrustumCulling uses in evaluatePose: apex at the camera,
+// near/far planes along view, the side planes given by the vertical (up) and horizontal (right) FOV.
+// a point is inside iff near <= v <= far, |u| <= v tan(vfov/2) and |r| <= v tan(hfov/2).
+// runs over a pointsSoA block by block (8 points per AVX2 instruction when the cpu has it) and only
+// writes the indexes of the points inside.
+class frustumCuller
+{
+public:
+	// set from the cpu features, clear it to force the scalar path
+	bool use_avx2;
+
+	frustumCuller()
+	{
+#ifdef SMOBEX_FRUSTUM_AVX2
+		use_avx2 = __builtin_cpu_supports("avx2");
+#else
+		use_avx2 = false;
+#endif
+	}
+
+	// view, up and right must be orthonormal, angles in radians
+	void setCamera(const float position[3], const float view[3], const float up[3], const float right[3],
+				   float vertical_FOV, float horizontal_FOV, float near_distance, float far_distance)
+	{
+		for (unsigned i = 0; i < 3; i++)
+		{
+			origin[i] = position[i];
+			view_axis[i] = view[i];
+			up_axis[i] = up[i];
+			right_axis[i] = right[i];
+		}
+
+		tan_vertical = tanf(vertical_FOV / 2);
+		tan_horizontal = tanf(horizontal_FOV / 2);
+		near_plane = near_distance;
+		far_plane = far_distance;
+	}
+
+	void cull(const pointsSoA &points, std::vector<uint32_t> &inside) const
+	{
+		inside.clear();
+
+		cullRange(points, 0, points.size(), inside);
+	}
+
+	// appends the points in [begin, end) that are inside, begin must be a multiple of the block size
+	void cullRange(const pointsSoA &points, size_t begin, size_t end, std::vector<uint32_t> &inside) const
+	{
+#ifdef SMOBEX_FRUSTUM_AVX2
+		if (use_avx2)
+		{
+			cullAVX2(points, begin, end, inside);
+			return;
+		}
+#endif
+		cullScalar(points, begin, end, inside);
+	}
+
+	enum boxClass
+	{
+		box_outside,
+		box_inside,
+		box_crossing
+	};
+
+	// conservative test of an axis aligned box against the 6 planes
+	boxClass classifyBox(const float box_min[3], const float box_max[3]) const
+	{
+		float center[3], extent[3];
+
+		for (unsigned i = 0; i < 3; i++)
+		{
+			center[i] = (box_min[i] + box_max[i]) / 2 - origin[i];
+			extent[i] = (box_max[i] - box_min[i]) / 2;
+		}
+
+		// every plane as n . d + c >= 0, d relative to the camera position
+		float normals[6][3];
+		float offsets[6] = {-near_plane, far_plane, 0, 0, 0, 0};
+
+		for (unsigned i = 0; i < 3; i++)
+		{
+			normals[0][i] = view_axis[i];
+			normals[1][i] = -view_axis[i];
+			normals[2][i] = view_axis[i] * tan_vertical - up_axis[i];
+			normals[3][i] = view_axis[i] * tan_vertical + up_axis[i];
+			normals[4][i] = view_axis[i] * tan_horizontal - right_axis[i];
+			normals[5][i] = view_axis[i] * tan_horizontal + right_axis[i];
+		}
+
+		bool inside = true;
+
+		for (unsigned plane = 0; plane < 6; plane++)
+		{
+			float distance = offsets[plane];
+			float radius = 0;
+
+			for (unsigned i = 0; i < 3; i++)
+			{
+				distance += normals[plane][i] * center[i];
+				radius += fabsf(normals[plane][i]) * extent[i];
+			}
+
+			if (distance + radius < 0)
+			{
+				return box_outside;
+			}
+
+			if (distance - radius < 0)
+			{
+				inside = false;
+			}
+		}
+
+		return inside ? box_inside : box_crossing;
+	}
+
+private:
+	float origin[3];
+	float view_axis[3], up_axis[3], right_axis[3];
+	float tan_vertical, tan_horizontal;
+	float near_plane, far_plane;
+
+	void cullScalar(const pointsSoA &points, size_t begin, size_t end, std::vector<uint32_t> &inside) const
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			float dx = points.x[i] - origin[0];
+			float dy = points.y[i] - origin[1];
+			float dz = points.z[i] - origin[2];
+
+			float v = dx * view_axis[0] + dy * view_axis[1] + dz * view_axis[2];
+			float u = dx * up_axis[0] + dy * up_axis[1] + dz * up_axis[2];
+			float r = dx * right_axis[0] + dy * right_axis[1] + dz * right_axis[2];
+
+			if (v >= near_plane && v <= far_plane && fabsf(u) <= v * tan_vertical && fabsf(r) <= v * tan_horizontal)
+			{
+				inside.push_back(i);
+			}
+		}
+	}
+
+#ifdef SMOBEX_FRUSTUM_AVX2
+	__attribute__((target("avx2"))) void cullAVX2(const pointsSoA &points, size_t begin, size_t end,
+												  std::vector<uint32_t> &inside) const
+	{
+		const __m256 o_x = _mm256_set1_ps(origin[0]), o_y = _mm256_set1_ps(origin[1]), o_z = _mm256_set1_ps(origin[2]);
+		const __m256 v_x = _mm256_set1_ps(view_axis[0]), v_y = _mm256_set1_ps(view_axis[1]), v_z = _mm256_set1_ps(view_axis[2]);
+		const __m256 u_x = _mm256_set1_ps(up_axis[0]), u_y = _mm256_set1_ps(up_axis[1]), u_z = _mm256_set1_ps(up_axis[2]);
+		const __m256 r_x = _mm256_set1_ps(right_axis[0]), r_y = _mm256_set1_ps(right_axis[1]), r_z = _mm256_set1_ps(right_axis[2]);
+		const __m256 tan_v = _mm256_set1_ps(tan_vertical);
+		const __m256 tan_h = _mm256_set1_ps(tan_horizontal);
+		const __m256 near_v = _mm256_set1_ps(near_plane);
+		const __m256 far_v = _mm256_set1_ps(far_plane);
+		const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+		// the padding points are far away, so whole blocks can be tested
+		for (size_t block = begin; block < end; block += pointsSoA::block_size)
+		{
+			__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&points.x[block]), o_x);
+			__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&points.y[block]), o_y);
+			__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&points.z[block]), o_z);
+
+			__m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, v_x), _mm256_mul_ps(dy, v_y)), _mm256_mul_ps(dz, v_z));
+			__m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, u_x), _mm256_mul_ps(dy, u_y)), _mm256_mul_ps(dz, u_z));
+			__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, r_x), _mm256_mul_ps(dy, r_y)), _mm256_mul_ps(dz, r_z));
+
+			__m256 in = _mm256_and_ps(_mm256_cmp_ps(v, near_v, _CMP_GE_OQ), _mm256_cmp_ps(v, far_v, _CMP_LE_OQ));
+			in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_and_ps(u, abs_mask), _mm256_mul_ps(v, tan_v), _CMP_LE_OQ));
+			in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_and_ps(r, abs_mask), _mm256_mul_ps(v, tan_h), _CMP_LE_OQ));
+
+			int mask = _mm256_movemask_ps(in);
+
+			// a range ending inside a block must not take the next points
+			if (block + pointsSoA::block_size > end)
+			{
+				mask &= (1 << (end - block)) - 1;
+			}
+
+			while (mask)
+			{
+				int lane = __builtin_ctz(mask);
+
+				inside.push_back(block + lane);
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+};
+
+#endif // SMOBEX_EXPLORER_FRUSTUM_CULLER
@@ -0,0 +1,528 @@
+#ifndef SMOBEX_EXPLORER_INCREMENTAL_VOXEL_CLUSTERING
+#define SMOBEX_EXPLORER_INCREMENTAL_VOXEL_CLUSTERING
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <pcl/PointIndices.h>
+#include <pcl/point_cloud.h>
+
+#include <smobex_explorer/voxel_clustering.h>
+
+// the clusters of voxelClustering kept from one iteration to the next. only the voxels that left or joined the
+// unknown set are looked at: a removed voxel can split its cluster, which is found by searching from its
+// neighbours all at once until only one of the searches is still going, so the cost follows the smaller
+// pieces and not the cluster. an added voxel joins or merges the clusters around it. every cluster keeps
+// its id while it exists (in a split the piece whose search runs out last keeps it, which is usually but not
+// always the biggest, in a merge the biggest cluster), new pieces get new ids, and the centroids are kept as
+// running sums
+class incrementalVoxelClustering
+{
+public:
+	struct clusterStats
+	{
+		size_t size;
+		double sum_x, sum_y, sum_z;
+
+		void centroid(double &x, double &y, double &z) const
+		{
+			x = sum_x / size;
+			y = sum_y / size;
+			z = sum_z / size;
+		}
+	};
+
+	incrementalVoxelClustering(double _resolution, float _radius = 2 * sqrt(1.1))
+	{
+		radius = _radius;
+		voxelClustering::neighbourKeys(radius, neighbour_keys);
+
+		resolution = _resolution;
+		next_id = 0;
+	}
+
+	// forgets every cluster when the resolution changes
+	void setResolution(double _resolution)
+	{
+		if (_resolution != resolution)
+		{
+			resolution = _resolution;
+			clear();
+		}
+	}
+
+	void clear()
+	{
+		label_of.clear();
+		clusters.clear();
+	}
+
+	bool empty() const
+	{
+		return label_of.empty();
+	}
+
+	// by id, the ids of the clusters that survived the last update did not change
+	const std::map<int, clusterStats> &getClusters() const
+	{
+		return clusters;
+	}
+
+	// the center of every clustered voxel and its cluster id, in no particular order
+	template <typename PointT>
+	void voxels(pcl::PointCloud<PointT> &centers, std::vector<int> &labels) const
+	{
+		centers.clear();
+		labels.clear();
+		centers.reserve(label_of.size());
+		labels.reserve(label_of.size());
+
+		for (std::unordered_map<int64_t, int>::const_iterator it = label_of.begin(); it != label_of.end(); it++)
+		{
+			double x, y, z;
+			center(it->first, x, y, z);
+
+			PointT point;
+			point.x = x;
+			point.y = y;
+			point.z = z;
+
+			centers.push_back(point);
+			labels.push_back(it->second);
+		}
+	}
+
+	// cluster id of the voxel holding the point, -1 if it is not in any
+	template <typename PointT>
+	int label(const PointT &point) const
+	{
+		std::unordered_map<int64_t, int>::const_iterator it = label_of.find(pointKey(point));
+
+		return it == label_of.end() ? -1 : it->second;
+	}
+
+	// brings the clusters to the voxels of cloud. the first time (or after clear) it clusters everything,
+	// afterwards one hash lookup per voxel finds what left or joined, and only that is reclustered. when the
+	// caller knows what changed, remove() and add() skip the lookups
+	template <typename PointT>
+	void update(const pcl::PointCloud<PointT> &cloud)
+	{
+		if (empty())
+		{
+			reset(cloud);
+			return;
+		}
+
+		std::unordered_set<int64_t> current;
+		current.reserve(cloud.size());
+
+		std::vector<int64_t> added;
+
+		for (size_t idx = 0; idx < cloud.size(); idx++)
+		{
+			int64_t key = pointKey(cloud.points[idx]);
+
+			if (current.insert(key).second && label_of.find(key) == label_of.end())
+			{
+				added.push_back(key);
+			}
+		}
+
+		std::vector<int64_t> removed;
+
+		for (std::unordered_map<int64_t, int>::const_iterator it = label_of.begin(); it != label_of.end(); it++)
+		{
+			if (current.find(it->first) == current.end())
+			{
+				removed.push_back(it->first);
+			}
+		}
+
+		removeKeys(removed);
+		addKeys(added);
+	}
+
+	// the voxels of the points left the unknown set
+	template <typename PointT>
+	void remove(const pcl::PointCloud<PointT> &points)
+	{
+		std::vector<int64_t> keys(points.size());
+
+		for (size_t idx = 0; idx < points.size(); idx++)
+		{
+			keys[idx] = pointKey(points.points[idx]);
+		}
+
+		removeKeys(keys);
+	}
+
+	// the voxels of the points joined the unknown set
+	template <typename PointT>
+	void add(const pcl::PointCloud<PointT> &points)
+	{
+		std::vector<int64_t> keys(points.size());
+
+		for (size_t idx = 0; idx < points.size(); idx++)
+		{
+			keys[idx] = pointKey(points.points[idx]);
+		}
+
+		addKeys(keys);
+	}
+
+private:
+	double resolution;
+	float radius;
+	std::vector<int64_t> neighbour_keys;
+
+	std::unordered_map<int64_t, int> label_of;
+	std::map<int, clusterStats> clusters;
+	int next_id;
+
+	template <typename PointT>
+	int64_t pointKey(const PointT &point) const
+	{
+		int coord[3] = {(int)floor(point.x / resolution), (int)floor(point.y / resolution),
+						(int)floor(point.z / resolution)};
+
+		return voxelClustering::key(coord);
+	}
+
+	void center(int64_t key, double &x, double &y, double &z) const
+	{
+		int coord[3];
+		voxelClustering::unpackKey(key, coord);
+
+		x = (coord[0] + 0.5) * resolution;
+		y = (coord[1] + 0.5) * resolution;
+		z = (coord[2] + 0.5) * resolution;
+	}
+
+	void addToStats(clusterStats &stats, int64_t key, int sign) const
+	{
+		double x, y, z;
+		center(key, x, y, z);
+
+		stats.size += sign;
+		stats.sum_x += sign * x;
+		stats.sum_y += sign * y;
+		stats.sum_z += sign * z;
+	}
+
+	int newCluster()
+	{
+		clusterStats stats = {0, 0, 0, 0};
+		clusters[next_id] = stats;
+
+		return next_id++;
+	}
+
+	template <typename PointT>
+	void reset(const pcl::PointCloud<PointT> &cloud)
+	{
+		clear();
+
+		pcl::IndicesClusters full_clusters;
+		voxelClustering clustering(resolution, radius);
+		clustering.segment(cloud, full_clusters);
+
+		label_of.reserve(cloud.size());
+
+		for (size_t cluster_idx = 0; cluster_idx < full_clusters.size(); cluster_idx++)
+		{
+			int id = newCluster();
+			clusterStats &stats = clusters[id];
+
+			for (size_t idx = 0; idx < full_clusters[cluster_idx].indices.size(); idx++)
+			{
+				int64_t key = pointKey(cloud.points[full_clusters[cluster_idx].indices[idx]]);
+
+				// the same voxel twice
+				if (label_of.insert(std::make_pair(key, id)).second)
+				{
+					addToStats(stats, key, 1);
+				}
+			}
+		}
+	}
+
+	void addKeys(const std::vector<int64_t> &keys)
+	{
+		for (size_t idx = 0; idx < keys.size(); idx++)
+		{
+			int64_t key = keys[idx];
+
+			if (label_of.find(key) != label_of.end())
+			{
+				continue;
+			}
+
+			// the biggest cluster around takes the voxel and the others
+			int id = -1;
+			std::vector<int> others;
+
+			for (size_t n = 0; n < neighbour_keys.size(); n++)
+			{
+				std::unordered_map<int64_t, int>::const_iterator it = label_of.find(key + neighbour_keys[n]);
+
+				if (it == label_of.end() || it->second == id ||
+					std::find(others.begin(), others.end(), it->second) != others.end())
+				{
+					continue;
+				}
+
+				if (id < 0 || clusters[it->second].size > clusters[id].size)
+				{
+					if (id >= 0)
+					{
+						others.push_back(id);
+					}
+
+					id = it->second;
+				}
+				else
+				{
+					others.push_back(it->second);
+				}
+			}
+
+			if (id < 0)
+			{
+				id = newCluster();
+			}
+
+			label_of[key] = id;
+			addToStats(clusters[id], key, 1);
+
+			for (size_t other = 0; other < others.size(); other++)
+			{
+				relabel(others[other], id, key);
+			}
+		}
+	}
+
+	// flood from the neighbours of from_key over the voxels of cluster from, they all go to cluster to
+	void relabel(int from, int to, int64_t from_key)
+	{
+		std::vector<int64_t> queue;
+
+		for (size_t n = 0; n < neighbour_keys.size(); n++)
+		{
+			std::unordered_map<int64_t, int>::iterator it = label_of.find(from_key + neighbour_keys[n]);
+
+			if (it != label_of.end() && it->second == from)
+			{
+				it->second = to;
+				queue.push_back(it->first);
+			}
+		}
+
+		for (size_t head = 0; head < queue.size(); head++)
+		{
+			for (size_t n = 0; n < neighbour_keys.size(); n++)
+			{
+				std::unordered_map<int64_t, int>::iterator it = label_of.find(queue[head] + neighbour_keys[n]);
+
+				if (it != label_of.end() && it->second == from)
+				{
+					it->second = to;
+					queue.push_back(it->first);
+				}
+			}
+		}
+
+		clusterStats &from_stats = clusters[from];
+		clusterStats &to_stats = clusters[to];
+
+		to_stats.size += from_stats.size;
+		to_stats.sum_x += from_stats.sum_x;
+		to_stats.sum_y += from_stats.sum_y;
+		to_stats.sum_z += from_stats.sum_z;
+
+		clusters.erase(from);
+	}
+
+	void removeKeys(const std::vector<int64_t> &keys)
+	{
+		// the neighbours left behind in every cluster that lost voxels
+		std::map<int, std::vector<int64_t> > seeds;
+
+		for (size_t idx = 0; idx < keys.size(); idx++)
+		{
+			std::unordered_map<int64_t, int>::iterator it = label_of.find(keys[idx]);
+
+			if (it == label_of.end())
+			{
+				continue;
+			}
+
+			int id = it->second;
+			label_of.erase(it);
+
+			clusterStats &stats = clusters[id];
+			addToStats(stats, keys[idx], -1);
+
+			if (stats.size == 0)
+			{
+				clusters.erase(id);
+				seeds.erase(id);
+				continue;
+			}
+
+			std::vector<int64_t> &cluster_seeds = seeds[id];
+
+			for (size_t n = 0; n < neighbour_keys.size(); n++)
+			{
+				cluster_seeds.push_back(keys[idx] + neighbour_keys[n]);
+			}
+		}
+
+		for (std::map<int, std::vector<int64_t> >::iterator it = seeds.begin(); it != seeds.end(); it++)
+		{
+			if (clusters.find(it->first) != clusters.end())
+			{
+				split(it->first, it->second);
+			}
+		}
+	}
+
+	// one search per seed still in the cluster, searches that meet become one. a search that runs out on its own
+	// is a piece cut off from the rest and gets a new id, the last search going keeps the id of the cluster
+	void split(int id, const std::vector<int64_t> &candidate_seeds)
+	{
+		std::unordered_map<int64_t, int> owner;
+		std::vector<std::vector<int64_t> > queues;
+		std::vector<size_t> heads;
+		std::vector<int> group_parent;
+		std::vector<bool> cut;
+
+		for (size_t idx = 0; idx < candidate_seeds.size(); idx++)
+		{
+			std::unordered_map<int64_t, int>::const_iterator it = label_of.find(candidate_seeds[idx]);
+
+			if (it == label_of.end() || it->second != id || owner.find(candidate_seeds[idx]) != owner.end())
+			{
+				continue;
+			}
+
+			owner[candidate_seeds[idx]] = queues.size();
+			queues.push_back(std::vector<int64_t>(1, candidate_seeds[idx]));
+			heads.push_back(0);
+			group_parent.push_back(group_parent.size());
+			cut.push_back(false);
+		}
+
+		size_t n_groups = queues.size();
+
+		while (n_groups > 1)
+		{
+			// one step of every search, then the searches that ran out
+			for (size_t group = 0; group < queues.size(); group++)
+			{
+				if (heads[group] == queues[group].size())
+				{
+					continue;
+				}
+
+				int64_t key = queues[group][heads[group]++];
+
+				for (size_t n = 0; n < neighbour_keys.size(); n++)
+				{
+					int64_t neighbour = key + neighbour_keys[n];
+					std::unordered_map<int64_t, int>::const_iterator it = label_of.find(neighbour);
+
+					if (it == label_of.end() || it->second != id)
+					{
+						continue;
+					}
+
+					std::pair<std::unordered_map<int64_t, int>::iterator, bool> visited =
+						owner.insert(std::make_pair(neighbour, (int)group));
+
+					if (visited.second)
+					{
+						queues[group].push_back(neighbour);
+					}
+					else
+					{
+						int a = findGroup(group_parent, group);
+						int b = findGroup(group_parent, visited.first->second);
+
+						if (a != b)
+						{
+							group_parent[b] = a;
+							n_groups--;
+						}
+					}
+				}
+			}
+
+			// groups whose searches all ran out
+			std::vector<bool> going(queues.size(), false);
+
+			for (size_t group = 0; group < queues.size(); group++)
+			{
+				if (heads[group] < queues[group].size())
+				{
+					going[findGroup(group_parent, group)] = true;
+				}
+			}
+
+			for (size_t group = 0; group < queues.size() && n_groups > 1; group++)
+			{
+				if (cut[group] || going[group] || findGroup(group_parent, group) != (int)group)
+				{
+					continue;
+				}
+
+				cutOff(id, group, group_parent, cut, queues);
+				n_groups--;
+			}
+		}
+	}
+
+	static int findGroup(std::vector<int> &group_parent, int group)
+	{
+		while (group_parent[group] != group)
+		{
+			// path halving
+			group_parent[group] = group_parent[group_parent[group]];
+			group = group_parent[group];
+		}
+
+		return group;
+	}
+
+	// the voxels found by the searches of root leave cluster id for a new one
+	void cutOff(int id, int root, std::vector<int> &group_parent, std::vector<bool> &cut,
+				const std::vector<std::vector<int64_t> > &queues)
+	{
+		int new_id = newCluster();
+		clusterStats &new_stats = clusters[new_id];
+		clusterStats &old_stats = clusters[id];
+
+		for (size_t group = 0; group < queues.size(); group++)
+		{
+			if (cut[group] || findGroup(group_parent, group) != root)
+			{
+				continue;
+			}
+
+			cut[group] = true;
+
+			for (size_t idx = 0; idx < queues[group].size(); idx++)
+			{
+				label_of[queues[group][idx]] = new_id;
+				addToStats(new_stats, queues[group][idx], 1);
+				addToStats(old_stats, queues[group][idx], -1);
+			}
+		}
+	}
+};
+
+#endif // SMOBEX_EXPLORER_INCREMENTAL_VOXEL_CLUSTERING
@@ -0,0 +1,149 @@
+#ifndef SMOBEX_EXPLORER_MAP_SETTLED_MONITOR
+#define SMOBEX_EXPLORER_MAP_SETTLED_MONITOR
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ros/ros.h>
+#include <sensor_msgs/JointState.h>
+
+#include <octomap_msgs/Octomap.h>
+
+// tells when the map took in the view after a move: the arm stopped (every joint slower than velocity_tolerance)
+// and at least min_updates octomaps made from clouds taken after the stop came in, the last of them changing
+// the size of the serialized map by at most size_tolerance. the callbacks run on the spinner threads of the node
+class mapSettledMonitor
+{
+public:
+	double velocity_tolerance = 0.01;
+	double size_tolerance = 0.01;
+	int min_updates = 2;
+
+	// the binary map is enough, only its stamp and size are looked at
+	mapSettledMonitor(ros::NodeHandle &n, const std::string &joint_states_topic = "/joint_states",
+					  const std::string &map_topic = "/octomap_binary")
+	{
+		moving = true;
+		post_stop_updates = 0;
+		last_size = 0;
+		last_change = 1;
+
+		joint_states_sub = n.subscribe(joint_states_topic, 10, &mapSettledMonitor::jointStatesCallback, this);
+		map_sub = n.subscribe(map_topic, 1, &mapSettledMonitor::mapCallback, this);
+	}
+
+	// blocks until the map settled after the last move, false if it did not within timeout
+	bool waitSettled(ros::Duration timeout)
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		ros::WallTime deadline = ros::WallTime::now() + ros::WallDuration(timeout.toSec());
+
+		while (!settled() && ros::ok())
+		{
+			ros::WallDuration left = deadline - ros::WallTime::now();
+
+			if (left <= ros::WallDuration(0))
+			{
+				return false;
+			}
+
+			// ros time may be simulated, so wake up now and then
+			changed.timed_wait(lock, boost::posix_time::milliseconds(std::min<int64_t>(left.toNSec() / 1000000 + 1, 100)));
+		}
+
+		return settled();
+	}
+
+private:
+	ros::Subscriber joint_states_sub;
+	ros::Subscriber map_sub;
+
+	boost::mutex mutex;
+	boost::condition_variable changed;
+
+	sensor_msgs::JointState last_joints;
+	bool moving;
+	ros::Time stopped_since;
+
+	int post_stop_updates;
+	size_t last_size;
+	double last_change;
+
+	bool settled() const
+	{
+		return !moving && post_stop_updates >= min_updates && last_change <= size_tolerance;
+	}
+
+	void jointStatesCallback(const sensor_msgs::JointStateConstPtr &joints)
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		bool now_moving = false;
+
+		if (!joints->velocity.empty())
+		{
+			for (size_t i = 0; i < joints->velocity.size(); i++)
+			{
+				now_moving = now_moving || fabs(joints->velocity[i]) > velocity_tolerance;
+			}
+		}
+
+		// drivers that only publish positions
+		double dt = (joints->header.stamp - last_joints.header.stamp).toSec();
+
+		if (dt > 0 && last_joints.position.size() == joints->position.size())
+		{
+			for (size_t i = 0; i < joints->position.size(); i++)
+			{
+				now_moving = now_moving || fabs(joints->position[i] - last_joints.position[i]) / dt > velocity_tolerance;
+			}
+		}
+		else if (last_joints.position.empty())
+		{
+			now_moving = true;
+		}
+
+		last_joints = *joints;
+
+		if (now_moving)
+		{
+			moving = true;
+			post_stop_updates = 0;
+		}
+		else if (moving)
+		{
+			moving = false;
+			stopped_since = joints->header.stamp;
+			post_stop_updates = 0;
+			last_change = 1;
+		}
+
+		changed.notify_all();
+	}
+
+	void mapCallback(const octomap_msgs::OctomapConstPtr &map)
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		size_t size = map->data.size();
+		ros::Time stamp = map->header.stamp.isZero() ? ros::Time::now() : map->header.stamp;
+
+		if (!moving && stamp > stopped_since)
+		{
+			last_change = fabs((double)size - (double)last_size) / std::max<size_t>(last_size, 1);
+			post_stop_updates++;
+		}
+
+		last_size = size;
+
+		changed.notify_all();
+	}
+};
+
+#endif // SMOBEX_EXPLORER_MAP_SETTLED_MONITOR
@@ -0,0 +1,394 @@
+#ifndef SMOBEX_EXPLORER_MAP_SNAPSHOT
+#define SMOBEX_EXPLORER_MAP_SNAPSHOT
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <octomap/octomap.h>
+#include <octomap_msgs/Octomap.h>
+#include <octomap_msgs/conversions.h>
+
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <smobex_explorer/dense_voxel_grid.h>
+#include <smobex_explorer/frustum_culler.h>
+#include <smobex_explorer/shared_octree_registry.h>
+#include <smobex_explorer/unknown_bvh.h>
+#include <smobex_explorer/unknown_space_extractor.h>
+
+// one consistent set of maps: both octrees and everything evaluatePose derives from them.
+// owns the trees, evaluatePose::swapSnapshot exchanges its own maps with the ones in here
+class mapSnapshot
+{
+public:
+	unsigned long version;
+
+	octomap::OcTree *known_tree;
+	octomap::OcTree *unknown_tree;
+
+	pcl::PointCloud<pcl::PointXYZ> unknown_centers_pcl;
+	pointsSoA unknown_centers_soa;
+	mortonBVH unknown_bvh;
+	denseVoxelGrid dense_grid;
+
+	mapSnapshot()
+	{
+		version = 0;
+		known_tree = NULL;
+		unknown_tree = NULL;
+	}
+
+	~mapSnapshot()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		delete known_tree;
+		delete unknown_tree;
+
+		known_tree = NULL;
+		unknown_tree = NULL;
+
+		dense_grid.clear();
+	}
+
+	void build(const octomap_msgs::Octomap &known_map, const octomap_msgs::Octomap &unknown_map,
+			   const sensor_msgs::PointCloud2 &unknown_cloud, const octomap::point3d &min_bbx,
+			   const octomap::point3d &max_bbx, double dense_grid_margin)
+	{
+		build(dynamic_cast<octomap::OcTree *>(octomap_msgs::msgToMap(known_map)), unknown_map, unknown_cloud, min_bbx,
+			  max_bbx, dense_grid_margin);
+	}
+
+	// takes ownership of known
+	void build(octomap::OcTree *known, const octomap_msgs::Octomap &unknown_map,
+			   const sensor_msgs::PointCloud2 &unknown_cloud, const octomap::point3d &min_bbx,
+			   const octomap::point3d &max_bbx, double dense_grid_margin)
+	{
+		clear();
+
+		known_tree = known;
+		unknown_tree = dynamic_cast<octomap::OcTree *>(octomap_msgs::msgToMap(unknown_map));
+
+		pcl::fromROSMsg(unknown_cloud, unknown_centers_pcl);
+		unknown_centers_soa.assign(unknown_centers_pcl);
+		unknown_bvh.build(unknown_centers_soa);
+
+		if (known_tree != NULL && unknown_tree != NULL)
+		{
+			dense_grid.build(known_tree, unknown_tree, min_bbx, max_bbx, dense_grid_margin);
+		}
+	}
+
+	// takes ownership of known, the unknown tree and centers are extracted from it
+	void build(octomap::OcTree *known, const unknownSpaceExtractor &extractor, double dense_grid_margin)
+	{
+		clear();
+
+		known_tree = known;
+
+		if (known_tree == NULL)
+		{
+			return;
+		}
+
+		unknown_tree = extractor.extract(*known_tree, unknown_centers_pcl);
+		unknown_centers_soa.assign(unknown_centers_pcl);
+		unknown_bvh.build(unknown_centers_soa);
+
+		dense_grid.build(known_tree, unknown_tree, extractor.min_bbx, extractor.max_bbx, dense_grid_margin);
+	}
+
+	bool valid() const
+	{
+		return known_tree != NULL && unknown_tree != NULL;
+	}
+
+private:
+	mapSnapshot(const mapSnapshot &);
+	mapSnapshot &operator=(const mapSnapshot &);
+};
+
+typedef boost::shared_ptr<mapSnapshot> mapSnapshotPtr;
+
+// builds map snapshots in a background thread, from /octomap_full (or its sharedOctreeRegistry entry),
+// /unknown_full_map and /unknown_pc.
+// double buffered: while the evaluator scores against the maps it holds, the next snapshot is prepared here,
+// and the maps the evaluator gives back on a swap become the buffer of the one after that
+class mapSnapshotManager
+{
+public:
+	std::string known_topic = "/octomap_full";
+	std::string unknown_topic = "/unknown_full_map";
+	std::string unknown_cloud_topic = "/unknown_pc";
+	// extract the unknown space from the known tree instead of reading the two unknown topics
+	bool extract_unknown = false;
+
+	mapSnapshotManager(const octomap::point3d &_min_bbx, const octomap::point3d &_max_bbx, double _dense_grid_margin)
+	{
+		min_bbx = _min_bbx;
+		max_bbx = _max_bbx;
+		dense_grid_margin = _dense_grid_margin;
+
+		running = false;
+		continuous = false;
+		refresh_requested = true;
+		building = false;
+		built_version = 0;
+	}
+
+	~mapSnapshotManager()
+	{
+		stop();
+	}
+
+	// continuous keeps building snapshots back to back, otherwise only after requestRefresh()
+	void start(bool _continuous = false)
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		if (running)
+		{
+			return;
+		}
+
+		continuous = _continuous;
+		running = true;
+		worker = boost::thread(&mapSnapshotManager::run, this);
+	}
+
+	void stop()
+	{
+		{
+			boost::mutex::scoped_lock lock(mutex);
+
+			if (!running)
+			{
+				return;
+			}
+
+			running = false;
+		}
+
+		wake_worker.notify_all();
+		worker.join();
+	}
+
+	// asks for a snapshot of the maps from now on, returns the version it will have.
+	// a build that already started may hold older messages, so then it is the one after it
+	unsigned long requestRefresh()
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		refresh_requested = true;
+		wake_worker.notify_all();
+
+		return built_version + (building ? 2 : 1);
+	}
+
+	// version of the last snapshot that was built, 0 before the first one
+	unsigned long version()
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		return built_version;
+	}
+
+	// the newest built snapshot if it is newer than min_version, waiting up to timeout for it. NULL otherwise
+	mapSnapshotPtr take(unsigned long min_version, ros::Duration timeout = ros::Duration(0))
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		ros::WallTime deadline = ros::WallTime::now() + ros::WallDuration(timeout.toSec());
+
+		while (!(ready && ready->version > min_version) && running)
+		{
+			ros::WallDuration left = deadline - ros::WallTime::now();
+
+			if (left <= ros::WallDuration(0))
+			{
+				break;
+			}
+
+			ready_cond.timed_wait(lock, boost::posix_time::microseconds(left.toNSec() / 1000));
+		}
+
+		if (!ready || ready->version <= min_version)
+		{
+			return mapSnapshotPtr();
+		}
+
+		mapSnapshotPtr snapshot = ready;
+		ready.reset();
+
+		return snapshot;
+	}
+
+	// hands a swapped out snapshot back, its memory is reused for the next build
+	void recycle(const mapSnapshotPtr &snapshot)
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		spare = snapshot;
+	}
+
+private:
+	octomap::point3d min_bbx, max_bbx;
+	double dense_grid_margin;
+
+	boost::thread worker;
+	boost::mutex mutex;
+	boost::condition_variable wake_worker;
+	boost::condition_variable ready_cond;
+
+	bool running;
+	bool continuous;
+	bool refresh_requested;
+	bool building;
+	unsigned long built_version;
+
+	mapSnapshotPtr ready;
+	mapSnapshotPtr spare;
+
+	template <class T>
+	boost::shared_ptr<const T> waitFor(const std::string &topic, ros::NodeHandle &n)
+	{
+		boost::shared_ptr<const T> msg;
+
+		while (!msg && isRunning())
+		{
+			msg = ros::topic::waitForMessage<T>(topic, n, ros::Duration(1));
+		}
+
+		return msg;
+	}
+
+	bool isRunning()
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		return running && ros::ok();
+	}
+
+	void run()
+	{
+		ros::NodeHandle n;
+
+		while (true)
+		{
+			mapSnapshotPtr buffer;
+
+			{
+				boost::mutex::scoped_lock lock(mutex);
+
+				while (running && !refresh_requested && !continuous)
+				{
+					wake_worker.wait(lock);
+				}
+
+				if (!running)
+				{
+					return;
+				}
+
+				refresh_requested = false;
+				building = true;
+
+				buffer = spare;
+				spare.reset();
+			}
+
+			// the known tree comes straight from a shared octomap server nodelet when there is one in this process
+			sharedOctreeRegistry &registry = sharedOctreeRegistry::instance();
+			octomap::OcTree *known = NULL;
+
+			if (registry.advertised(known_topic))
+			{
+				registry.request(known_topic);
+			}
+
+			octomap_msgs::OctomapConstPtr known_map;
+			octomap_msgs::OctomapConstPtr unknown_map;
+			sensor_msgs::PointCloud2ConstPtr unknown_cloud;
+
+			if (!extract_unknown)
+			{
+				unknown_map = waitFor<octomap_msgs::Octomap>(unknown_topic, n);
+				unknown_cloud = waitFor<sensor_msgs::PointCloud2>(unknown_cloud_topic, n);
+			}
+
+			if (registry.advertised(known_topic))
+			{
+				known = registry.take(known_topic, ros::Duration(1));
+			}
+
+			if (known == NULL)
+			{
+				known_map = waitFor<octomap_msgs::Octomap>(known_topic, n);
+			}
+
+			if ((known == NULL && !known_map) || (!extract_unknown && (!unknown_map || !unknown_cloud)))
+			{
+				delete known;
+				return;
+			}
+
+			if (!buffer)
+			{
+				buffer.reset(new mapSnapshot);
+			}
+
+			if (extract_unknown)
+			{
+				if (known == NULL)
+				{
+					known = dynamic_cast<octomap::OcTree *>(octomap_msgs::msgToMap(*known_map));
+				}
+
+				buffer->build(known, unknownSpaceExtractor(min_bbx, max_bbx), dense_grid_margin);
+			}
+			else if (known != NULL)
+			{
+				buffer->build(known, *unknown_map, *unknown_cloud, min_bbx, max_bbx, dense_grid_margin);
+			}
+			else
+			{
+				buffer->build(*known_map, *unknown_map, *unknown_cloud, min_bbx, max_bbx, dense_grid_margin);
+			}
+
+			boost::mutex::scoped_lock lock(mutex);
+
+			building = false;
+
+			if (!buffer->valid())
+			{
+				ROS_WARN("Could not read the maps, snapshot dropped.");
+				refresh_requested = true;
+				continue;
+			}
+
+			buffer->version = ++built_version;
+
+			// a snapshot nobody took is superseded, its memory is the next buffer
+			if (ready)
+			{
+				spare = ready;
+			}
+
+			ready = buffer;
+			ready_cond.notify_all();
+		}
+	}
+};
+
+#endif // SMOBEX_EXPLORER_MAP_SNAPSHOT
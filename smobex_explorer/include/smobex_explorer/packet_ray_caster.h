@@ -0,0 +1,462 @@
+#ifndef SMOBEX_EXPLORER_PACKET_RAY_CASTER
+#define SMOBEX_EXPLORER_PACKET_RAY_CASTER
+
+#include <stdint.h>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include <smobex_explorer/dense_voxel_grid.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SMOBEX_PACKET_AVX2
+#include <immintrin.h>
+#endif
+
+// per thread bookkeeping of the packet ray caster, indexed by the unknown ids of the grid.
+// a voxel is counted once as first seen and once as seen behind another one, like the key sets of evalPose
+class packetRayScratch
+{
+public:
+	std::vector<uint32_t> covered_stamp;
+	std::vector<uint32_t> first_stamp;
+	std::vector<uint32_t> posterior_stamp;
+	uint32_t stamp;
+
+	size_t n_first;
+	size_t n_posterior;
+
+	packetRayScratch()
+	{
+		stamp = 0;
+		n_first = 0;
+		n_posterior = 0;
+	}
+
+	// starts the bookkeeping of a new pose
+	void reset(size_t n_unknown)
+	{
+		if (covered_stamp.size() != n_unknown)
+		{
+			covered_stamp.assign(n_unknown, 0);
+			first_stamp.assign(n_unknown, 0);
+			posterior_stamp.assign(n_unknown, 0);
+			stamp = 0;
+		}
+
+		stamp++;
+
+		if (stamp == 0)
+		{
+			std::fill(covered_stamp.begin(), covered_stamp.end(), 0);
+			std::fill(first_stamp.begin(), first_stamp.end(), 0);
+			std::fill(posterior_stamp.begin(), posterior_stamp.end(), 0);
+			stamp = 1;
+		}
+
+		n_first = 0;
+		n_posterior = 0;
+	}
+
+	inline bool isCovered(int32_t id) const
+	{
+		return id >= 0 && covered_stamp[id] == stamp;
+	}
+};
+
+// walks up to 8 rays from a common origin towards unknown target voxels through a denseVoxelGrid,
+// 3D-DDA in voxel units. fuses what evalPose does with castRay + computeRayKeys + to_visit:
+// before hitting an occupied voxel every unknown voxel (past min_range) is counted as first or posterior
+// seen, after the hit the walk only goes on to the target, marking the voxels in between as covered.
+// the counts go straight into scratch.n_first/n_posterior, no key lists are built. like removeFirstFromPosterior,
+// a voxel that is first seen by any ray is not counted as posterior seen.
+// uses AVX2 when the cpu has it, otherwise the same steps one lane at a time.
+class packetRayCaster
+{
+public:
+	enum
+	{
+		packet_size = 8
+	};
+
+	const denseVoxelGrid &grid;
+	packetRayScratch &scratch;
+
+	// set from the cpu features, clear it to force the one lane at a time path
+	bool use_avx2;
+
+	// what each lane added to the counts of the scratch, a posterior voxel taken back later is not taken off
+	int32_t first_hits[packet_size];
+	int32_t posterior_hits[packet_size];
+
+	packetRayCaster(const denseVoxelGrid &_grid, packetRayScratch &_scratch) : grid(_grid), scratch(_scratch)
+	{
+#ifdef SMOBEX_PACKET_AVX2
+		use_avx2 = __builtin_cpu_supports("avx2");
+#else
+		use_avx2 = false;
+#endif
+	}
+
+	// origin must lie inside the grid
+	void setOrigin(const octomap::point3d &origin, float min_range, float max_range)
+	{
+		for (unsigned i = 0; i < 3; i++)
+		{
+			origin_v[i] = (origin(i) - grid.corner(i)) / grid.resolution;
+			origin_key[i] = (int32_t)floorf(origin_v[i]);
+		}
+
+		min_sq = (min_range / grid.resolution) * (min_range / grid.resolution);
+		max_sq = (max_range / grid.resolution) * (max_range / grid.resolution);
+	}
+
+	bool originInside() const
+	{
+		return (unsigned)origin_key[0] < (unsigned)grid.size_x && (unsigned)origin_key[1] < (unsigned)grid.size_y &&
+			   (unsigned)origin_key[2] < (unsigned)grid.size_z;
+	}
+
+	void cast(const octomap::OcTreeKey *targets, int n_rays)
+	{
+		for (int lane = 0; lane < packet_size; lane++)
+		{
+			first_hits[lane] = 0;
+			posterior_hits[lane] = 0;
+			seen_first[lane] = 0;
+
+			if (lane >= n_rays)
+			{
+				active[lane] = 0;
+				hit[lane] = 0;
+				continue;
+			}
+
+			float target_v[3];
+			float dir[3];
+			float norm = 0;
+
+			for (unsigned i = 0; i < 3; i++)
+			{
+				target_key[i][lane] = (int32_t)targets[lane][i] - (int32_t)grid.min_key[i];
+				target_v[i] = target_key[i][lane] + 0.5f;
+				dir[i] = target_v[i] - origin_v[i];
+				norm += dir[i] * dir[i];
+			}
+
+			norm = sqrtf(norm);
+			target_dist_sq[lane] = 0;
+
+			for (unsigned i = 0; i < 3; i++)
+			{
+				float center_delta = target_key[i][lane] + 0.5f - origin_v[i];
+				target_dist_sq[lane] += center_delta * center_delta;
+
+				dir[i] = norm > 0 ? dir[i] / norm : 0;
+				key[i][lane] = origin_key[i];
+
+				if (dir[i] > 0)
+				{
+					step[i][lane] = 1;
+					t_max[i][lane] = (origin_key[i] + 1 - origin_v[i]) / dir[i];
+					t_delta[i][lane] = 1 / dir[i];
+				}
+				else if (dir[i] < 0)
+				{
+					step[i][lane] = -1;
+					t_max[i][lane] = (origin_key[i] - origin_v[i]) / dir[i];
+					t_delta[i][lane] = -1 / dir[i];
+				}
+				else
+				{
+					step[i][lane] = 0;
+					t_max[i][lane] = FLT_MAX;
+					t_delta[i][lane] = FLT_MAX;
+				}
+			}
+
+			active[lane] = norm > 0 ? -1 : 0;
+			hit[lane] = 0;
+
+			// the origin voxel is part of the ray too
+			if (active[lane])
+			{
+				size_t idx = cellIndex(origin_key[0], origin_key[1], origin_key[2]);
+				uint8_t state = grid.cell(idx);
+
+				if (state == denseVoxelGrid::cell_occupied)
+				{
+					hit[lane] = -1;
+				}
+				else if (state == denseVoxelGrid::cell_unknown && centerDistSq(origin_key[0], origin_key[1], origin_key[2]) >= min_sq)
+				{
+					countUnknown(lane, idx);
+				}
+			}
+		}
+
+#ifdef SMOBEX_PACKET_AVX2
+		if (use_avx2)
+		{
+			walkAVX2();
+			return;
+		}
+#endif
+		walkLanes();
+	}
+
+private:
+	float origin_v[3];
+	int32_t origin_key[3];
+	float min_sq, max_sq;
+
+	// structure of arrays, one column per lane
+	float t_max[3][packet_size];
+	float t_delta[3][packet_size];
+	int32_t key[3][packet_size];
+	int32_t step[3][packet_size];
+	int32_t target_key[3][packet_size];
+	float target_dist_sq[packet_size];
+	int32_t active[packet_size];
+	int32_t hit[packet_size];
+	int32_t seen_first[packet_size];
+
+	inline size_t cellIndex(int32_t x, int32_t y, int32_t z) const
+	{
+		return (size_t)x + (size_t)grid.size_x * (y + (size_t)grid.size_y * z);
+	}
+
+	inline float centerDistSq(int32_t x, int32_t y, int32_t z) const
+	{
+		float dx = x + 0.5f - origin_v[0];
+		float dy = y + 0.5f - origin_v[1];
+		float dz = z + 0.5f - origin_v[2];
+
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	inline void countUnknown(int lane, size_t idx)
+	{
+		int32_t id = grid.unknownId(idx);
+
+		scratch.covered_stamp[id] = scratch.stamp;
+
+		if (!seen_first[lane])
+		{
+			seen_first[lane] = 1;
+
+			if (scratch.first_stamp[id] != scratch.stamp)
+			{
+				scratch.first_stamp[id] = scratch.stamp;
+				first_hits[lane]++;
+				scratch.n_first++;
+
+				// an earlier ray saw it behind its first voxel
+				if (scratch.posterior_stamp[id] == scratch.stamp)
+					scratch.n_posterior--;
+			}
+		}
+		else if (scratch.first_stamp[id] != scratch.stamp && scratch.posterior_stamp[id] != scratch.stamp)
+		{
+			scratch.posterior_stamp[id] = scratch.stamp;
+			posterior_hits[lane]++;
+			scratch.n_posterior++;
+		}
+	}
+
+	inline void markCovered(size_t idx)
+	{
+		scratch.covered_stamp[grid.unknownId(idx)] = scratch.stamp;
+	}
+
+	// reference path: the same steps as walkAVX2, one lane after the other
+	void walkLanes()
+	{
+		for (int lane = 0; lane < packet_size; lane++)
+		{
+			while (active[lane])
+			{
+				unsigned dim;
+
+				if (t_max[0][lane] < t_max[1][lane])
+					dim = (t_max[0][lane] < t_max[2][lane]) ? 0 : 2;
+				else
+					dim = (t_max[1][lane] < t_max[2][lane]) ? 1 : 2;
+
+				key[dim][lane] += step[dim][lane];
+				t_max[dim][lane] += t_delta[dim][lane];
+
+				int32_t x = key[0][lane], y = key[1][lane], z = key[2][lane];
+
+				if ((unsigned)x >= (unsigned)grid.size_x || (unsigned)y >= (unsigned)grid.size_y ||
+					(unsigned)z >= (unsigned)grid.size_z)
+				{
+					active[lane] = 0;
+					break;
+				}
+
+				size_t idx = cellIndex(x, y, z);
+				uint8_t state = grid.cell(idx);
+				float dist_sq = centerDistSq(x, y, z);
+
+				if (!hit[lane])
+				{
+					if (dist_sq > max_sq)
+					{
+						active[lane] = 0;
+					}
+					else if (state == denseVoxelGrid::cell_occupied)
+					{
+						hit[lane] = -1;
+					}
+					else if (state == denseVoxelGrid::cell_unknown && dist_sq >= min_sq)
+					{
+						countUnknown(lane, idx);
+					}
+				}
+				else
+				{
+					if ((x == target_key[0][lane] && y == target_key[1][lane] && z == target_key[2][lane]) ||
+						dist_sq > target_dist_sq[lane])
+					{
+						active[lane] = 0;
+					}
+					else if (state == denseVoxelGrid::cell_unknown)
+					{
+						markCovered(idx);
+					}
+				}
+			}
+		}
+	}
+
+#ifdef SMOBEX_PACKET_AVX2
+	__attribute__((target("avx2"))) void walkAVX2()
+	{
+		__m256 t_max_x = _mm256_loadu_ps(t_max[0]);
+		__m256 t_max_y = _mm256_loadu_ps(t_max[1]);
+		__m256 t_max_z = _mm256_loadu_ps(t_max[2]);
+		const __m256 t_delta_x = _mm256_loadu_ps(t_delta[0]);
+		const __m256 t_delta_y = _mm256_loadu_ps(t_delta[1]);
+		const __m256 t_delta_z = _mm256_loadu_ps(t_delta[2]);
+
+		__m256i key_x = _mm256_loadu_si256((const __m256i *)key[0]);
+		__m256i key_y = _mm256_loadu_si256((const __m256i *)key[1]);
+		__m256i key_z = _mm256_loadu_si256((const __m256i *)key[2]);
+		const __m256i step_x = _mm256_loadu_si256((const __m256i *)step[0]);
+		const __m256i step_y = _mm256_loadu_si256((const __m256i *)step[1]);
+		const __m256i step_z = _mm256_loadu_si256((const __m256i *)step[2]);
+		const __m256i target_x = _mm256_loadu_si256((const __m256i *)target_key[0]);
+		const __m256i target_y = _mm256_loadu_si256((const __m256i *)target_key[1]);
+		const __m256i target_z = _mm256_loadu_si256((const __m256i *)target_key[2]);
+		const __m256 target_sq = _mm256_loadu_ps(target_dist_sq);
+
+		__m256i lanes_active = _mm256_loadu_si256((const __m256i *)active);
+		__m256i lanes_hit = _mm256_loadu_si256((const __m256i *)hit);
+
+		const __m256i size_x = _mm256_set1_epi32(grid.size_x);
+		const __m256i size_y = _mm256_set1_epi32(grid.size_y);
+		const __m256i size_z = _mm256_set1_epi32(grid.size_z);
+		const __m256i minus_one = _mm256_set1_epi32(-1);
+		const __m256i fifteen = _mm256_set1_epi32(15);
+		const __m256i three = _mm256_set1_epi32(3);
+		const __m256i unknown_state = _mm256_set1_epi32(denseVoxelGrid::cell_unknown);
+		const __m256i occupied_state = _mm256_set1_epi32(denseVoxelGrid::cell_occupied);
+
+		const __m256 origin_x = _mm256_set1_ps(origin_v[0] - 0.5f);
+		const __m256 origin_y = _mm256_set1_ps(origin_v[1] - 0.5f);
+		const __m256 origin_z = _mm256_set1_ps(origin_v[2] - 0.5f);
+		const __m256 min_dist_sq = _mm256_set1_ps(min_sq);
+		const __m256 max_dist_sq = _mm256_set1_ps(max_sq);
+
+		const int *words = (const int *)&grid.words[0];
+
+		int32_t cell_idx[packet_size];
+		int32_t count_lanes[packet_size];
+
+		while (!_mm256_testz_si256(lanes_active, lanes_active))
+		{
+			// same axis choice as OcTree::castRay
+			__m256 x_lt_y = _mm256_cmp_ps(t_max_x, t_max_y, _CMP_LT_OQ);
+			__m256 x_lt_z = _mm256_cmp_ps(t_max_x, t_max_z, _CMP_LT_OQ);
+			__m256 y_lt_z = _mm256_cmp_ps(t_max_y, t_max_z, _CMP_LT_OQ);
+
+			__m256 active_ps = _mm256_castsi256_ps(lanes_active);
+			__m256 sel_x = _mm256_and_ps(_mm256_and_ps(x_lt_y, x_lt_z), active_ps);
+			__m256 sel_y = _mm256_and_ps(_mm256_andnot_ps(x_lt_y, y_lt_z), active_ps);
+			__m256 sel_z = _mm256_andnot_ps(_mm256_or_ps(sel_x, sel_y), active_ps);
+
+			key_x = _mm256_add_epi32(key_x, _mm256_and_si256(_mm256_castps_si256(sel_x), step_x));
+			key_y = _mm256_add_epi32(key_y, _mm256_and_si256(_mm256_castps_si256(sel_y), step_y));
+			key_z = _mm256_add_epi32(key_z, _mm256_and_si256(_mm256_castps_si256(sel_z), step_z));
+
+			t_max_x = _mm256_add_ps(t_max_x, _mm256_and_ps(sel_x, t_delta_x));
+			t_max_y = _mm256_add_ps(t_max_y, _mm256_and_ps(sel_y, t_delta_y));
+			t_max_z = _mm256_add_ps(t_max_z, _mm256_and_ps(sel_z, t_delta_z));
+
+			// leaving the grid ends the ray, there is no unknown space outside of it
+			__m256i inside = _mm256_and_si256(_mm256_cmpgt_epi32(key_x, minus_one), _mm256_cmpgt_epi32(size_x, key_x));
+			inside = _mm256_and_si256(inside, _mm256_and_si256(_mm256_cmpgt_epi32(key_y, minus_one), _mm256_cmpgt_epi32(size_y, key_y)));
+			inside = _mm256_and_si256(inside, _mm256_and_si256(_mm256_cmpgt_epi32(key_z, minus_one), _mm256_cmpgt_epi32(size_z, key_z)));
+
+			lanes_active = _mm256_and_si256(lanes_active, inside);
+
+			__m256i idx = _mm256_add_epi32(key_x, _mm256_mullo_epi32(size_x, _mm256_add_epi32(key_y, _mm256_mullo_epi32(size_y, key_z))));
+
+			__m256i word = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), words, _mm256_srli_epi32(idx, 4), lanes_active, 4);
+			__m256i state = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_slli_epi32(_mm256_and_si256(idx, fifteen), 1)), three);
+
+			__m256 dx = _mm256_sub_ps(_mm256_cvtepi32_ps(key_x), origin_x);
+			__m256 dy = _mm256_sub_ps(_mm256_cvtepi32_ps(key_y), origin_y);
+			__m256 dz = _mm256_sub_ps(_mm256_cvtepi32_ps(key_z), origin_z);
+			__m256 dist_sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+
+			__m256i is_unknown = _mm256_cmpeq_epi32(state, unknown_state);
+
+			// before the hit: range, occupancy and counting
+			__m256i before_hit = _mm256_andnot_si256(lanes_hit, lanes_active);
+			__m256i beyond = _mm256_and_si256(before_hit, _mm256_castps_si256(_mm256_cmp_ps(dist_sq, max_dist_sq, _CMP_GT_OQ)));
+			before_hit = _mm256_andnot_si256(beyond, before_hit);
+
+			__m256i new_hit = _mm256_and_si256(before_hit, _mm256_cmpeq_epi32(state, occupied_state));
+			__m256i count = _mm256_and_si256(_mm256_andnot_si256(new_hit, before_hit),
+											 _mm256_and_si256(is_unknown, _mm256_castps_si256(_mm256_cmp_ps(dist_sq, min_dist_sq, _CMP_GE_OQ))));
+
+			// after the hit: walk on to the target
+			__m256i after_hit = _mm256_and_si256(lanes_hit, lanes_active);
+			__m256i at_target = _mm256_and_si256(_mm256_cmpeq_epi32(key_x, target_x),
+												 _mm256_and_si256(_mm256_cmpeq_epi32(key_y, target_y), _mm256_cmpeq_epi32(key_z, target_z)));
+			__m256i reached = _mm256_and_si256(after_hit, _mm256_or_si256(at_target, _mm256_castps_si256(_mm256_cmp_ps(dist_sq, target_sq, _CMP_GT_OQ))));
+			__m256i cover = _mm256_and_si256(_mm256_andnot_si256(reached, after_hit), is_unknown);
+
+			lanes_active = _mm256_andnot_si256(_mm256_or_si256(beyond, reached), lanes_active);
+			lanes_hit = _mm256_or_si256(lanes_hit, new_hit);
+
+			int todo = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_or_si256(count, cover)));
+
+			if (todo)
+			{
+				_mm256_storeu_si256((__m256i *)cell_idx, idx);
+				_mm256_storeu_si256((__m256i *)count_lanes, count);
+
+				for (int lane = 0; lane < packet_size; lane++)
+				{
+					if (todo & (1 << lane))
+					{
+						if (count_lanes[lane])
+						{
+							countUnknown(lane, cell_idx[lane]);
+						}
+						else
+						{
+							markCovered(cell_idx[lane]);
+						}
+					}
+				}
+			}
+		}
+	}
+#endif
+};
+
+#endif // SMOBEX_EXPLORER_PACKET_RAY_CASTER
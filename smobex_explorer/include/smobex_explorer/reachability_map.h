@@ -0,0 +1,339 @@
+#ifndef SMOBEX_EXPLORER_REACHABILITY_MAP
+#define SMOBEX_EXPLORER_REACHABILITY_MAP
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// which camera view directions the arm can reach at every voxel of a box of the planning frame, made offline
+// by sweeping the analytic IK (fanuc_m6ib6s_moveit_plugins reachability_map_generator). a voxel holds one bit per
+// view direction bin, the bins are a fibonacci sphere of up to 64 directions. a bit is set when some roll of the
+// camera around that direction has an IK solution inside the joint limits, since getOrientation() picks the roll
+// at random. the file is the header below followed by the words, load() maps it read only so every process
+// using it shares the same pages
+class reachabilityMap
+{
+public:
+	struct fileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t n_directions;
+		int32_t size_x, size_y, size_z;
+		// lower corner of the first voxel
+		float origin[3];
+		float resolution;
+		char frame_id[64];
+	};
+
+	static const uint32_t file_version = 1;
+	static const uint32_t max_directions = 64;
+
+	reachabilityMap()
+	{
+		memset(&header, 0, sizeof(header));
+		words = NULL;
+		mapped = NULL;
+		mapped_size = 0;
+	}
+
+	~reachabilityMap()
+	{
+		unmap();
+	}
+
+	bool empty() const
+	{
+		return words == NULL;
+	}
+
+	int sizeX() const
+	{
+		return header.size_x;
+	}
+
+	int sizeY() const
+	{
+		return header.size_y;
+	}
+
+	int sizeZ() const
+	{
+		return header.size_z;
+	}
+
+	double resolution() const
+	{
+		return header.resolution;
+	}
+
+	uint32_t nDirections() const
+	{
+		return header.n_directions;
+	}
+
+	std::string frameId() const
+	{
+		return std::string(header.frame_id, strnlen(header.frame_id, sizeof(header.frame_id)));
+	}
+
+	// an empty map, every bit cleared, to be filled with set() and written with save()
+	void create(const float origin[3], int size_x, int size_y, int size_z, float resolution, uint32_t n_directions,
+				const std::string &frame_id)
+	{
+		unmap();
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "SMOBEXRM", 8);
+		header.version = file_version;
+		header.n_directions = std::min(std::max<uint32_t>(n_directions, 1), max_directions);
+		header.size_x = std::max(size_x, 1);
+		header.size_y = std::max(size_y, 1);
+		header.size_z = std::max(size_z, 1);
+		std::copy(origin, origin + 3, header.origin);
+		header.resolution = resolution;
+		strncpy(header.frame_id, frame_id.c_str(), sizeof(header.frame_id) - 1);
+
+		owned.assign((size_t)header.size_x * header.size_y * header.size_z, 0);
+		words = owned.data();
+
+		buildDirections();
+	}
+
+	// maps the file read only, false (and the map left empty) when it is missing or not a map
+	bool load(const std::string &path)
+	{
+		unmap();
+
+		int fd = open(path.c_str(), O_RDONLY);
+
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat file_stat;
+
+		if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(fileHeader))
+		{
+			close(fd);
+			return false;
+		}
+
+		void *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (data == MAP_FAILED)
+		{
+			return false;
+		}
+
+		const fileHeader *file_header = static_cast<const fileHeader *>(data);
+
+		size_t n_voxels = (size_t)std::max(file_header->size_x, 0) * std::max(file_header->size_y, 0) *
+						  std::max(file_header->size_z, 0);
+
+		if (memcmp(file_header->magic, "SMOBEXRM", 8) != 0 || file_header->version != file_version ||
+			file_header->n_directions < 1 || file_header->n_directions > max_directions ||
+			file_header->resolution <= 0 || n_voxels == 0 ||
+			(size_t)file_stat.st_size != sizeof(fileHeader) + n_voxels * sizeof(uint64_t))
+		{
+			munmap(data, file_stat.st_size);
+			return false;
+		}
+
+		mapped = data;
+		mapped_size = file_stat.st_size;
+
+		header = *file_header;
+		words = reinterpret_cast<const uint64_t *>(static_cast<const char *>(data) + sizeof(fileHeader));
+
+		buildDirections();
+
+		return true;
+	}
+
+	bool save(const std::string &path) const
+	{
+		if (empty())
+		{
+			return false;
+		}
+
+		FILE *file = fopen(path.c_str(), "wb");
+
+		if (file == NULL)
+		{
+			return false;
+		}
+
+		size_t n_voxels = (size_t)header.size_x * header.size_y * header.size_z;
+
+		bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+					   fwrite(words, sizeof(uint64_t), n_voxels, file) == n_voxels;
+
+		return fclose(file) == 0 && written;
+	}
+
+	// unit vector of a direction bin
+	void direction(uint32_t bin, double &dx, double &dy, double &dz) const
+	{
+		dx = bin_directions[3 * bin];
+		dy = bin_directions[3 * bin + 1];
+		dz = bin_directions[3 * bin + 2];
+	}
+
+	// centre of a voxel
+	void voxelCenter(int ix, int iy, int iz, double &x, double &y, double &z) const
+	{
+		x = header.origin[0] + (ix + 0.5) * header.resolution;
+		y = header.origin[1] + (iy + 0.5) * header.resolution;
+		z = header.origin[2] + (iz + 0.5) * header.resolution;
+	}
+
+	void set(int ix, int iy, int iz, uint32_t bin)
+	{
+		owned[index(ix, iy, iz)] |= (uint64_t)1 << bin;
+	}
+
+	// direction bins reachable at the voxel holding the point, 0 outside of the box
+	uint64_t reachableBins(double x, double y, double z) const
+	{
+		int ix = (int)floor((x - header.origin[0]) / header.resolution);
+		int iy = (int)floor((y - header.origin[1]) / header.resolution);
+		int iz = (int)floor((z - header.origin[2]) / header.resolution);
+
+		if (ix < 0 || iy < 0 || iz < 0 || ix >= header.size_x || iy >= header.size_y || iz >= header.size_z)
+		{
+			return 0;
+		}
+
+		return words[index(ix, iy, iz)];
+	}
+
+	// the camera at (x, y, z) looking along (dx, dy, dz), any roll. an empty map rejects nothing
+	bool reachable(double x, double y, double z, double dx, double dy, double dz) const
+	{
+		if (empty())
+		{
+			return true;
+		}
+
+		return (reachableBins(x, y, z) >> bin(dx, dy, dz)) & 1;
+	}
+
+	// the closest direction bin, a table lookup
+	uint32_t bin(double dx, double dy, double dz) const
+	{
+		double norm = sqrt(dx * dx + dy * dy + dz * dz);
+
+		if (norm <= 0)
+		{
+			return 0;
+		}
+
+		int row = std::min((int)((dz / norm + 1) / 2 * table_rows), table_rows - 1);
+		int column = std::min((int)((atan2(dy, dx) + M_PI) / (2 * M_PI) * table_columns), table_columns - 1);
+
+		return bin_table[row * table_columns + std::max(column, 0)];
+	}
+
+private:
+	// rows are bands of equal area (uniform in z), so the table error is the same all over the sphere
+	static const int table_rows = 64;
+	static const int table_columns = 128;
+
+	fileHeader header;
+
+	const uint64_t *words;
+	std::vector<uint64_t> owned;
+
+	void *mapped;
+	size_t mapped_size;
+
+	std::vector<double> bin_directions;
+	std::vector<uint8_t> bin_table;
+
+	size_t index(int ix, int iy, int iz) const
+	{
+		return ((size_t)iz * header.size_y + iy) * header.size_x + ix;
+	}
+
+	void unmap()
+	{
+		if (mapped != NULL)
+		{
+			munmap(mapped, mapped_size);
+		}
+
+		mapped = NULL;
+		mapped_size = 0;
+		owned.clear();
+		words = NULL;
+	}
+
+	void buildDirections()
+	{
+		uint32_t n = header.n_directions;
+
+		bin_directions.resize(3 * n);
+
+		double golden_angle = M_PI * (3 - sqrt(5.0));
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			double z = 1 - (2 * i + 1.0) / n;
+			double radius = sqrt(std::max(0.0, 1 - z * z));
+
+			bin_directions[3 * i] = cos(golden_angle * i) * radius;
+			bin_directions[3 * i + 1] = sin(golden_angle * i) * radius;
+			bin_directions[3 * i + 2] = z;
+		}
+
+		bin_table.resize(table_rows * table_columns);
+
+		for (int row = 0; row < table_rows; row++)
+		{
+			double z = (row + 0.5) / table_rows * 2 - 1;
+			double radius = sqrt(std::max(0.0, 1 - z * z));
+
+			for (int column = 0; column < table_columns; column++)
+			{
+				double azimuth = (column + 0.5) / table_columns * 2 * M_PI - M_PI;
+				double x = cos(azimuth) * radius;
+				double y = sin(azimuth) * radius;
+
+				uint32_t best = 0;
+				double best_dot = -2;
+
+				for (uint32_t i = 0; i < n; i++)
+				{
+					double dot = x * bin_directions[3 * i] + y * bin_directions[3 * i + 1] + z * bin_directions[3 * i + 2];
+
+					if (dot > best_dot)
+					{
+						best_dot = dot;
+						best = i;
+					}
+				}
+
+				bin_table[row * table_columns + column] = best;
+			}
+		}
+	}
+
+	// not copyable, it may own a mapping
+	reachabilityMap(const reachabilityMap &);
+	reachabilityMap &operator=(const reachabilityMap &);
+};
+
+#endif // SMOBEX_EXPLORER_REACHABILITY_MAP
@@ -0,0 +1,67 @@
+#ifndef SMOBEX_EXPLORER_SHARED_OCTREE_REGISTRY
+#define SMOBEX_EXPLORER_SHARED_OCTREE_REGISTRY
+
+#include <map>
+#include <string>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ros/ros.h>
+
+#include <octomap/octomap.h>
+
+// in process handoff of octrees between nodelets of the same manager, keyed by the topic the tree is also
+// published on (e.g. /octomap_full). the producer only copies its tree when a consumer asked for one, and the
+// consumer takes ownership of that copy, so the tree never goes through an octomap_msgs::Octomap.
+// lives in the smobex_shared_maps library so every nodelet loaded in the manager sees the same instance
+class sharedOctreeRegistry
+{
+public:
+	static sharedOctreeRegistry &instance();
+
+	// a producer for name runs in this process
+	void advertise(const std::string &name);
+	void unadvertise(const std::string &name);
+	bool advertised(const std::string &name);
+
+	// consumer side: asks for a copy made from now on, any older one waiting is dropped
+	void request(const std::string &name);
+	// the requested copy, waiting up to timeout for it. NULL if none, the caller owns the tree
+	octomap::OcTree *take(const std::string &name, ros::Duration timeout);
+
+	// producer side: true when a consumer waits for a copy
+	bool requested(const std::string &name);
+	// hands a copy of the tree over, the registry owns it until it is taken
+	void publish(const std::string &name, octomap::OcTree *tree);
+
+private:
+	struct slot
+	{
+		bool advertised;
+		bool requested;
+		octomap::OcTree *tree;
+
+		slot()
+		{
+			advertised = false;
+			requested = false;
+			tree = NULL;
+		}
+	};
+
+	boost::mutex mutex;
+	boost::condition_variable published;
+	std::map<std::string, slot> slots;
+
+	sharedOctreeRegistry()
+	{
+	}
+
+	~sharedOctreeRegistry();
+
+	sharedOctreeRegistry(const sharedOctreeRegistry &);
+	sharedOctreeRegistry &operator=(const sharedOctreeRegistry &);
+};
+
+#endif // SMOBEX_EXPLORER_SHARED_OCTREE_REGISTRY
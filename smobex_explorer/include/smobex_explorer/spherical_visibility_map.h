@@ -0,0 +1,184 @@
+#ifndef SMOBEX_EXPLORER_SPHERICAL_VISIBILITY_MAP
+#define SMOBEX_EXPLORER_SPHERICAL_VISIBILITY_MAP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <octomap/math/Vector3.h>
+
+// equirectangular image (azimuth x elevation) around one viewpoint origin, holding how many unknown voxels
+// are first seen / seen behind another one in every direction. filled once by a 360 degrees visibility pass,
+// then any camera orientation at that origin is scored by summing its FOV window from summed-area tables.
+// the window is the azimuth/elevation box around the view direction, so the roll of the camera is ignored.
+class sphericalVisibilityMap
+{
+public:
+	int n_azimuth;
+	int n_elevation;
+	octomath::Vector3 origin;
+
+	// per pixel counts, row major (one row per elevation bin)
+	std::vector<float> first_counts;
+	std::vector<float> posterior_counts;
+
+	sphericalVisibilityMap(int _n_azimuth = 360, int _n_elevation = 180)
+	{
+		n_azimuth = std::max(_n_azimuth, 1);
+		n_elevation = std::max(_n_elevation, 1);
+
+		clear(octomath::Vector3(0, 0, 0));
+	}
+
+	void clear(const octomath::Vector3 &_origin)
+	{
+		origin = _origin;
+
+		first_counts.assign(n_azimuth * n_elevation, 0);
+		posterior_counts.assign(n_azimuth * n_elevation, 0);
+		first_table.clear();
+		posterior_table.clear();
+	}
+
+	// direction from the origin to the voxel
+	void addFirst(const octomath::Vector3 &direction)
+	{
+		first_counts[pixel(direction)] += 1;
+	}
+
+	void addPosterior(const octomath::Vector3 &direction)
+	{
+		posterior_counts[pixel(direction)] += 1;
+	}
+
+	// builds the summed-area tables, call it once after the last add
+	void integrate()
+	{
+		buildTable(first_counts, first_table);
+		buildTable(posterior_counts, posterior_table);
+	}
+
+	// counts inside the FOV window centred on view_direction, O(1) once integrated
+	void windowCounts(const octomath::Vector3 &view_direction, float width_FOV, float height_FOV, double &n_first,
+					  double &n_posterior) const
+	{
+		n_first = 0;
+		n_posterior = 0;
+
+		if (first_table.empty())
+		{
+			return;
+		}
+
+		double azimuth, elevation;
+		toAngles(view_direction, azimuth, elevation);
+
+		double el_min = elevation - height_FOV / 2;
+		double el_max = elevation + height_FOV / 2;
+
+		int row_begin = std::max(0, elevationRow(el_min));
+		int row_end = std::min(n_elevation - 1, elevationRow(el_max));
+
+		// the frustum gets wider in azimuth away from the equator, over a pole it covers every azimuth
+		int col_begin = 0;
+		int col_end = n_azimuth - 1;
+
+		if (el_min > -M_PI / 2 && el_max < M_PI / 2)
+		{
+			// a FOV of 180 degrees or more sees every azimuth, the tan would wrap
+			double half_azimuth = width_FOV / 2 < M_PI / 2 ? atan(tan(width_FOV / 2) / cos(elevation)) : M_PI;
+
+			// the window only wraps onto itself when it has as many columns as the table
+			if (half_azimuth / M_PI * n_azimuth + 1 < n_azimuth)
+			{
+				col_begin = azimuthColumn(azimuth - half_azimuth);
+				col_end = azimuthColumn(azimuth + half_azimuth);
+			}
+		}
+
+		if (col_begin <= col_end)
+		{
+			n_first = boxSum(first_table, row_begin, row_end, col_begin, col_end);
+			n_posterior = boxSum(posterior_table, row_begin, row_end, col_begin, col_end);
+		}
+		else
+		{
+			// the window wraps around azimuth +-pi
+			n_first = boxSum(first_table, row_begin, row_end, col_begin, n_azimuth - 1) +
+					  boxSum(first_table, row_begin, row_end, 0, col_end);
+			n_posterior = boxSum(posterior_table, row_begin, row_end, col_begin, n_azimuth - 1) +
+						  boxSum(posterior_table, row_begin, row_end, 0, col_end);
+		}
+	}
+
+private:
+	// (n_elevation + 1) x (n_azimuth + 1), first row and column are zeros
+	std::vector<double> first_table;
+	std::vector<double> posterior_table;
+
+	static void toAngles(const octomath::Vector3 &direction, double &azimuth, double &elevation)
+	{
+		double norm = direction.norm();
+
+		azimuth = atan2(direction.y(), direction.x());
+		elevation = norm > 0 ? asin(std::max(-1.0, std::min(1.0, direction.z() / norm))) : 0;
+	}
+
+	int elevationRow(double elevation) const
+	{
+		int row = (int)floor((elevation + M_PI / 2) / M_PI * n_elevation);
+
+		return std::max(-1, std::min(n_elevation, row));
+	}
+
+	int azimuthColumn(double azimuth) const
+	{
+		int col = (int)floor((azimuth + M_PI) / (2 * M_PI) * n_azimuth) % n_azimuth;
+
+		return col < 0 ? col + n_azimuth : col;
+	}
+
+	size_t pixel(const octomath::Vector3 &direction) const
+	{
+		double azimuth, elevation;
+		toAngles(direction, azimuth, elevation);
+
+		int row = std::max(0, std::min(n_elevation - 1, elevationRow(elevation)));
+
+		return (size_t)row * n_azimuth + azimuthColumn(azimuth);
+	}
+
+	void buildTable(const std::vector<float> &counts, std::vector<double> &table) const
+	{
+		int stride = n_azimuth + 1;
+
+		table.assign((size_t)(n_elevation + 1) * stride, 0);
+
+		for (int row = 0; row < n_elevation; row++)
+		{
+			double row_sum = 0;
+
+			for (int col = 0; col < n_azimuth; col++)
+			{
+				row_sum += counts[(size_t)row * n_azimuth + col];
+				table[(size_t)(row + 1) * stride + col + 1] = table[(size_t)row * stride + col + 1] + row_sum;
+			}
+		}
+	}
+
+	// inclusive bounds
+	double boxSum(const std::vector<double> &table, int row_begin, int row_end, int col_begin, int col_end) const
+	{
+		if (row_begin > row_end)
+		{
+			return 0;
+		}
+
+		int stride = n_azimuth + 1;
+
+		return table[(size_t)(row_end + 1) * stride + col_end + 1] - table[(size_t)row_begin * stride + col_end + 1] -
+			   table[(size_t)(row_end + 1) * stride + col_begin] + table[(size_t)row_begin * stride + col_begin];
+	}
+};
+
+#endif // SMOBEX_EXPLORER_SPHERICAL_VISIBILITY_MAP
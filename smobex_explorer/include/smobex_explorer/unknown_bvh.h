@@ -0,0 +1,242 @@
+#ifndef SMOBEX_EXPLORER_UNKNOWN_BVH
+#define SMOBEX_EXPLORER_UNKNOWN_BVH
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include <smobex_explorer/frustum_culler.h>
+
+// bounding volume tree over the unknown centers. build() sorts the points of a pointsSoA along a Morton curve,
+// so every node covers a contiguous, spatially compact range of them. frustum queries drop whole subtrees
+// outside of the frustum and take whole subtrees inside of it without testing their points, except for the
+// points removed since the build, which the node boxes still cover. points appended since are tested one by one.
+class mortonBVH
+{
+public:
+	enum
+	{
+		leaf_size = 32
+	};
+
+	struct node
+	{
+		float box_min[3];
+		float box_max[3];
+		uint32_t begin, end;
+		// children of inner nodes, -1 on the leafs
+		int32_t left, right;
+	};
+
+	std::vector<node> nodes;
+	// the points the tree was built over, the ones after them were appended since
+	size_t n_built;
+
+	mortonBVH()
+	{
+		n_built = 0;
+	}
+
+	bool empty() const
+	{
+		return nodes.empty();
+	}
+
+	// reorders points, indexes returned by query() refer to the new order
+	void build(pointsSoA &points)
+	{
+		nodes.clear();
+
+		size_t n_points = points.size();
+		n_built = n_points;
+
+		if (n_points == 0)
+		{
+			return;
+		}
+
+		float lower[3] = {points.x[0], points.y[0], points.z[0]};
+		float upper[3] = {points.x[0], points.y[0], points.z[0]};
+
+		for (size_t i = 1; i < n_points; i++)
+		{
+			float p[3] = {points.x[i], points.y[i], points.z[i]};
+
+			for (unsigned k = 0; k < 3; k++)
+			{
+				lower[k] = std::min(lower[k], p[k]);
+				upper[k] = std::max(upper[k], p[k]);
+			}
+		}
+
+		std::vector<std::pair<uint32_t, uint32_t> > codes(n_points);
+
+		for (size_t i = 0; i < n_points; i++)
+		{
+			float p[3] = {points.x[i], points.y[i], points.z[i]};
+			uint32_t quantized[3];
+
+			for (unsigned k = 0; k < 3; k++)
+			{
+				float extent = upper[k] - lower[k];
+				quantized[k] = extent > 0 ? (uint32_t)((p[k] - lower[k]) / extent * 1023) : 0;
+			}
+
+			codes[i] = std::make_pair(mortonCode(quantized[0], quantized[1], quantized[2]), (uint32_t)i);
+		}
+
+		std::sort(codes.begin(), codes.end());
+
+		pointsSoA sorted = points;
+
+		for (size_t i = 0; i < n_points; i++)
+		{
+			points.x[i] = sorted.x[codes[i].second];
+			points.y[i] = sorted.y[codes[i].second];
+			points.z[i] = sorted.z[codes[i].second];
+			points.removed[i] = sorted.removed[codes[i].second];
+		}
+
+		nodes.reserve(2 * (n_points / leaf_size + 1));
+		buildNode(points, 0, n_points);
+	}
+
+	// indexes of the points inside the frustum
+	void query(const pointsSoA &points, const frustumCuller &frustum, std::vector<uint32_t> &inside) const
+	{
+		inside.clear();
+
+		if (nodes.empty())
+		{
+			frustum.cullRange(points, 0, points.size(), inside);
+			return;
+		}
+
+		queryNode(0, points, frustum, inside);
+
+		if (points.size() > n_built)
+		{
+			// from the start of the block, the points of it that are in the tree are left out
+			size_t first = inside.size();
+			frustum.cullRange(points, n_built / pointsSoA::block_size * pointsSoA::block_size, points.size(), inside);
+
+			size_t kept = first;
+
+			for (size_t i = first; i < inside.size(); i++)
+			{
+				if (inside[i] >= n_built)
+				{
+					inside[kept++] = inside[i];
+				}
+			}
+
+			inside.resize(kept);
+		}
+	}
+
+private:
+	// spreads the 10 low bits of value to every third bit
+	static uint32_t spreadBits(uint32_t value)
+	{
+		value &= 0x3ff;
+		value = (value | (value << 16)) & 0x030000ff;
+		value = (value | (value << 8)) & 0x0300f00f;
+		value = (value | (value << 4)) & 0x030c30c3;
+		value = (value | (value << 2)) & 0x09249249;
+
+		return value;
+	}
+
+	static uint32_t mortonCode(uint32_t x, uint32_t y, uint32_t z)
+	{
+		return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+	}
+
+	// the ranges are split at multiples of leaf_size, so every node starts on a culler block
+	int32_t buildNode(const pointsSoA &points, size_t begin, size_t end)
+	{
+		int32_t idx = nodes.size();
+		nodes.push_back(node());
+
+		node a_node;
+		a_node.begin = begin;
+		a_node.end = end;
+		a_node.left = -1;
+		a_node.right = -1;
+
+		if (end - begin > leaf_size)
+		{
+			size_t n_leafs = (end - begin + leaf_size - 1) / leaf_size;
+			size_t middle = begin + n_leafs / 2 * leaf_size;
+
+			a_node.left = buildNode(points, begin, middle);
+			a_node.right = buildNode(points, middle, end);
+
+			const node &left = nodes[a_node.left];
+			const node &right = nodes[a_node.right];
+
+			for (unsigned k = 0; k < 3; k++)
+			{
+				a_node.box_min[k] = std::min(left.box_min[k], right.box_min[k]);
+				a_node.box_max[k] = std::max(left.box_max[k], right.box_max[k]);
+			}
+		}
+		else
+		{
+			a_node.box_min[0] = a_node.box_max[0] = points.x[begin];
+			a_node.box_min[1] = a_node.box_max[1] = points.y[begin];
+			a_node.box_min[2] = a_node.box_max[2] = points.z[begin];
+
+			for (size_t i = begin + 1; i < end; i++)
+			{
+				float p[3] = {points.x[i], points.y[i], points.z[i]};
+
+				for (unsigned k = 0; k < 3; k++)
+				{
+					a_node.box_min[k] = std::min(a_node.box_min[k], p[k]);
+					a_node.box_max[k] = std::max(a_node.box_max[k], p[k]);
+				}
+			}
+		}
+
+		nodes[idx] = a_node;
+
+		return idx;
+	}
+
+	void queryNode(int32_t idx, const pointsSoA &points, const frustumCuller &frustum, std::vector<uint32_t> &inside) const
+	{
+		const node &a_node = nodes[idx];
+
+		frustumCuller::boxClass box_class = frustum.classifyBox(a_node.box_min, a_node.box_max);
+
+		if (box_class == frustumCuller::box_outside)
+		{
+			return;
+		}
+
+		if (box_class == frustumCuller::box_inside)
+		{
+			for (uint32_t i = a_node.begin; i < a_node.end; i++)
+			{
+				if (points.n_removed == 0 || !points.isRemoved(i))
+				{
+					inside.push_back(i);
+				}
+			}
+
+			return;
+		}
+
+		if (a_node.left < 0)
+		{
+			frustum.cullRange(points, a_node.begin, a_node.end, inside);
+			return;
+		}
+
+		queryNode(a_node.left, points, frustum, inside);
+		queryNode(a_node.right, points, frustum, inside);
+	}
+};
+
+#endif // SMOBEX_EXPLORER_UNKNOWN_BVH
@@ -0,0 +1,179 @@
+#ifndef SMOBEX_EXPLORER_UNKNOWN_SPACE_EXTRACTOR
+#define SMOBEX_EXPLORER_UNKNOWN_SPACE_EXTRACTOR
+
+#include <algorithm>
+#include <vector>
+
+#include <octomap/octomap.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+// the unknown voxels of the exploration box straight from the known OcTree, in place of the
+// /unknown_full_map and /unknown_pc of octomap_bounding_box. extract() walks the known tree once: subtrees
+// that exist are known and skipped whole, missing ones are unknown and only there every leaf is visited.
+// update() brings a previous result up to date after a change of the known tree, looking only at the changed keys
+class unknownSpaceExtractor
+{
+public:
+	octomap::point3d min_bbx, max_bbx;
+
+	unknownSpaceExtractor()
+	{
+	}
+
+	unknownSpaceExtractor(const octomap::point3d &_min_bbx, const octomap::point3d &_max_bbx)
+	{
+		setBox(_min_bbx, _max_bbx);
+	}
+
+	void setBox(const octomap::point3d &_min_bbx, const octomap::point3d &_max_bbx)
+	{
+		min_bbx = _min_bbx;
+		max_bbx = _max_bbx;
+	}
+
+	// unknown gets one node per unknown voxel (pruned afterwards), centers one point per unknown voxel.
+	// the returned tree has the resolution of known, the caller owns it
+	octomap::OcTree *extract(const octomap::OcTree &known, pcl::PointCloud<pcl::PointXYZ> &centers) const
+	{
+		using namespace octomap;
+
+		OcTree *unknown = new OcTree(known.getResolution());
+
+		centers.clear();
+
+		OcTreeKey min_key, max_key;
+
+		if (!known.coordToKeyChecked(min_bbx, min_key) || !known.coordToKeyChecked(max_bbx, max_key))
+		{
+			return unknown;
+		}
+
+		visit(known, unknown, centers, known.getRoot(), OcTreeKey(0, 0, 0), 1 << known.getTreeDepth(), min_key,
+			  max_key);
+
+		unknown->updateInnerOccupancy();
+		unknown->prune();
+
+		return unknown;
+	}
+
+	// after known changed at the changed keys: those that are known now leave unknown, and are returned in
+	// now_known. those cleared from known join unknown again, and are returned in now_unknown. keys outside of
+	// the box are never unknown
+	void update(const octomap::OcTree &known, const octomap::KeySet &changed, octomap::OcTree &unknown,
+				std::vector<octomap::OcTreeKey> &now_known, std::vector<octomap::OcTreeKey> &now_unknown) const
+	{
+		using namespace octomap;
+
+		now_known.clear();
+		now_unknown.clear();
+
+		OcTreeKey min_key, max_key;
+
+		if (!known.coordToKeyChecked(min_bbx, min_key) || !known.coordToKeyChecked(max_bbx, max_key))
+		{
+			return;
+		}
+
+		for (KeySet::const_iterator it = changed.begin(); it != changed.end(); it++)
+		{
+			if (!inside(*it, min_key, max_key))
+			{
+				continue;
+			}
+
+			if (known.search(*it) != NULL)
+			{
+				if (unknown.search(*it) != NULL)
+				{
+					unknown.deleteNode(*it);
+				}
+
+				now_known.push_back(*it);
+			}
+			else if (unknown.search(*it) == NULL)
+			{
+				// cleared from the known tree
+				unknown.updateNode(*it, true);
+				now_unknown.push_back(*it);
+			}
+		}
+	}
+
+private:
+	static bool inside(const octomap::OcTreeKey &key, const octomap::OcTreeKey &min_key, const octomap::OcTreeKey &max_key)
+	{
+		for (unsigned i = 0; i < 3; i++)
+		{
+			if (key[i] < min_key[i] || key[i] > max_key[i])
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// node covers the keys [first, first + span) on every axis, NULL when it does not exist in known
+	void visit(const octomap::OcTree &known, octomap::OcTree *unknown, pcl::PointCloud<pcl::PointXYZ> &centers,
+			   const octomap::OcTreeNode *node, const octomap::OcTreeKey &first, unsigned span,
+			   const octomap::OcTreeKey &min_key, const octomap::OcTreeKey &max_key) const
+	{
+		using namespace octomap;
+
+		unsigned begin[3], end[3];
+
+		for (unsigned i = 0; i < 3; i++)
+		{
+			begin[i] = std::max<unsigned>(first[i], min_key[i]);
+			end[i] = std::min<unsigned>(first[i] + span - 1, max_key[i]);
+
+			if (begin[i] > end[i])
+			{
+				return;
+			}
+		}
+
+		if (node == NULL)
+		{
+			for (unsigned z = begin[2]; z <= end[2]; z++)
+			{
+				for (unsigned y = begin[1]; y <= end[1]; y++)
+				{
+					for (unsigned x = begin[0]; x <= end[0]; x++)
+					{
+						OcTreeKey key(x, y, z);
+						point3d center = known.keyToCoord(key);
+
+						unknown->updateNode(key, true, true);
+						centers.push_back(pcl::PointXYZ(center.x(), center.y(), center.z()));
+					}
+				}
+			}
+
+			return;
+		}
+
+		// a leaf, maybe pruned, is known all over
+		if (!known.nodeHasChildren(node))
+		{
+			return;
+		}
+
+		unsigned half = span / 2;
+
+		for (unsigned child = 0; child < 8; child++)
+		{
+			OcTreeKey child_first(first[0] + ((child & 1) ? half : 0), first[1] + ((child & 2) ? half : 0),
+								  first[2] + ((child & 4) ? half : 0));
+
+			const OcTreeNode *child_node = known.nodeChildExists(node, child) ? known.getNodeChild(node, child) : NULL;
+
+			visit(known, unknown, centers, child_node, child_first, half, min_key, max_key);
+		}
+	}
+};
+
+#endif // SMOBEX_EXPLORER_UNKNOWN_SPACE_EXTRACTOR
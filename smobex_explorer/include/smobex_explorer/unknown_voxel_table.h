@@ -0,0 +1,204 @@
+#ifndef SMOBEX_EXPLORER_UNKNOWN_VOXEL_TABLE
+#define SMOBEX_EXPLORER_UNKNOWN_VOXEL_TABLE
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include <octomap/OcTreeKey.h>
+#include <octomap/math/Vector3.h>
+
+class unknownVoxel
+{
+
+public:
+	octomap::OcTreeKey key;
+	octomap::point3d center;
+	double distance_to_camera;
+	bool to_visit;
+
+	unknownVoxel()
+	{
+		to_visit = true;
+	}
+
+	bool operator==(const unknownVoxel &rhs) const { return this->key == rhs.key; }
+	bool operator==(const octomap::OcTreeKey &rhs) const { return this->key == rhs; }
+};
+
+// open addressing (linear probing) table of the unknown voxels inside one frustum.
+// voxels are stored contiguously in insertion order, the slots only hold indexes into them.
+// clear() does not touch the slots: every slot carries the generation it was written in,
+// so the same table can be reused for every evaluated pose without reallocating.
+class unknownVoxelTable
+{
+public:
+	enum
+	{
+		npos = -1
+	};
+
+	std::vector<unknownVoxel> voxels;
+
+	unknownVoxelTable()
+	{
+		generation = 1;
+		shift = 64;
+		mask = 0;
+	}
+
+	void clear()
+	{
+		voxels.clear();
+
+		generation++;
+
+		if (generation == 0)
+		{
+			std::fill(slot_generation.begin(), slot_generation.end(), 0);
+			generation = 1;
+		}
+	}
+
+	void reserve(size_t n_voxels)
+	{
+		voxels.reserve(n_voxels);
+
+		// keep the load factor below 0.5
+		if (n_voxels * 2 > slots.size())
+		{
+			rehash(n_voxels * 2);
+		}
+	}
+
+	size_t size() const
+	{
+		return voxels.size();
+	}
+
+	// returns the index of the voxel with the same key if it was already inserted
+	int32_t insert(const unknownVoxel &voxel)
+	{
+		if ((voxels.size() + 1) * 2 > slots.size())
+		{
+			rehash((voxels.size() + 1) * 2);
+		}
+
+		size_t slot = findSlot(voxel.key);
+
+		if (slot_generation[slot] == generation)
+		{
+			return slots[slot];
+		}
+
+		int32_t idx = voxels.size();
+
+		slots[slot] = idx;
+		slot_generation[slot] = generation;
+		voxels.push_back(voxel);
+
+		return idx;
+	}
+
+	int32_t find(const octomap::OcTreeKey &key) const
+	{
+		if (slots.empty())
+		{
+			return npos;
+		}
+
+		size_t slot = findSlot(key);
+
+		return slot_generation[slot] == generation ? slots[slot] : npos;
+	}
+
+	void markVisited(const octomap::OcTreeKey &key)
+	{
+		int32_t idx = find(key);
+
+		if (idx != npos)
+		{
+			voxels[idx].to_visit = false;
+		}
+	}
+
+	// indexes of all voxels, farthest from the camera first
+	void sortByDistance(std::vector<size_t> &order) const
+	{
+		order.resize(voxels.size());
+
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+
+		std::sort(order.begin(), order.end(), compareVoxelDistanceIndex(voxels));
+	}
+
+private:
+	struct compareVoxelDistanceIndex
+	{
+		const std::vector<unknownVoxel> &voxels;
+
+		compareVoxelDistanceIndex(const std::vector<unknownVoxel> &_voxels) : voxels(_voxels) {}
+
+		bool operator()(size_t a, size_t b) const
+		{
+			return voxels[a].distance_to_camera > voxels[b].distance_to_camera;
+		}
+	};
+
+	std::vector<int32_t> slots;
+	std::vector<uint32_t> slot_generation;
+	uint32_t generation;
+	unsigned shift;
+	size_t mask;
+
+	size_t hashKey(const octomap::OcTreeKey &key) const
+	{
+		// fibonacci hashing of the packed 48 bit key, the high bits are the well mixed ones
+		uint64_t packed = (uint64_t)key[0] | ((uint64_t)key[1] << 16) | ((uint64_t)key[2] << 32);
+
+		return (packed * 0x9E3779B97F4A7C15ULL) >> shift;
+	}
+
+	size_t findSlot(const octomap::OcTreeKey &key) const
+	{
+		size_t slot = hashKey(key);
+
+		while (slot_generation[slot] == generation && !(voxels[slots[slot]].key == key))
+		{
+			slot = (slot + 1) & mask;
+		}
+
+		return slot;
+	}
+
+	void rehash(size_t min_slots)
+	{
+		size_t n_slots = 16;
+		unsigned bits = 4;
+
+		while (n_slots < min_slots)
+		{
+			n_slots <<= 1;
+			bits++;
+		}
+
+		slots.assign(n_slots, npos);
+		slot_generation.assign(n_slots, 0);
+		generation = 1;
+		shift = 64 - bits;
+		mask = n_slots - 1;
+
+		for (size_t idx = 0; idx < voxels.size(); idx++)
+		{
+			size_t slot = findSlot(voxels[idx].key);
+
+			slots[slot] = idx;
+			slot_generation[slot] = generation;
+		}
+	}
+};
+
+#endif // SMOBEX_EXPLORER_UNKNOWN_VOXEL_TABLE
@@ -0,0 +1,293 @@
+#ifndef SMOBEX_EXPLORER_VIEW_SAMPLER
+#define SMOBEX_EXPLORER_VIEW_SAMPLER
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <tf/tf.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <smobex_explorer/reachability_map.h>
+
+// candidate views on the [r_min, r_max] shell around every observation point, looking at it. the shell is
+// covered by a low discrepancy sequence (halton, bases 2 3 5, shifted at random on every call) or by jittered
+// strata instead of independent draws, so n views leave no clumps and gaps and fewer of them find the same best
+// view. the position is uniform in the volume of the shell, the roll around the view direction is random.
+// views outside of the workspace box, further than max_reach from reach_center or that the reachability map
+// rejects are skipped for the next point of the sequence, up to tries points per view. every thread draws
+// from its own generator
+class viewSampler
+{
+public:
+	enum sequenceType
+	{
+		random_sequence,
+		stratified_sequence,
+		halton_sequence
+	};
+
+	sequenceType sequence;
+	float r_min, r_max;
+	int tries;
+
+	// the views are kept inside, -inf/inf by default
+	tf::Vector3 workspace_min, workspace_max;
+
+	// max_reach <= 0 keeps every distance
+	tf::Vector3 reach_center;
+	float max_reach;
+
+	// not owned, NULL (or an empty map) keeps every direction
+	const reachabilityMap *reachability_map;
+
+	viewSampler(float _r_min = 0.8, float _r_max = 1.2, sequenceType _sequence = halton_sequence)
+	{
+		sequence = _sequence;
+		r_min = _r_min;
+		r_max = _r_max;
+		tries = 20;
+
+		float inf = std::numeric_limits<float>::infinity();
+		workspace_min.setValue(-inf, -inf, -inf);
+		workspace_max.setValue(inf, inf, inf);
+
+		reach_center.setValue(0, 0, 0);
+		max_reach = 0;
+
+		reachability_map = NULL;
+
+		seed(std::random_device()());
+	}
+
+	// "random", "stratified" or "halton", false when unknown
+	bool setSequence(const std::string &name)
+	{
+		if (name == "random")
+		{
+			sequence = random_sequence;
+		}
+		else if (name == "stratified")
+		{
+			sequence = stratified_sequence;
+		}
+		else if (name == "halton")
+		{
+			sequence = halton_sequence;
+		}
+		else
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	void seed(uint32_t value)
+	{
+		int n_threads = 1;
+
+#ifdef _OPENMP
+		n_threads = omp_get_max_threads();
+#endif
+
+		engines.clear();
+
+		std::seed_seq seeds = {value};
+		std::vector<uint32_t> thread_seeds(n_threads);
+		seeds.generate(thread_seeds.begin(), thread_seeds.end());
+
+		for (int thread = 0; thread < n_threads; thread++)
+		{
+			engines.push_back(std::mt19937(thread_seeds[thread]));
+		}
+	}
+
+	// up to n_views views around every center, fewer when the tries ran out
+	void sample(const std::vector<tf::Point> &centers, size_t n_views, std::vector<std::vector<tf::Pose> > &views)
+	{
+		views.assign(centers.size(), std::vector<tf::Pose>());
+
+#pragma omp parallel for schedule(dynamic)
+		for (int center_idx = 0; center_idx < (int)centers.size(); center_idx++)
+		{
+			sampleCenter(centers[center_idx], n_views, engine(), views[center_idx]);
+		}
+	}
+
+	void sample(const tf::Point &center, size_t n_views, std::vector<tf::Pose> &views)
+	{
+		sampleCenter(center, n_views, engines[0], views);
+	}
+
+	// the origin of the views before the retries, u in [0, 1)^3
+	tf::Point shellPoint(const tf::Point &center, const double *u) const
+	{
+		double z = 1 - 2 * u[0];
+		double ring = sqrt(std::max(0.0, 1 - z * z));
+		double azimuth = 2 * M_PI * u[1];
+
+		double r_min3 = (double)r_min * r_min * r_min;
+		double r_max3 = (double)r_max * r_max * r_max;
+		double radius = cbrt(r_min3 + u[2] * (r_max3 - r_min3));
+
+		return center + radius * tf::Vector3(ring * cos(azimuth), ring * sin(azimuth), z);
+	}
+
+	static double halton(uint32_t index, uint32_t base)
+	{
+		double value = 0;
+		double fraction = 1.0 / base;
+
+		while (index > 0)
+		{
+			value += (index % base) * fraction;
+			index /= base;
+			fraction /= base;
+		}
+
+		return value;
+	}
+
+	// inside the workspace, within reach, and the map has the direction to center
+	bool accepted(const tf::Point &origin, const tf::Point &center) const
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			if (origin[i] < workspace_min[i] || origin[i] > workspace_max[i])
+			{
+				return false;
+			}
+		}
+
+		if (max_reach > 0 && origin.distance2(reach_center) > max_reach * max_reach)
+		{
+			return false;
+		}
+
+		if (reachability_map != NULL)
+		{
+			tf::Vector3 direction = center - origin;
+
+			return reachability_map->reachable(origin.x(), origin.y(), origin.z(), direction.x(), direction.y(),
+											   direction.z());
+		}
+
+		return true;
+	}
+
+	// camera z to the center, x and y turned by roll around it
+	static tf::Pose lookAt(const tf::Point &origin, const tf::Point &center, double roll)
+	{
+		tf::Vector3 z_direction = (center - origin).normalized();
+
+		// any vector not along z_direction
+		tf::Vector3 other = fabs(z_direction.z()) < 0.9 ? tf::Vector3(0, 0, 1) : tf::Vector3(1, 0, 0);
+
+		tf::Vector3 a = z_direction.cross(other).normalized();
+		tf::Vector3 b = z_direction.cross(a);
+
+		tf::Vector3 x_direction = cos(roll) * a + sin(roll) * b;
+		tf::Vector3 y_direction = z_direction.cross(x_direction);
+
+		tf::Matrix3x3 rotation_matrix(x_direction.getX(), y_direction.getX(), z_direction.getX(), x_direction.getY(),
+									  y_direction.getY(), z_direction.getY(), x_direction.getZ(), y_direction.getZ(),
+									  z_direction.getZ());
+
+		tf::Quaternion view_orientation;
+		rotation_matrix.getRotation(view_orientation);
+		view_orientation.normalize();
+
+		return tf::Pose(view_orientation, origin);
+	}
+
+private:
+	std::vector<std::mt19937> engines;
+
+	std::mt19937 &engine()
+	{
+#ifdef _OPENMP
+		return engines[omp_get_thread_num() % engines.size()];
+#else
+		return engines[0];
+#endif
+	}
+
+	void sampleCenter(const tf::Point &center, size_t n_views, std::mt19937 &rng, std::vector<tf::Pose> &views) const
+	{
+		std::uniform_real_distribution<double> uniform(0, 1);
+
+		views.clear();
+		views.reserve(n_views);
+
+		// halton: one random shift for the whole sequence. stratified: k^3 cells, visited in a random order and
+		// again with new jitter once the tries went through all of them
+		double shift[3] = {uniform(rng), uniform(rng), uniform(rng)};
+
+		int k = std::max(1, (int)ceil(cbrt((double)n_views)));
+		std::vector<int> cells(k * k * k);
+
+		for (size_t cell = 0; cell < cells.size(); cell++)
+		{
+			cells[cell] = cell;
+		}
+
+		size_t n_points = n_views * std::max(tries, 1);
+
+		for (size_t point_idx = 0; point_idx < n_points && views.size() < n_views; point_idx++)
+		{
+			double u[3];
+
+			if (sequence == halton_sequence)
+			{
+				const uint32_t bases[3] = {2, 3, 5};
+
+				for (int i = 0; i < 3; i++)
+				{
+					u[i] = halton(point_idx + 1, bases[i]) + shift[i];
+					u[i] -= floor(u[i]);
+				}
+			}
+			else if (sequence == stratified_sequence)
+			{
+				if (point_idx % cells.size() == 0)
+				{
+					std::shuffle(cells.begin(), cells.end(), rng);
+				}
+
+				int cell = cells[point_idx % cells.size()];
+				int cell_coord[3] = {cell % k, (cell / k) % k, cell / (k * k)};
+
+				for (int i = 0; i < 3; i++)
+				{
+					u[i] = (cell_coord[i] + uniform(rng)) / k;
+				}
+			}
+			else
+			{
+				for (int i = 0; i < 3; i++)
+				{
+					u[i] = uniform(rng);
+				}
+			}
+
+			tf::Point origin = shellPoint(center, u);
+
+			if (!accepted(origin, center))
+			{
+				continue;
+			}
+
+			views.push_back(lookAt(origin, center, 2 * M_PI * uniform(rng)));
+		}
+	}
+};
+
+#endif // SMOBEX_EXPLORER_VIEW_SAMPLER
@@ -0,0 +1,307 @@
+#ifndef SMOBEX_EXPLORER_VOXEL_CLUSTERING
+#define SMOBEX_EXPLORER_VOXEL_CLUSTERING
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include <pcl/PointIndices.h>
+#include <pcl/point_cloud.h>
+
+// connected components of voxel centers, in place of pcl::ConditionalEuclideanClustering with the
+// customRegionGrowing condition. two voxels are connected when their centers are closer than radius voxels
+// (2 * sqrt(1.1) by default, the old condition), every point is joined to its neighbours ahead of it in a
+// dense grid (or a hash table for spread out clouds) with union-find, so the cost is linear in the points.
+// the clusters come in the order of their first point, as from the kd-tree region growing
+class voxelClustering
+{
+public:
+	voxelClustering(double _resolution, float _radius = 2 * sqrt(1.1))
+	{
+		resolution = _resolution;
+		setRadius(_radius);
+	}
+
+	// in voxels
+	void setRadius(float radius)
+	{
+		offsets.clear();
+
+		int reach = (int)ceil(radius);
+
+		for (int dz = -reach; dz <= reach; dz++)
+		{
+			for (int dy = -reach; dy <= reach; dy++)
+			{
+				for (int dx = -reach; dx <= reach; dx++)
+				{
+					// half of the neighbourhood is enough, the other half is looked at from the neighbours
+					bool ahead = dz > 0 || (dz == 0 && (dy > 0 || (dy == 0 && dx > 0)));
+
+					if (ahead && dx * dx + dy * dy + dz * dz < radius * radius)
+					{
+						neighbourOffset neighbour = {dx, dy, dz, pack(dx, dy, dz)};
+						offsets.push_back(neighbour);
+					}
+				}
+			}
+		}
+	}
+
+	template <typename PointT>
+	void segment(const pcl::PointCloud<PointT> &cloud, pcl::IndicesClusters &clusters)
+	{
+		clusters.clear();
+
+		size_t n_points = cloud.size();
+
+		if (n_points == 0)
+		{
+			return;
+		}
+
+		coords.resize(3 * n_points);
+
+		int min_coord[3], max_coord[3];
+		std::fill(min_coord, min_coord + 3, std::numeric_limits<int>::max());
+		std::fill(max_coord, max_coord + 3, std::numeric_limits<int>::min());
+
+		for (size_t idx = 0; idx < n_points; idx++)
+		{
+			const PointT &point = cloud.points[idx];
+			int coord[3] = {(int)floor(point.x / resolution), (int)floor(point.y / resolution),
+							(int)floor(point.z / resolution)};
+
+			for (unsigned i = 0; i < 3; i++)
+			{
+				coords[3 * idx + i] = coord[i];
+				min_coord[i] = std::min(min_coord[i], coord[i]);
+				max_coord[i] = std::max(max_coord[i], coord[i]);
+			}
+		}
+
+		parents.resize(n_points);
+		sizes.assign(n_points, 1);
+
+		for (size_t idx = 0; idx < n_points; idx++)
+		{
+			parents[idx] = idx;
+		}
+
+		int64_t size_x = max_coord[0] - min_coord[0] + 1;
+		int64_t size_y = max_coord[1] - min_coord[1] + 1;
+		int64_t size_z = max_coord[2] - min_coord[2] + 1;
+
+		if (size_x * size_y * size_z <= std::max<int64_t>(8 * n_points, 1 << 20))
+		{
+			joinDense(min_coord, size_x, size_y, size_z);
+		}
+		else
+		{
+			joinHashed();
+		}
+
+		// one cluster per root, numbered by their first point
+		std::vector<int> cluster_of_root(n_points, -1);
+
+		for (size_t idx = 0; idx < n_points; idx++)
+		{
+			int root = find(idx);
+
+			if (cluster_of_root[root] < 0)
+			{
+				cluster_of_root[root] = clusters.size();
+				clusters.push_back(pcl::PointIndices());
+				clusters.back().indices.reserve(sizes[root]);
+			}
+
+			clusters[cluster_of_root[root]].indices.push_back(idx);
+		}
+	}
+
+	// 21 bits per coordinate, linear so that the key of a neighbour is the key plus the packed offset
+	// (offsets may be negative, hence the products)
+	static int64_t pack(int64_t x, int64_t y, int64_t z)
+	{
+		return z * ((int64_t)1 << 42) + y * ((int64_t)1 << 21) + x;
+	}
+
+	static int64_t key(const int *coord)
+	{
+		return pack(coord[0] + (1 << 20), coord[1] + (1 << 20), coord[2] + (1 << 20));
+	}
+
+	static void unpackKey(int64_t key, int *coord)
+	{
+		coord[0] = (int)(key & ((1 << 21) - 1)) - (1 << 20);
+		coord[1] = (int)((key >> 21) & ((1 << 21) - 1)) - (1 << 20);
+		coord[2] = (int)(key >> 42) - (1 << 20);
+	}
+
+	// packed offsets of every neighbour closer than radius voxels, both halves
+	static void neighbourKeys(float radius, std::vector<int64_t> &keys)
+	{
+		keys.clear();
+
+		int reach = (int)ceil(radius);
+
+		for (int dz = -reach; dz <= reach; dz++)
+		{
+			for (int dy = -reach; dy <= reach; dy++)
+			{
+				for (int dx = -reach; dx <= reach; dx++)
+				{
+					int squared = dx * dx + dy * dy + dz * dz;
+
+					if (squared > 0 && squared < radius * radius)
+					{
+						keys.push_back(pack(dx, dy, dz));
+					}
+				}
+			}
+		}
+	}
+
+private:
+	double resolution;
+
+	struct neighbourOffset
+	{
+		int dx, dy, dz;
+		// the offset of the hash keys
+		int64_t packed;
+	};
+
+	std::vector<neighbourOffset> offsets;
+
+	std::vector<int> coords;
+	std::vector<int> parents;
+	std::vector<int> sizes;
+
+	std::vector<int> cells;
+	std::unordered_map<int64_t, int> cell_table;
+
+	int find(int idx)
+	{
+		while (parents[idx] != idx)
+		{
+			// path halving
+			parents[idx] = parents[parents[idx]];
+			idx = parents[idx];
+		}
+
+		return idx;
+	}
+
+	void join(int a, int b)
+	{
+		a = find(a);
+		b = find(b);
+
+		if (a == b)
+		{
+			return;
+		}
+
+		if (sizes[a] < sizes[b])
+		{
+			std::swap(a, b);
+		}
+
+		parents[b] = a;
+		sizes[a] += sizes[b];
+	}
+
+	void joinDense(const int *min_coord, int64_t size_x, int64_t size_y, int64_t size_z)
+	{
+		size_t n_points = parents.size();
+
+		cells.assign(size_x * size_y * size_z, -1);
+
+		std::vector<int64_t> cell_of_point(n_points);
+
+		for (size_t idx = 0; idx < n_points; idx++)
+		{
+			int64_t x = coords[3 * idx] - min_coord[0];
+			int64_t y = coords[3 * idx + 1] - min_coord[1];
+			int64_t z = coords[3 * idx + 2] - min_coord[2];
+
+			cell_of_point[idx] = (z * size_y + y) * size_x + x;
+
+			int &cell = cells[cell_of_point[idx]];
+
+			// the same voxel twice
+			if (cell >= 0)
+			{
+				join(cell, idx);
+			}
+			else
+			{
+				cell = idx;
+			}
+		}
+
+		for (size_t idx = 0; idx < n_points; idx++)
+		{
+			int x = coords[3 * idx] - min_coord[0];
+			int y = coords[3 * idx + 1] - min_coord[1];
+			int z = coords[3 * idx + 2] - min_coord[2];
+
+			for (size_t o = 0; o < offsets.size(); o++)
+			{
+				int dx = offsets[o].dx, dy = offsets[o].dy, dz = offsets[o].dz;
+
+				if (x + dx < 0 || x + dx >= size_x || y + dy < 0 || y + dy >= size_y || z + dz >= size_z)
+				{
+					continue;
+				}
+
+				int neighbour = cells[cell_of_point[idx] + ((int64_t)dz * size_y + dy) * size_x + dx];
+
+				if (neighbour >= 0)
+				{
+					join(idx, neighbour);
+				}
+			}
+		}
+	}
+
+	void joinHashed()
+	{
+		size_t n_points = parents.size();
+
+		cell_table.clear();
+		cell_table.reserve(n_points);
+
+		for (size_t idx = 0; idx < n_points; idx++)
+		{
+			std::pair<std::unordered_map<int64_t, int>::iterator, bool> inserted =
+				cell_table.insert(std::make_pair(key(&coords[3 * idx]), (int)idx));
+
+			if (!inserted.second)
+			{
+				join(inserted.first->second, idx);
+			}
+		}
+
+		for (size_t idx = 0; idx < n_points; idx++)
+		{
+			int64_t voxel_key = key(&coords[3 * idx]);
+
+			for (size_t o = 0; o < offsets.size(); o++)
+			{
+				std::unordered_map<int64_t, int>::const_iterator it = cell_table.find(voxel_key + offsets[o].packed);
+
+				if (it != cell_table.end())
+				{
+					join(idx, it->second);
+				}
+			}
+		}
+	}
+};
+
+#endif // SMOBEX_EXPLORER_VOXEL_CLUSTERING
@@ -0,0 +1,185 @@
+#include <ros/ros.h>
+
+#include <smobex_explorer/explorer.h>
+#include <smobex_explorer/view_sampler.h>
+
+#include <tf/tf.h>
+
+#include <algorithm>
+#include <vector>
+
+// ranks of the values, 0 for the biggest one
+std::vector<float> getRanks(const std::vector<float> &values)
+{
+	std::vector<size_t> order(values.size());
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+
+	std::sort(order.begin(), order.end(), evaluatePose::compareValueIndex(values));
+
+	std::vector<float> ranks(values.size());
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		ranks[order[i]] = i;
+	}
+
+	return ranks;
+}
+
+float spearmanCorrelation(const std::vector<float> &a, const std::vector<float> &b)
+{
+	std::vector<float> rank_a = getRanks(a);
+	std::vector<float> rank_b = getRanks(b);
+
+	double n = a.size();
+	double sum_sq = 0;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		sum_sq += (rank_a[i] - rank_b[i]) * (rank_a[i] - rank_b[i]);
+	}
+
+	return n > 1 ? 1 - 6 * sum_sq / (n * (n * n - 1)) : 1;
+}
+
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "coarse_to_fine_benchmark");
+	ros::NodeHandle n;
+
+	float min_range = 0;
+	float max_range = 1;
+	float width_FOV = M_PI;
+	float height_FOV = M_PI;
+	int n_poses = 150;
+	int iterations = 5;
+	int coarse_level = 1;
+	float coarse_keep_ratio = 0.2;
+	int top_k = 5;
+	float r_min = 0.8;
+	float r_max = 1.2;
+
+	ros::param::get("~" + ros::names::remap("min_range"), min_range);
+	ros::param::get("~" + ros::names::remap("max_range"), max_range);
+	ros::param::get("~" + ros::names::remap("width_FOV"), width_FOV);
+	ros::param::get("~" + ros::names::remap("height_FOV"), height_FOV);
+	ros::param::get("~n_poses", n_poses);
+	ros::param::get("~iterations", iterations);
+	ros::param::get("~coarse_level", coarse_level);
+	ros::param::get("~coarse_keep_ratio", coarse_keep_ratio);
+	ros::param::get("~top_k", top_k);
+	ros::param::get("~r_min", r_min);
+	ros::param::get("~r_max", r_max);
+
+	// "halton", "stratified" or "random" views of viewSampler, "" keeps genPose
+	std::string sampler_sequence;
+	ros::param::get("~sampler", sampler_sequence);
+
+	viewSampler view_sampler(r_min, r_max);
+
+	if (!sampler_sequence.empty() && !view_sampler.setSequence(sampler_sequence))
+	{
+		ROS_WARN_STREAM("Unknown sampler " << sampler_sequence << ", using genPose");
+		sampler_sequence.clear();
+	}
+
+	evaluatePose pose_test(min_range, max_range, width_FOV, height_FOV);
+
+	pose_test.writeKnownOctomap();
+	pose_test.writeUnknownOctomap();
+	pose_test.writeUnknownCloud();
+
+	pose_test.coarse_level = coarse_level;
+	pose_test.coarse_keep_ratio = coarse_keep_ratio;
+
+	tf::Point observation_center((pose_test.min_bbx.x() + pose_test.max_bbx.x()) / 2,
+								 (pose_test.min_bbx.y() + pose_test.max_bbx.y()) / 2,
+								 (pose_test.min_bbx.z() + pose_test.max_bbx.z()) / 2);
+
+	srand(time(NULL));
+
+	auto samplePoses = [&](std::vector<tf::Pose> &poses) {
+		poses.clear();
+
+		if (!sampler_sequence.empty())
+		{
+			view_sampler.sample(observation_center, n_poses, poses);
+		}
+
+		for (int pose_idx = poses.size(); pose_idx < n_poses; pose_idx++)
+		{
+			pose_test.genPose(r_min, r_max, observation_center);
+			poses.push_back(pose_test.view_pose);
+		}
+	};
+
+	// warm-up, the first evaluations build the dense and coarse grids, which the timed iterations should not include
+	{
+		std::vector<tf::Pose> poses;
+		samplePoses(poses);
+
+		ros::WallTime fine_start = ros::WallTime::now();
+		pose_test.evalPoses(poses);
+		double fine_time = (ros::WallTime::now() - fine_start).toSec();
+
+		ros::WallTime coarse_start = ros::WallTime::now();
+		pose_test.evalPosesCoarseToFine(poses);
+		double coarse_time = (ros::WallTime::now() - coarse_start).toSec();
+
+		ROS_INFO_STREAM("Warm-up with the grid builds: fine " << fine_time << " secs, coarse to fine " << coarse_time
+															  << " secs");
+	}
+
+	double total_fine = 0, total_coarse = 0;
+
+	for (int iteration = 0; iteration < iterations && ros::ok(); iteration++)
+	{
+		std::vector<tf::Pose> poses;
+		samplePoses(poses);
+
+		ros::WallTime fine_start = ros::WallTime::now();
+		std::vector<float> fine_scores = pose_test.evalPoses(poses);
+		double fine_time = (ros::WallTime::now() - fine_start).toSec();
+
+		std::vector<float> coarse_scores;
+
+		ros::WallTime coarse_start = ros::WallTime::now();
+		std::vector<float> mixed_scores = pose_test.evalPosesCoarseToFine(poses, &coarse_scores);
+		double coarse_time = (ros::WallTime::now() - coarse_start).toSec();
+
+		total_fine += fine_time;
+		total_coarse += coarse_time;
+
+		// how many of the fine top_k survived the coarse stage, and did the best one
+		std::vector<float> fine_ranks = getRanks(fine_scores);
+		int kept_top = 0;
+		bool kept_best = false;
+
+		for (size_t i = 0; i < poses.size(); i++)
+		{
+			if (fine_ranks[i] < top_k && mixed_scores[i] >= 0)
+			{
+				kept_top++;
+				kept_best = kept_best || fine_ranks[i] == 0;
+			}
+		}
+
+		ROS_INFO_STREAM("Iteration " << iteration << ": fine " << fine_time << " secs, coarse to fine " << coarse_time
+									 << " secs, rank correlation " << spearmanCorrelation(coarse_scores, fine_scores)
+									 << ", top " << top_k << " kept " << kept_top << ", best kept "
+									 << (kept_best ? "yes" : "no") << ", best score "
+									 << (fine_scores.empty() ? 0 : *std::max_element(fine_scores.begin(), fine_scores.end())));
+	}
+
+	if (iterations > 0)
+	{
+		ROS_INFO_STREAM("Mean: fine " << total_fine / iterations << " secs, coarse to fine " << total_coarse / iterations
+									  << " secs, speedup " << (total_coarse > 0 ? total_fine / total_coarse : 0));
+	}
+
+	return 0;
+}
@@ -9,6 +9,9 @@
 #include <moveit/robot_trajectory/robot_trajectory.h>
 
 #include <smobex_explorer/explorer.h>
+#include <smobex_explorer/incremental_voxel_clustering.h>
+#include <smobex_explorer/reachability_map.h>
+#include <smobex_explorer/view_sampler.h>
 
 #include <tf/LinearMath/Matrix3x3.h>
 #include <tf/LinearMath/Quaternion.h>
@@ -30,26 +33,24 @@
 
 #include <pcl/features/normal_3d.h>
 #include <pcl/filters/voxel_grid.h>
-#include <pcl/segmentation/conditional_euclidean_clustering.h>
+#include <pcl/common/centroid.h>
+#include <pcl/PointIndices.h>
 
 typedef pcl::PointXYZRGBA PointTypeIO;
 
 sensor_msgs::PointCloud2 cloud_clusters_publish;
 sensor_msgs::PointCloud2 centroid_clusters_publish;
 float octomap_resolution = 0.1;
+incrementalVoxelClustering clustering(octomap_resolution);
 
 using namespace std;
 
-bool customRegionGrowing(const PointTypeIO &point_a, const PointTypeIO &point_b, float squared_distance)
+// the same colour for a cluster every time it is published
+int labelColour(int label, int channel)
 {
-	if (squared_distance < (octomap_resolution * 2) * (octomap_resolution * 2) * 1.1)
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
+	const int primes[3] = {97, 157, 211};
+
+	return ((label + 1) * primes[channel] + 61 * channel) % 256;
 }
 
 std::vector<geometry_msgs::Point> findClusters(sensor_msgs::PointCloud2ConstPtr unknown_cloud)
@@ -58,49 +59,39 @@ std::vector<geometry_msgs::Point> findClusters(sensor_msgs::PointCloud2ConstPtr
 
 	// Data containers used
 	pcl::PointCloud<PointTypeIO>::Ptr cloud_out(new pcl::PointCloud<PointTypeIO>);
-	pcl::IndicesClustersPtr clusters(new pcl::IndicesClusters);
 
-	pcl::PointXYZRGBA point_add_rgba;
-	pcl::PointXYZ point_add, centroid_pcl;
+	pcl::PointXYZ centroid_pcl;
 	pcl::PointCloud<pcl::PointXYZ> all_centroids_pcl;
 
 	// Load the input point cloud
 	pcl::fromROSMsg(*unknown_cloud, *cloud_out);
 
-	// Set up a Conditional Euclidean Clustering class
-	pcl::ConditionalEuclideanClustering<PointTypeIO> cec(true);
-	cec.setInputCloud(cloud_out);
-	cec.setConditionFunction(&customRegionGrowing);
-	cec.setClusterTolerance(octomap_resolution * 3);
-	cec.segment(*clusters);
+	// connected voxels, closer than 2 * sqrt(1.1) voxels. only the voxels that changed since the last call are
+	// reclustered, the clusters keep their ids (and colours) from one call to the next
+	clustering.setResolution(octomap_resolution);
+	clustering.update(*cloud_out);
 
-	for (int i = 0; i < clusters->size(); ++i)
+	for (size_t i = 0; i < cloud_out->size(); ++i)
 	{
-		pcl::CentroidPoint<pcl::PointXYZ> centroid_points;
-		geometry_msgs::Point centroid;
-
-		int label_r = ((double)rand() / RAND_MAX) * 255;
-		int label_g = ((double)rand() / RAND_MAX) * 255;
-		int label_b = ((double)rand() / RAND_MAX) * 255;
-
-		for (int j = 0; j < (*clusters)[i].indices.size(); ++j)
-		{
-			cloud_out->points[(*clusters)[i].indices[j]].r = label_r;
-			cloud_out->points[(*clusters)[i].indices[j]].g = label_g;
-			cloud_out->points[(*clusters)[i].indices[j]].b = label_b;
+		int label = clustering.label(cloud_out->points[i]);
 
-			point_add_rgba = cloud_out->points[(*clusters)[i].indices[j]];
+		cloud_out->points[i].r = labelColour(label, 0);
+		cloud_out->points[i].g = labelColour(label, 1);
+		cloud_out->points[i].b = labelColour(label, 2);
+	}
 
-			pcl::copyPoint(point_add_rgba, point_add);
+	const std::map<int, incrementalVoxelClustering::clusterStats> &clusters = clustering.getClusters();
 
-			centroid_points.add(point_add);
-		}
+	for (std::map<int, incrementalVoxelClustering::clusterStats>::const_iterator it = clusters.begin();
+		 it != clusters.end(); it++)
+	{
+		geometry_msgs::Point centroid;
 
-		centroid_points.get(centroid_pcl);
+		it->second.centroid(centroid.x, centroid.y, centroid.z);
 
-		centroid.x = centroid_pcl.x;
-		centroid.y = centroid_pcl.y;
-		centroid.z = centroid_pcl.z;
+		centroid_pcl.x = centroid.x;
+		centroid_pcl.y = centroid.y;
+		centroid_pcl.z = centroid.z;
 
 		centroids_vect.push_back(centroid);
 
@@ -245,6 +236,50 @@ int main(int argc, char **argv)
 	// evaluatePose pose_test(step, min_range, max_range, width_FOV, height_FOV);
 	evaluatePose pose_test(min_range, max_range, width_FOV, height_FOV);
 
+	// pixel based ray casting, one ray every pixel_step pixels (0 keeps the voxel based evaluation)
+	int pixel_step = 0;
+	ros::param::get("~pixel_step", pixel_step);
+
+	if (pixel_step > 0)
+	{
+		pose_test.setPixelStep(pixel_step);
+	}
+
+	// views the arm can not reach, by the offline map of fanuc_m6ib6s_moveit_plugins, are drawn again up to
+	// reachability_tries times before they are planned ("" plans every one)
+	std::string reachability_map_path;
+	int reachability_tries = 20;
+	ros::param::get("~reachability_map", reachability_map_path);
+	ros::param::get("~reachability_tries", reachability_tries);
+
+	reachabilityMap reachability_map;
+
+	if (!reachability_map_path.empty() && !reachability_map.load(reachability_map_path))
+	{
+		ROS_WARN_STREAM("Could not load the reachability map " << reachability_map_path);
+	}
+
+	// candidate origins on the [view_r_min, view_r_max] shell around every cluster, by a "halton" or "stratified"
+	// sequence (or "random" draws) instead of move_group.getRandomPose() ("" keeps getRandomPose)
+	std::string sampler_sequence;
+	ros::param::get("~sampler", sampler_sequence);
+
+	viewSampler view_sampler(0.8, 1.2);
+	ros::param::get("~view_r_min", view_sampler.r_min);
+	ros::param::get("~view_r_max", view_sampler.r_max);
+	view_sampler.tries = reachability_tries;
+	view_sampler.reachability_map = &reachability_map;
+	// in front of the arm, as the mirrored getRandomPose
+	view_sampler.workspace_min.setX(0);
+
+	bool use_sampler = !sampler_sequence.empty();
+
+	if (use_sampler && !view_sampler.setSequence(sampler_sequence))
+	{
+		ROS_WARN_STREAM("Unknown sampler " << sampler_sequence << ", using getRandomPose");
+		use_sampler = false;
+	}
+
 	int n_poses = 20;
 	float threshold = 0.01;
 	float max_reach = 0.951;
@@ -272,10 +307,7 @@ int main(int argc, char **argv)
 		sensor_msgs::PointCloud2ConstPtr unknown_cloud =
 				ros::topic::waitForMessage<sensor_msgs::PointCloud2>("/unknown_pc", n);
 
-		pose_test.writeKnownOctomap();
-		pose_test.writeUnknownOctomap();
-
-		pose_test.writeUnknownCloud();
+		pose_test.refreshMaps(unknown_cloud);
 
 		clusters_centroids = findClusters(unknown_cloud);
 
@@ -296,21 +328,63 @@ int main(int argc, char **argv)
 
 		size_t poses_by_cluster = n_poses / total_clusters;
 
+		std::vector<tf::Pose> candidate_poses;
+		std::vector<geometry_msgs::PoseStamped> candidate_targets;
+		std::vector<int> candidate_arrow_ids;
+
 		ROS_INFO_STREAM("Number of clusters: " << total_clusters);
 		ROS_INFO_STREAM("Poses by cluster: " << poses_by_cluster);
 
+		std::vector<std::vector<tf::Pose> > cluster_views;
+
+		if (use_sampler)
+		{
+			std::vector<tf::Point> centers(total_clusters);
+
+			for (size_t cluster_idx = 0; cluster_idx < total_clusters; cluster_idx++)
+			{
+				tf::pointMsgToTF(clusters_centroids[cluster_idx], centers[cluster_idx]);
+			}
+
+			view_sampler.sample(centers, poses_by_cluster, cluster_views);
+		}
+
 		for (size_t cluster_idx = 0; cluster_idx < total_clusters; cluster_idx++)
 		{
 			geometry_msgs::Point observation_point = clusters_centroids[cluster_idx];
 
+			size_t cluster_poses = use_sampler ? cluster_views[cluster_idx].size() : poses_by_cluster;
+
 			// size_t pose_idx = 0;
 
 			// while (pose_idx < poses_by_cluster)
 			// #pragma omp parallel for //TODO
-			for (size_t pose_idx = 0; pose_idx < poses_by_cluster; pose_idx++)
+			for (size_t pose_idx = 0; pose_idx < cluster_poses; pose_idx++)
 			{
-				geometry_msgs::PoseStamped target_pose = move_group.getRandomPose();
-				target_pose.pose.position.x = abs(target_pose.pose.position.x);
+				geometry_msgs::PoseStamped target_pose;
+
+				if (use_sampler)
+				{
+					target_pose.header.frame_id = move_group.getPlanningFrame();
+					target_pose.header.stamp = ros::Time::now();
+					tf::poseTFToMsg(cluster_views[cluster_idx][pose_idx], target_pose.pose);
+				}
+				else
+				{
+					for (int try_idx = 0; try_idx < std::max(reachability_tries, 1); try_idx++)
+					{
+						target_pose = move_group.getRandomPose();
+						target_pose.pose.position.x = abs(target_pose.pose.position.x);
+
+						const geometry_msgs::Point &origin = target_pose.pose.position;
+
+						if (reachability_map.reachable(origin.x, origin.y, origin.z, observation_point.x - origin.x,
+													   observation_point.y - origin.y, observation_point.z - origin.z))
+						{
+							break;
+						}
+					}
+				}
 
 				// double pose_dist;
 
@@ -334,8 +408,11 @@ int main(int argc, char **argv)
 				// 	target_pose.pose.position.x = 0.2;
 				// }
 
-				geometry_msgs::Quaternion quat_orient = getOrientation(target_pose, observation_point);
-				target_pose.pose.orientation = quat_orient;
+				if (!use_sampler)
+				{
+					geometry_msgs::Quaternion quat_orient = getOrientation(target_pose, observation_point);
+					target_pose.pose.orientation = quat_orient;
+				}
 
 				bool set_target = move_group.setJointValueTarget(target_pose, end_effector_link);
 
@@ -344,9 +421,7 @@ int main(int argc, char **argv)
 				ROS_INFO("Plan (pose goal) %s", set_plan ? "SUCCESS" : "FAILED");
 				ROS_INFO("Target (pose goal) %s", set_target ? "SUCCESS" : "FAILED");
 
-				ROS_INFO_STREAM("Cluster " << cluster_idx + 1 << " of " << total_clusters << " Pose " << pose_idx + 1 << " of " << poses_by_cluster);
-
-				tf::poseMsgToTF(target_pose.pose, pose_test.view_pose);
+				ROS_INFO_STREAM("Cluster " << cluster_idx + 1 << " of " << total_clusters << " Pose " << pose_idx + 1 << " of " << cluster_poses);
 
 				arrow.header.stamp = ros::Time::now();
 				arrow.header.frame_id = frame_id;
@@ -374,39 +449,48 @@ int main(int argc, char **argv)
 
 				if (set_target && set_plan)
 				{
-					pose_test.evalPose();
-
-					ROS_INFO_STREAM("Score: " << pose_test.score);
-
-					arrow.color = pose_test.score_color;
+					tf::Pose candidate;
+					tf::poseMsgToTF(target_pose.pose, candidate);
 
-					if (pose_test.score > best_score)
-					{
-						best_score = pose_test.score;
-						best_pose = target_pose;
-						best_arrow_id = arrow_id;
-
-						single_view_boxes = pose_test.discoveredBoxesVis(frame_id);
-					}
-
-					// pose_idx++;
+					candidate_poses.push_back(candidate);
+					candidate_targets.push_back(target_pose);
+					candidate_arrow_ids.push_back(arrow_id);
 				}
 				else
 				{
-					pose_test.score = 0;
-
-					ROS_INFO_STREAM("Score: " << pose_test.score);
-
-					arrow.color = pose_test.score_color;
+					arrow.color = evaluatePose::scoreColor(0);
 				}
 
 				all_poses.markers.push_back(arrow);
-				pub_arrows.publish(all_poses);
 
 				ROS_INFO("---------");
 			}
 		}
 
+		std::vector<float> candidate_scores = pose_test.evalPoses(candidate_poses);
+
+		for (size_t candidate_idx = 0; candidate_idx < candidate_scores.size(); candidate_idx++)
+		{
+			ROS_INFO_STREAM("Score: " << candidate_scores[candidate_idx]);
+
+			all_poses.markers[candidate_arrow_ids[candidate_idx]].color = evaluatePose::scoreColor(candidate_scores[candidate_idx]);
+
+			if (candidate_scores[candidate_idx] > best_score)
+			{
+				best_score = candidate_scores[candidate_idx];
+				best_pose = candidate_targets[candidate_idx];
+				best_arrow_id = candidate_arrow_ids[candidate_idx];
+			}
+		}
+
+		if (best_score >= 0)
+		{
+			tf::poseMsgToTF(best_pose.pose, pose_test.view_pose);
+			pose_test.evalPose();
+
+			single_view_boxes = pose_test.discoveredBoxesVis(frame_id);
+		}
+
 		all_poses.markers[best_arrow_id].color = green_color;
 		all_poses.markers[best_arrow_id].scale.x *= 2;
 		all_poses.markers[best_arrow_id].scale.y *= 2;
@@ -59,9 +59,22 @@ bool publish = false;
 void genAndEvalPose(geometry_msgs::Pose marker_pose)
 {
     // evaluatePose pose(20, 0.8, 10, 58 * M_PI / 180, 45 * M_PI / 180);
-    evaluatePose pose(0.8, 10, 58 * M_PI / 180, 45 * M_PI / 180);
+    // kept between evaluations, so the maps can be updated incrementally
+    static evaluatePose pose(0.8, 10, 58 * M_PI / 180, 45 * M_PI / 180);
+    static bool configured = false;
+
+    if (!configured)
+    {
+        // between two clicks only the camera clouds change the maps, the incremental_maps param can turn it off
+        pose.incremental_maps = true;
+        ros::param::get("incremental_maps", pose.incremental_maps);
+        configured = true;
+    }
+
     tf::poseMsgToTF(marker_pose, pose.view_pose);
 
+    pose.refreshMaps();
+
     pose.evalPose();
 
     line = pose.rayLinesVis("base_link");
@@ -35,6 +35,8 @@ ros::Publisher pub_text;
 visualization_msgs::Marker line, text, frustum_lines;
 visualization_msgs::MarkerArray single_view_boxes;
 
+boost::shared_ptr<evaluatePose> pose_evaluator;
+
 // int step = 1;
 float min_range = 0;
 float max_range = 1;
@@ -56,15 +58,23 @@ void clickCB(const visualization_msgs::InteractiveMarkerFeedbackConstPtr &feedba
 
 	// evaluatePose pose(20, 0.8, 3.5, 58 * M_PI / 180, 45 * M_PI / 180);
 	// evaluatePose pose(step, min_range, max_range, width_FOV, height_FOV);
-	evaluatePose pose(min_range, max_range, width_FOV, height_FOV);
+	// kept between clicks, so the maps can be updated incrementally
+	if (!pose_evaluator)
+	{
+		pose_evaluator.reset(new evaluatePose(min_range, max_range, width_FOV, height_FOV));
+
+		// between two clicks only the camera clouds change the maps, the incremental_maps param can turn it off
+		pose_evaluator->incremental_maps = true;
+		ros::param::get("incremental_maps", pose_evaluator->incremental_maps);
+	}
+
+	evaluatePose &pose = *pose_evaluator;
 	// pose.view_pose = transform;
 
 	//TODO catch
 	tf::poseMsgToTF(cam_feedback->markers[0].pose, pose.view_pose);
 
-	pose.writeKnownOctomap();
-	pose.writeUnknownOctomap();
-	pose.writeUnknownCloud();
+	pose.refreshMaps();
 
 	ROS_INFO_STREAM("Everything written...");
 
@@ -106,12 +116,15 @@ void autoModeStartCB(const visualization_msgs::InteractiveMarkerFeedbackConstPtr
 
 	int n_poses = 20;
 	float threshold = 0.01;
+	float time_budget = 0;
 
 	ros::param::get("~n_poses", n_poses);
 	ros::param::get("~threshold", threshold);
+	ros::param::get("~time_budget", time_budget);
 
 	goal.threshold = threshold;
 	goal.n_poses = n_poses;
+	goal.time_budget = time_budget;
 	ac.sendGoal(goal);
 
 	//wait for the action to return
@@ -0,0 +1,93 @@
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include <octomap_server/OctomapServer.h>
+
+#include <smobex_explorer/shared_octree_registry.h>
+
+// octomap_server that also hands copies of its tree to the nodelets loaded next to it,
+// under the name of its full map topic. every copy is a deep copy of the whole tree made between two cloud
+// insertions, so at most one is made per ~shared_min_period, requests in between wait for the next one
+class sharedOctomapServer : public octomap_server::OctomapServer
+{
+public:
+	sharedOctomapServer(const ros::NodeHandle &private_nh, const std::string &_shared_name)
+		: octomap_server::OctomapServer(private_nh)
+	{
+		shared_name = _shared_name;
+		min_period = 0.5;
+
+		private_nh.getParam("shared_min_period", min_period);
+
+		sharedOctreeRegistry::instance().advertise(shared_name);
+	}
+
+	~sharedOctomapServer()
+	{
+		sharedOctreeRegistry::instance().unadvertise(shared_name);
+	}
+
+protected:
+	std::string shared_name;
+	double min_period;
+	ros::WallTime last_shared;
+	ros::WallTimer share_timer;
+
+	// called after every change of the map, on the thread that changes it
+	virtual void publishAll(const ros::Time &rostime)
+	{
+		octomap_server::OctomapServer::publishAll(rostime);
+
+		if (m_octree == NULL || !sharedOctreeRegistry::instance().requested(shared_name))
+		{
+			return;
+		}
+
+		ros::WallDuration wait = last_shared + ros::WallDuration(min_period) - ros::WallTime::now();
+
+		if (wait <= ros::WallDuration(0))
+		{
+			share();
+		}
+		else if (!share_timer.hasPending())
+		{
+			// the map may not change again soon, so the request is not left for the next cloud. the timer runs on
+			// the queue of the cloud callback, never during an insertion
+			share_timer = m_nh.createWallTimer(wait, &sharedOctomapServer::shareLater, this, true);
+		}
+	}
+
+	void shareLater(const ros::WallTimerEvent &)
+	{
+		if (m_octree != NULL && sharedOctreeRegistry::instance().requested(shared_name))
+		{
+			share();
+		}
+	}
+
+	void share()
+	{
+		sharedOctreeRegistry::instance().publish(shared_name, new octomap::OcTree(*m_octree));
+		last_shared = ros::WallTime::now();
+	}
+};
+
+class sharedOctomapServerNodelet : public nodelet::Nodelet
+{
+public:
+	virtual void onInit()
+	{
+		NODELET_DEBUG("Initializing shared octomap server nodelet ...");
+
+		std::string shared_name = getNodeHandle().resolveName("octomap_full");
+
+		server.reset(new sharedOctomapServer(getPrivateNodeHandle(), shared_name));
+
+		NODELET_INFO_STREAM("Sharing the octree in process as " << shared_name);
+	}
+
+private:
+	boost::shared_ptr<sharedOctomapServer> server;
+};
+
+PLUGINLIB_EXPORT_CLASS(sharedOctomapServerNodelet, nodelet::Nodelet)
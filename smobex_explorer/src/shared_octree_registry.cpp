@@ -0,0 +1,105 @@
+#include <smobex_explorer/shared_octree_registry.h>
+
+sharedOctreeRegistry &sharedOctreeRegistry::instance()
+{
+	static sharedOctreeRegistry registry;
+
+	return registry;
+}
+
+sharedOctreeRegistry::~sharedOctreeRegistry()
+{
+	for (std::map<std::string, slot>::iterator it = slots.begin(); it != slots.end(); it++)
+	{
+		delete it->second.tree;
+	}
+}
+
+void sharedOctreeRegistry::advertise(const std::string &name)
+{
+	boost::mutex::scoped_lock lock(mutex);
+
+	slots[name].advertised = true;
+}
+
+void sharedOctreeRegistry::unadvertise(const std::string &name)
+{
+	boost::mutex::scoped_lock lock(mutex);
+
+	slot &a_slot = slots[name];
+
+	a_slot.advertised = false;
+	delete a_slot.tree;
+	a_slot.tree = NULL;
+
+	// consumers waiting in take() fall back to the topics
+	published.notify_all();
+}
+
+bool sharedOctreeRegistry::advertised(const std::string &name)
+{
+	boost::mutex::scoped_lock lock(mutex);
+
+	std::map<std::string, slot>::const_iterator it = slots.find(name);
+
+	return it != slots.end() && it->second.advertised;
+}
+
+void sharedOctreeRegistry::request(const std::string &name)
+{
+	boost::mutex::scoped_lock lock(mutex);
+
+	slot &a_slot = slots[name];
+
+	delete a_slot.tree;
+	a_slot.tree = NULL;
+	a_slot.requested = true;
+}
+
+octomap::OcTree *sharedOctreeRegistry::take(const std::string &name, ros::Duration timeout)
+{
+	boost::mutex::scoped_lock lock(mutex);
+
+	ros::WallTime deadline = ros::WallTime::now() + ros::WallDuration(timeout.toSec());
+
+	slot &a_slot = slots[name];
+
+	while (a_slot.tree == NULL && a_slot.advertised)
+	{
+		ros::WallDuration left = deadline - ros::WallTime::now();
+
+		if (left <= ros::WallDuration(0))
+		{
+			break;
+		}
+
+		published.timed_wait(lock, boost::posix_time::microseconds(left.toNSec() / 1000));
+	}
+
+	octomap::OcTree *tree = a_slot.tree;
+	a_slot.tree = NULL;
+
+	return tree;
+}
+
+bool sharedOctreeRegistry::requested(const std::string &name)
+{
+	boost::mutex::scoped_lock lock(mutex);
+
+	std::map<std::string, slot>::const_iterator it = slots.find(name);
+
+	return it != slots.end() && it->second.requested;
+}
+
+void sharedOctreeRegistry::publish(const std::string &name, octomap::OcTree *tree)
+{
+	boost::mutex::scoped_lock lock(mutex);
+
+	slot &a_slot = slots[name];
+
+	delete a_slot.tree;
+	a_slot.tree = tree;
+	a_slot.requested = false;
+
+	published.notify_all();
+}
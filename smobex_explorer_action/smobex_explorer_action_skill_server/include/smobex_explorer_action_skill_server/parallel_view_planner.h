@@ -0,0 +1,68 @@
+#ifndef SMOBEX_EXPLORER_ACTION_SKILL_PARALLEL_VIEW_PLANNER
+#define SMOBEX_EXPLORER_ACTION_SKILL_PARALLEL_VIEW_PLANNER
+
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ros/ros.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <moveit_msgs/Constraints.h>
+
+#include <moveit/move_group_interface/move_group_interface.h>
+#include <moveit/planning_pipeline/planning_pipeline.h>
+#include <moveit/planning_scene_monitor/planning_scene_monitor.h>
+#include <moveit/robot_model_loader/robot_model_loader.h>
+
+// plans the candidate views with the planning pipeline of move_group, loaded in process, in up to n_threads
+// requests at once instead of one MoveGroupInterface::plan after the other. the candidates come best first,
+// the planning stops as soon as one planned and every better one failed.
+// OMPL gives every concurrent request its own planning context, all of them share one copy of the scene
+class ParallelViewPlanner
+{
+public:
+  int n_threads;
+  double planning_time;
+  int planning_attempts;
+  double goal_position_tolerance;
+  double goal_orientation_tolerance;
+
+  ParallelViewPlanner(const std::string &group_name, const std::string &end_effector_link, int _n_threads = 4);
+
+  // index of the best target that planned, its plan in plan. -1 when none did
+  int plan(const std::vector<geometry_msgs::PoseStamped> &targets, const moveit_msgs::Constraints &path_constraints,
+           moveit::planning_interface::MoveGroupInterface::Plan &plan);
+
+private:
+  enum planStatus
+  {
+    plan_pending,
+    plan_running,
+    plan_failed,
+    plan_succeeded
+  };
+
+  std::string group_name_;
+  std::string end_effector_link_;
+
+  robot_model_loader::RobotModelLoaderPtr model_loader_;
+  planning_scene_monitor::PlanningSceneMonitorPtr scene_monitor_;
+  planning_pipeline::PlanningPipelinePtr pipeline_;
+
+  // shared by the workers of one plan() call
+  boost::mutex mutex_;
+  boost::condition_variable done_;
+  std::vector<planStatus> status_;
+  std::vector<moveit::planning_interface::MoveGroupInterface::Plan> plans_;
+  size_t next_target_;
+
+  void worker(const std::vector<geometry_msgs::PoseStamped> &targets, const moveit_msgs::Constraints &path_constraints,
+              const planning_scene::PlanningSceneConstPtr &scene, const moveit_msgs::RobotState &start_state);
+
+  // the best target that did not fail (yet), -1 once all of them failed
+  int firstNotFailed() const;
+};
+
+#endif // SMOBEX_EXPLORER_ACTION_SKILL_PARALLEL_VIEW_PLANNER
@@ -9,16 +9,19 @@ class SmobexExplorerActionSkill
 {
 protected:
   ros::NodeHandle nh_;
+  // the node's private namespace, or the nodelet's one when loaded as a nodelet
+  ros::NodeHandle private_nh_;
   actionlib::SimpleActionServer<smobex_explorer_action_skill_msgs::SmobexExplorerActionSkillAction> as_;
   std::string action_name_;
   smobex_explorer_action_skill_msgs::SmobexExplorerActionSkillFeedback feedback_;
   smobex_explorer_action_skill_msgs::SmobexExplorerActionSkillResult result_;
 
 public:
-  SmobexExplorerActionSkill(std::string name);
+  SmobexExplorerActionSkill(std::string name, const ros::NodeHandle &private_nh = ros::NodeHandle("~"));
   ~SmobexExplorerActionSkill(void);
   void executeCB(const smobex_explorer_action_skill_msgs::SmobexExplorerActionSkillGoalConstPtr &goal);
   void feedback(float percentage);
+  void feedback(float percentage, int n_evaluated, float evaluation_rate, float best_score);
   void set_succeeded(std::string outcome = "succeeded");
   void set_aborted(std::string outcome = "aborted");
   bool check_preemption();
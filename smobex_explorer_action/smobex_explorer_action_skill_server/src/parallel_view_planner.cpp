@@ -0,0 +1,168 @@
+#include <smobex_explorer_action_skill_server/parallel_view_planner.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <moveit/kinematic_constraints/utils.h>
+#include <moveit/robot_state/conversions.h>
+
+ParallelViewPlanner::ParallelViewPlanner(const std::string &group_name, const std::string &end_effector_link,
+                                         int _n_threads)
+  : group_name_(group_name), end_effector_link_(end_effector_link)
+{
+  n_threads = _n_threads;
+  planning_time = 0.5;
+  planning_attempts = 5;
+  goal_position_tolerance = 1e-4;
+  goal_orientation_tolerance = 1e-3;
+
+  model_loader_.reset(new robot_model_loader::RobotModelLoader("robot_description"));
+
+  scene_monitor_.reset(new planning_scene_monitor::PlanningSceneMonitor(model_loader_));
+  scene_monitor_->startSceneMonitor("/move_group/monitored_planning_scene");
+  scene_monitor_->startStateMonitor();
+  scene_monitor_->requestPlanningSceneState("/get_planning_scene");
+
+  // the planner plugin, its adapters and their configs as move_group loaded them
+  pipeline_.reset(new planning_pipeline::PlanningPipeline(model_loader_->getModel(), ros::NodeHandle("/move_group"),
+                                                          "planning_plugin", "request_adapters"));
+}
+
+int ParallelViewPlanner::plan(const std::vector<geometry_msgs::PoseStamped> &targets,
+                              const moveit_msgs::Constraints &path_constraints,
+                              moveit::planning_interface::MoveGroupInterface::Plan &plan)
+{
+  if (targets.empty())
+  {
+    return -1;
+  }
+
+  // one copy of the scene, so the monitor can go on updating while the workers plan
+  planning_scene::PlanningSceneConstPtr scene;
+  moveit_msgs::RobotState start_state;
+
+  {
+    planning_scene_monitor::LockedPlanningSceneRO locked_scene(scene_monitor_);
+    scene = planning_scene::PlanningScene::clone(locked_scene);
+  }
+
+  robot_state::robotStateToRobotStateMsg(scene->getCurrentState(), start_state);
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    status_.assign(targets.size(), plan_pending);
+    plans_.assign(targets.size(), moveit::planning_interface::MoveGroupInterface::Plan());
+    next_target_ = 0;
+  }
+
+  boost::thread_group workers;
+
+  for (int i = 0; i < std::max(n_threads, 1); i++)
+  {
+    workers.create_thread(boost::bind(&ParallelViewPlanner::worker, this, boost::cref(targets),
+                                      boost::cref(path_constraints), scene, boost::cref(start_state)));
+  }
+
+  int best = -1;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (true)
+    {
+      best = firstNotFailed();
+
+      if (best < 0 || status_[best] == plan_succeeded)
+      {
+        break;
+      }
+
+      done_.wait(lock);
+    }
+
+    // nothing left worth planning, the workers stop at their next target
+    next_target_ = targets.size();
+  }
+
+  // the requests still running plan worse targets than the one kept
+  pipeline_->terminate();
+  workers.join_all();
+
+  if (best >= 0)
+  {
+    plan = plans_[best];
+  }
+
+  return best;
+}
+
+void ParallelViewPlanner::worker(const std::vector<geometry_msgs::PoseStamped> &targets,
+                                 const moveit_msgs::Constraints &path_constraints,
+                                 const planning_scene::PlanningSceneConstPtr &scene,
+                                 const moveit_msgs::RobotState &start_state)
+{
+  while (ros::ok())
+  {
+    size_t target_idx;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      // the best target not failed already planned, the ones left are worse
+      int best = firstNotFailed();
+
+      if (next_target_ >= targets.size() || (best >= 0 && status_[best] == plan_succeeded))
+      {
+        return;
+      }
+
+      target_idx = next_target_++;
+      status_[target_idx] = plan_running;
+    }
+
+    planning_interface::MotionPlanRequest request;
+    planning_interface::MotionPlanResponse response;
+
+    request.group_name = group_name_;
+    request.start_state = start_state;
+    request.allowed_planning_time = planning_time;
+    request.num_planning_attempts = planning_attempts;
+    request.max_velocity_scaling_factor = 1.0;
+    request.max_acceleration_scaling_factor = 1.0;
+    request.path_constraints = path_constraints;
+    request.goal_constraints.push_back(kinematic_constraints::constructGoalConstraints(
+        end_effector_link_, targets[target_idx], goal_position_tolerance, goal_orientation_tolerance));
+
+    bool planned = pipeline_->generatePlan(scene, request, response) &&
+                   response.error_code_.val == moveit_msgs::MoveItErrorCodes::SUCCESS && response.trajectory_;
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (planned)
+    {
+      response.trajectory_->getRobotTrajectoryMsg(plans_[target_idx].trajectory_);
+      plans_[target_idx].start_state_ = start_state;
+      plans_[target_idx].planning_time_ = response.planning_time_;
+    }
+
+    status_[target_idx] = planned ? plan_succeeded : plan_failed;
+
+    ROS_INFO("Plan %zu (pose goal) %s", target_idx, planned ? "SUCCESS" : "FAILED");
+
+    done_.notify_all();
+  }
+}
+
+int ParallelViewPlanner::firstNotFailed() const
+{
+  for (size_t i = 0; i < status_.size(); i++)
+  {
+    if (status_[i] != plan_failed)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
@@ -0,0 +1,25 @@
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include <smobex_explorer_action_skill_server/smobex_explorer_action_skill_server.h>
+
+// the action skill as a nodelet. loaded in the same manager as smobex_explorer/SharedOctomapServer,
+// it takes the known octree from it without serializing it
+class SmobexExplorerActionSkillNodelet : public nodelet::Nodelet
+{
+public:
+  virtual void onInit()
+  {
+    std::string skill_name;
+    getPrivateNodeHandle().param<std::string>("SkillName", skill_name, "SmobexExplorerActionSkill");
+
+    smobex_explorer_action_.reset(new SmobexExplorerActionSkill(skill_name, getPrivateNodeHandle()));
+
+    NODELET_INFO_STREAM("Action skill " << skill_name << " started.");
+  }
+
+private:
+  boost::shared_ptr<SmobexExplorerActionSkill> smobex_explorer_action_;
+};
+
+PLUGINLIB_EXPORT_CLASS(SmobexExplorerActionSkillNodelet, nodelet::Nodelet)
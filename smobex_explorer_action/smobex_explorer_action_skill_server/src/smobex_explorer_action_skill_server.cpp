@@ -1,6 +1,7 @@
 #include <ros/ros.h>
 #include <actionlib/server/simple_action_server.h>
 #include <smobex_explorer_action_skill_server/smobex_explorer_action_skill_server.h>
+#include <smobex_explorer_action_skill_server/parallel_view_planner.h>
 
 #include <moveit/move_group_interface/move_group_interface.h>
 #include <moveit/planning_scene_interface/planning_scene_interface.h>
@@ -30,15 +31,25 @@
 
 #include <pcl/features/normal_3d.h>
 #include <pcl/filters/voxel_grid.h>
-#include <pcl/segmentation/conditional_euclidean_clustering.h>
+#include <pcl/common/centroid.h>
+#include <pcl/PointIndices.h>
+
+#include <boost/thread/thread.hpp>
 
 #include <smobex_explorer/explorer.h>
+#include <smobex_explorer/incremental_voxel_clustering.h>
+#include <smobex_explorer/map_settled_monitor.h>
+#include <smobex_explorer/reachability_map.h>
+#include <smobex_explorer/view_sampler.h>
+#include <smobex_explorer/cross_entropy_view_search.h>
+#include <smobex_explorer/candidate_pool.h>
 
 typedef pcl::PointXYZRGBA PointTypeIO;
 
 sensor_msgs::PointCloud2 cloud_clusters_publish;
 sensor_msgs::PointCloud2 centroid_clusters_publish;
 float octomap_resolution = 0.1;
+incrementalVoxelClustering clustering(octomap_resolution);
 
 using namespace std;
 
@@ -56,93 +67,98 @@ bool cmp_aPose(const aPose &a, const aPose &b)
   return a.score > b.score;
 }
 
-bool customRegionGrowing(const PointTypeIO &point_a, const PointTypeIO &point_b, float squared_distance)
+// the same colour for a cluster every time it is published
+int labelColour(int label, int channel)
 {
-  if (squared_distance < (octomap_resolution * 2) * (octomap_resolution * 2) * 1.1)
-  {
-    return true;
-  }
-  else
-  {
-    return false;
-  }
+  const int primes[3] = {97, 157, 211};
+
+  return ((label + 1) * primes[channel] + 61 * channel) % 256;
 }
 
-std::vector<geometry_msgs::Point> findClusters(sensor_msgs::PointCloud2ConstPtr unknown_cloud)
+// pose_test, when given, is the unknown space instead of unknown_cloud: it hands over the voxels that changed
+// since the last call, so the cost follows the change and not the unknown space. the coloured voxels are only
+// built with colour_voxels (someone listens to them), straight from the clusters
+std::vector<geometry_msgs::Point> findClusters(sensor_msgs::PointCloud2ConstPtr unknown_cloud,
+                                               evaluatePose *pose_test, bool colour_voxels)
 {
   std::vector<geometry_msgs::Point> centroids_vect;
 
-  // Data containers used
-  pcl::PointCloud<PointTypeIO>::Ptr cloud_out(new pcl::PointCloud<PointTypeIO>);
-  pcl::IndicesClustersPtr clusters(new pcl::IndicesClusters);
-
-  pcl::PointXYZRGBA point_add_rgba;
-  pcl::PointXYZ point_add, centroid_pcl;
-  // pcl::PointCloud<pcl::PointXYZ> all_centroids_pcl;
   pcl::PointCloud<PointTypeIO> all_centroids_pcl;
 
-  // Load the input point cloud
-  pcl::fromROSMsg(*unknown_cloud, *cloud_out);
+  // connected voxels, closer than 2 * sqrt(1.1) voxels. only the voxels that changed since the last call are
+  // reclustered, the clusters keep their ids (and colours) from one call to the next
+  clustering.setResolution(octomap_resolution);
 
-  // Set up a Conditional Euclidean Clustering class
-  pcl::ConditionalEuclideanClustering<PointTypeIO> cec(true);
-  cec.setInputCloud(cloud_out);
-  cec.setConditionFunction(&customRegionGrowing);
-  cec.setClusterTolerance(octomap_resolution * 3);
-  cec.segment(*clusters);
+  pcl::PointCloud<pcl::PointXYZ> now_known, now_unknown;
 
-  geometry_msgs::Point centroid;
-
-  for (int i = 0; i < clusters->size(); ++i)
+  if (pose_test == NULL)
   {
-    pcl::CentroidPoint<pcl::PointXYZ> centroid_points;
-
-    int label_r = ((double)rand() / RAND_MAX) * 255;
-    int label_g = ((double)rand() / RAND_MAX) * 255;
-    int label_b = ((double)rand() / RAND_MAX) * 255;
+    pcl::PointCloud<pcl::PointXYZ> cloud;
+    pcl::fromROSMsg(*unknown_cloud, cloud);
 
-    for (int j = 0; j < (*clusters)[i].indices.size(); ++j)
-    {
-      cloud_out->points[(*clusters)[i].indices[j]].r = label_r;
-      cloud_out->points[(*clusters)[i].indices[j]].g = label_g;
-      cloud_out->points[(*clusters)[i].indices[j]].b = label_b;
-
-      point_add_rgba = cloud_out->points[(*clusters)[i].indices[j]];
+    clustering.update(cloud);
+  }
+  else if (pose_test->takeUnknownChanges(now_known, now_unknown) && !clustering.empty())
+  {
+    clustering.remove(now_known);
+    clustering.add(now_unknown);
+  }
+  else
+  {
+    // the unknown centers were rebuilt since the last call
+    pcl::PointCloud<pcl::PointXYZ> cloud;
+    pose_test->unknownCloud(cloud);
 
-      pcl::copyPoint(point_add_rgba, point_add);
+    clustering.update(cloud);
+  }
 
-      centroid_points.add(point_add);
-    }
+  const std::map<int, incrementalVoxelClustering::clusterStats> &clusters = clustering.getClusters();
 
-    centroid_points.get(centroid_pcl);
+  for (std::map<int, incrementalVoxelClustering::clusterStats>::const_iterator it = clusters.begin();
+       it != clusters.end(); it++)
+  {
+    geometry_msgs::Point centroid;
 
-    centroid.x = centroid_pcl.x;
-    centroid.y = centroid_pcl.y;
-    centroid.z = centroid_pcl.z;
+    it->second.centroid(centroid.x, centroid.y, centroid.z);
 
-    ROS_INFO_STREAM("Centroid i: " << centroid);
+    ROS_INFO_STREAM("Centroid " << it->first << ": " << centroid);
 
     centroids_vect.push_back(centroid);
 
     PointTypeIO centroid_pcl_colored;
 
-    centroid_pcl_colored.x = centroid_pcl.x;
-    centroid_pcl_colored.y = centroid_pcl.y;
-    centroid_pcl_colored.z = centroid_pcl.z;
+    centroid_pcl_colored.x = centroid.x;
+    centroid_pcl_colored.y = centroid.y;
+    centroid_pcl_colored.z = centroid.z;
 
-    centroid_pcl_colored.r = label_r;
-    centroid_pcl_colored.g = label_g;
-    centroid_pcl_colored.b = label_b;
-    // centroid_pcl_colored.a = 1;
+    centroid_pcl_colored.r = labelColour(it->first, 0);
+    centroid_pcl_colored.g = labelColour(it->first, 1);
+    centroid_pcl_colored.b = labelColour(it->first, 2);
 
     all_centroids_pcl.push_back(centroid_pcl_colored);
   }
 
-  // Save the output point cloud
-  // ROS_INFO("SAVING PCL");
-  // pcl::io::savePCDFile("output.pcd", *cloud_out);
+  if (colour_voxels)
+  {
+    pcl::PointCloud<PointTypeIO> cloud_out;
+    std::vector<int> labels;
+
+    clustering.voxels(cloud_out, labels);
+
+    for (size_t i = 0; i < cloud_out.size(); ++i)
+    {
+      cloud_out.points[i].r = labelColour(labels[i], 0);
+      cloud_out.points[i].g = labelColour(labels[i], 1);
+      cloud_out.points[i].b = labelColour(labels[i], 2);
+    }
+
+    // Save the output point cloud
+    // ROS_INFO("SAVING PCL");
+    // pcl::io::savePCDFile("output.pcd", cloud_out);
+
+    pcl::toROSMsg(cloud_out, cloud_clusters_publish);
+  }
 
-  pcl::toROSMsg(*cloud_out, cloud_clusters_publish);
   pcl::toROSMsg(all_centroids_pcl, centroid_clusters_publish);
 
   return centroids_vect;
@@ -220,8 +236,82 @@ geometry_msgs::Quaternion getOrientation(geometry_msgs::PoseStamped pose, geomet
   return quat_out;
 }
 
-SmobexExplorerActionSkill::SmobexExplorerActionSkill(std::string name) : as_(nh_, name, boost::bind(&SmobexExplorerActionSkill::executeCB, this, _1), false),
-                                                                         action_name_(name)
+// refreshes the evaluator maps and returns the unknown cloud to cluster, both from the same source
+sensor_msgs::PointCloud2ConstPtr refreshUnknown(evaluatePose &pose_test, const std::string &frame_id, ros::NodeHandle &n)
+{
+  if (pose_test.extract_unknown)
+  {
+    pose_test.refreshMaps();
+
+    // findClusters follows pose_test itself
+    return sensor_msgs::PointCloud2ConstPtr();
+  }
+
+  sensor_msgs::PointCloud2ConstPtr unknown_cloud = ros::topic::waitForMessage<sensor_msgs::PointCloud2>("/unknown_pc", n);
+
+  pose_test.refreshMaps(unknown_cloud);
+
+  return unknown_cloud;
+}
+
+// gives the map time to take in the new view
+void waitMapSettled(mapSettledMonitor &settled_monitor, double settle_timeout)
+{
+  ros::WallTime settle_start = ros::WallTime::now();
+
+  if (settled_monitor.waitSettled(ros::Duration(settle_timeout)))
+  {
+    ROS_INFO_STREAM("Map settled after " << (ros::WallTime::now() - settle_start).toSec() << " secs.");
+  }
+  else
+  {
+    ROS_WARN_STREAM("Map not settled after " << settle_timeout << " secs, going on.");
+  }
+}
+
+// runs in its own thread in the pipelined mode
+void executePlan(moveit::planning_interface::MoveGroupInterface &move_group,
+                 moveit::planning_interface::MoveGroupInterface::Plan plan, bool &success)
+{
+  success = (move_group.execute(plan) == moveit::planning_interface::MoveItErrorCode::SUCCESS);
+
+  ROS_INFO("Execute (best pose goal) %s", success ? "SUCCESS" : "FAILED");
+}
+
+// the arrow of a candidate, along its view direction
+visualization_msgs::Marker poseArrow(const geometry_msgs::PoseStamped &pose, const std::string &frame_id, int id)
+{
+  visualization_msgs::Marker arrow;
+  tf::Quaternion q_rot, q_new;
+
+  arrow.header.stamp = ros::Time::now();
+  arrow.header.frame_id = frame_id;
+
+  arrow.id = id;
+
+  arrow.type = visualization_msgs::Marker::ARROW;
+  arrow.action = visualization_msgs::Marker::ADD;
+
+  arrow.pose.position = pose.pose.position;
+
+  tf::quaternionMsgToTF(pose.pose.orientation, q_new);
+
+  q_rot.setRPY(0, -M_PI / 2, 0);
+  q_new = q_new * q_rot;
+  q_new.normalize();
+
+  tf::quaternionTFToMsg(q_new, arrow.pose.orientation);
+
+  arrow.scale.x = 0.10;
+  arrow.scale.y = 0.02;
+  arrow.scale.z = 0.02;
+
+  return arrow;
+}
+
+SmobexExplorerActionSkill::SmobexExplorerActionSkill(std::string name, const ros::NodeHandle &private_nh) : private_nh_(private_nh),
+                                                                                                        as_(nh_, name, boost::bind(&SmobexExplorerActionSkill::executeCB, this, _1), false),
+                                                                                                        action_name_(name)
 {
   as_.start();
 }
@@ -270,18 +360,180 @@ void SmobexExplorerActionSkill::executeCB(const smobex_explorer_action_skill_msg
   std::string frame_id = "/world";
 
   // ros::param::get("~" + ros::names::remap("step"), step);
-  ros::param::get("~" + ros::names::remap("min_range"), min_range);
-  ros::param::get("~" + ros::names::remap("max_range"), max_range);
-  ros::param::get("~" + ros::names::remap("width_FOV"), width_FOV);
-  ros::param::get("~" + ros::names::remap("height_FOV"), height_FOV);
-  ros::param::get("~" + ros::names::remap("frame_id"), frame_id);
+  private_nh_.getParam("min_range", min_range);
+  private_nh_.getParam("max_range", max_range);
+  private_nh_.getParam("width_FOV", width_FOV);
+  private_nh_.getParam("height_FOV", height_FOV);
+  private_nh_.getParam("frame_id", frame_id);
 
   // evaluatePose pose_test(20, 0.8, 3.5, 58 * M_PI / 180, 45 * M_PI / 180);
   // evaluatePose pose_test(step, min_range, max_range, width_FOV, height_FOV);
   evaluatePose pose_test(min_range, max_range, width_FOV, height_FOV);
 
+  // pixel based ray casting, one ray every pixel_step pixels (0 keeps the voxel based evaluation)
+  int pixel_step = 0;
+  private_nh_.getParam("pixel_step", pixel_step);
+
+  if (pixel_step > 0)
+  {
+    pose_test.setPixelStep(pixel_step);
+  }
+
+  // orientations tried at every candidate origin on its spherical visibility map (0 only looks at the cluster)
+  int orientations_per_origin = 0;
+  private_nh_.getParam("orientations_per_origin", orientations_per_origin);
+
+  sphericalVisibilityMap visibility_map;
+
+  // only ray cast the poses that can still make it into the best bound_top_k (0 ray casts all of them)
+  int bound_top_k = 0;
+  private_nh_.getParam("bound_top_k", bound_top_k);
+
+  // build the maps in a background thread, the next snapshot is asked for once the map settled after every move
+  bool map_snapshots = false;
+  private_nh_.getParam("map_snapshots", map_snapshots);
+
+  boost::shared_ptr<mapSnapshotManager> snapshot_manager;
+
+  if (map_snapshots)
+  {
+    snapshot_manager.reset(new mapSnapshotManager(pose_test.min_bbx, pose_test.max_bbx, pose_test.dense_grid_margin));
+    snapshot_manager->extract_unknown = pose_test.extract_unknown;
+    snapshot_manager->start();
+    pose_test.snapshot_manager = snapshot_manager.get();
+  }
+
+  // pipelined: the next view is sampled and scored on the predicted map while the arm moves, then the best
+  // pipeline_validate_k of them are scored again on the real map once it arrived
+  bool pipelined = false;
+  int pipeline_validate_k = 10;
+  private_nh_.getParam("pipelined", pipelined);
+  private_nh_.getParam("pipeline_validate_k", pipeline_validate_k);
+
+  // the sorted candidates are planned planning_threads at once in process (0 plans them one by one with move_group)
+  int planning_threads = 0;
+  private_nh_.getParam("planning_threads", planning_threads);
+
+  boost::shared_ptr<ParallelViewPlanner> view_planner;
+
+  if (planning_threads > 0)
+  {
+    view_planner.reset(new ParallelViewPlanner(PLANNING_GROUP, move_group.getEndEffectorLink(), planning_threads));
+  }
+
+  // candidates whose view the arm can not reach, by the offline map of fanuc_m6ib6s_moveit_plugins, are drawn
+  // again up to reachability_tries times before any scoring ("" keeps every candidate)
+  std::string reachability_map_path;
+  int reachability_tries = 20;
+  private_nh_.getParam("reachability_map", reachability_map_path);
+  private_nh_.getParam("reachability_tries", reachability_tries);
+
+  reachabilityMap reachability_map;
+
+  if (!reachability_map_path.empty())
+  {
+    if (!reachability_map.load(reachability_map_path))
+    {
+      ROS_WARN_STREAM("Could not load the reachability map " << reachability_map_path);
+    }
+    else if (reachability_map.frameId() != move_group.getPlanningFrame())
+    {
+      ROS_WARN_STREAM("Reachability map in " << reachability_map.frameId() << ", planning in "
+                                             << move_group.getPlanningFrame());
+    }
+  }
+
+  // candidate origins on the [view_r_min, view_r_max] shell around every cluster, by a "halton" or "stratified"
+  // sequence (or "random" draws) instead of move_group.getRandomPose() ("" keeps getRandomPose)
+  std::string sampler_sequence;
+  private_nh_.getParam("sampler", sampler_sequence);
+
+  viewSampler view_sampler(0.8, 1.2);
+  private_nh_.getParam("view_r_min", view_sampler.r_min);
+  private_nh_.getParam("view_r_max", view_sampler.r_max);
+  view_sampler.tries = reachability_tries;
+  view_sampler.reachability_map = &reachability_map;
+  // in front of the arm, as the mirrored getRandomPose
+  view_sampler.workspace_min.setX(0);
+
+  bool use_sampler = !sampler_sequence.empty();
+
+  if (use_sampler && !view_sampler.setSequence(sampler_sequence))
+  {
+    ROS_WARN_STREAM("Unknown sampler " << sampler_sequence << ", using getRandomPose");
+    use_sampler = false;
+  }
+
+  // the candidates come from cross_entropy_rounds rounds of cross entropy search on the view sampler instead
+  // of one batch, with the same n_poses evaluations (0 keeps one batch)
+  crossEntropyViewSearch view_search;
+  view_search.rounds = 0;
+  private_nh_.getParam("cross_entropy_rounds", view_search.rounds);
+  private_nh_.getParam("elite_fraction", view_search.elite_fraction);
+
+  // the scored candidates are kept between iterations, up to candidate_pool of them (0 keeps none). the ones
+  // that look at where the map changed are scored again, the best bounded pool_rescore_top_k of them (0 all).
+  // the pool scores every view in full, without the coarse or bounded evaluation. it needs incremental_maps
+  // without map_snapshots: a map downloaded or swapped in whole makes every candidate stale on every iteration
+  int pool_size = 0;
+  int pool_rescore_top_k = 0;
+  private_nh_.getParam("candidate_pool", pool_size);
+  private_nh_.getParam("pool_rescore_top_k", pool_rescore_top_k);
+
+  if (pool_size > 0 && (!pose_test.incremental_maps || snapshot_manager))
+  {
+    ROS_WARN("candidate_pool needs incremental_maps and no map_snapshots, the candidates are not kept.");
+    pool_size = 0;
+  }
+
+  candidatePool candidate_pool(std::max(pool_size, 0));
+  candidate_pool.rescore_top_k = std::max(pool_rescore_top_k, 0);
+
+  // after a move the loop goes on once the map settled, or after settle_timeout secs
+  double settle_timeout = 5;
+  private_nh_.getParam("settle_timeout", settle_timeout);
+
+  mapSettledMonitor settled_monitor(n);
+  private_nh_.getParam("settle_velocity_tolerance", settled_monitor.velocity_tolerance);
+  private_nh_.getParam("settle_size_tolerance", settled_monitor.size_tolerance);
+  private_nh_.getParam("settle_min_updates", settled_monitor.min_updates);
+
+  boost::thread execution;
+  bool executing = false;
+  bool execute_success = false;
+
   int n_poses = goal->n_poses;
   float threshold = goal->threshold;
+
+  // secs for an iteration, from the map refresh to the best candidate (0 scores one batch of n_poses)
+  float time_budget = goal->time_budget;
+  bool anytime = time_budget > 0;
+
+  // with a time budget the candidates are scored anytime_chunk at a time, and the deadline is checked between
+  // two chunks. the first chunk of an iteration is always scored
+  int anytime_chunk = 8;
+  private_nh_.getParam("anytime_chunk", anytime_chunk);
+  anytime_chunk = std::max(anytime_chunk, 1);
+
+  ros::Time deadline;
+  size_t n_scored = 0;
+
+  std::function<bool()> past_deadline = [&]() -> bool {
+    return anytime && n_scored > 0 && ros::Time::now() >= deadline;
+  };
+
+  view_search.stop = past_deadline;
+
+  // coarse to fine evaluation, the goal overrides the coarse_level/coarse_keep_ratio params
+  if (goal->coarse_level > 0)
+  {
+    pose_test.coarse_level = goal->coarse_level;
+  }
+
+  if (goal->coarse_keep_ratio > 0)
+  {
+    pose_test.coarse_keep_ratio = goal->coarse_keep_ratio;
+  }
   float max_reach = 0.951;
 
   int arrow_id = -1;
@@ -300,13 +552,49 @@ void SmobexExplorerActionSkill::executeCB(const smobex_explorer_action_skill_msg
   moveit_msgs::Constraints constraints;
   moveit_msgs::JointConstraint joint3_constraint;
   geometry_msgs::Quaternion quat_orient;
-  geometry_msgs::Quaternion q_arrow;
   moveit::core::RobotStatePtr current_state;
   std::vector<double> joint_group_positions;
-  tf::Quaternion q_rot, q_new;
-  visualization_msgs::Marker arrow;
   std::vector<geometry_msgs::Point> clusters_centroids;
 
+  // a batch of candidates, scored coarse to fine, bounded or all of them as the params ask
+  crossEntropyViewSearch::evaluator evaluate_candidates =
+      [&](const std::vector<tf::Pose> &poses) -> std::vector<float> {
+        if (pool_size > 0)
+        {
+          return candidate_pool.add(poses, pose_test);
+        }
+        else if (pose_test.coarse_level > 0)
+        {
+          return pose_test.evalPosesCoarseToFine(poses);
+        }
+        else if (bound_top_k > 0)
+        {
+          return pose_test.evalPosesBounded(poses, bound_top_k);
+        }
+
+        return pose_test.evalPoses(poses);
+      };
+
+  // evaluate_candidates chunk by chunk until the deadline, the poses left get -1 as the unscored ones
+  crossEntropyViewSearch::evaluator evaluate_until_deadline =
+      [&](const std::vector<tf::Pose> &poses) -> std::vector<float> {
+        std::vector<float> scores(poses.size(), -1);
+        size_t chunk = anytime ? anytime_chunk : std::max<size_t>(poses.size(), 1);
+
+        for (size_t begin = 0; begin < poses.size() && !past_deadline(); begin += chunk)
+        {
+          size_t end = std::min(poses.size(), begin + chunk);
+
+          std::vector<float> chunk_scores =
+              evaluate_candidates(std::vector<tf::Pose>(poses.begin() + begin, poses.begin() + end));
+
+          std::copy(chunk_scores.begin(), chunk_scores.end(), scores.begin() + begin);
+          n_scored += end - begin;
+        }
+
+        return scores;
+      };
+
   constraints.name = "joint3_limit";
 
   joint3_constraint.joint_name = "joint_3";
@@ -324,20 +612,61 @@ void SmobexExplorerActionSkill::executeCB(const smobex_explorer_action_skill_msg
     arrow_id = -1;
     best_score = -1;
 
-    move_group.clearPoseTargets();
+    deadline = ros::Time::now() + ros::Duration(std::max(time_budget, 0.0f));
+    n_scored = 0;
+
+    // clustered and evaluated on the same unknown space
+    if (executing)
+    {
+      // the predicted map, with the view being taken already in it
+      if (!pose_test.extract_unknown)
+      {
+        unknown_cloud = pose_test.unknownCloudMsg(frame_id);
+      }
+    }
+    else
+    {
+      move_group.clearPoseTargets();
 
-    unknown_cloud = ros::topic::waitForMessage<sensor_msgs::PointCloud2>("/unknown_pc", n);
+      unknown_cloud = refreshUnknown(pose_test, frame_id, n);
+    }
 
-    pose_test.writeKnownOctomap();
-    pose_test.writeUnknownOctomap();
+    bool show_cluster_voxels = pub_cloud_clusters.getNumSubscribers() > 0;
 
-    pose_test.writeUnknownCloud(unknown_cloud);
+    clusters_centroids =
+        findClusters(unknown_cloud, pose_test.extract_unknown ? &pose_test : NULL, show_cluster_voxels);
+
+    // the candidates of the last iterations, brought to this map before the new ones join them
+    std::vector<tf::Pose> pooled_poses;
+    std::vector<float> pooled_scores;
+
+    if (pool_size > 0 && candidate_pool.size() > 0)
+    {
+      ros::Time update_start = ros::Time::now();
+
+      candidate_pool.update(pose_test);
+
+      for (size_t pool_idx = 0; pool_idx < candidate_pool.size(); pool_idx++)
+      {
+        pooled_poses.push_back(candidate_pool.candidates[pool_idx].pose);
+        // a stale score is only a bound, skipped as by evalPosesBounded
+        pooled_scores.push_back(candidate_pool.candidates[pool_idx].stale ? -1 : candidate_pool.candidates[pool_idx].score);
+      }
 
-    clusters_centroids = findClusters(unknown_cloud);
+      ROS_INFO_STREAM("Pool of " << candidate_pool.size() << " poses updated, " << candidate_pool.n_stale
+                                 << " stale and " << candidate_pool.n_rescored << " rescored in "
+                                 << (ros::Time::now() - update_start).toSec() << " secs.");
+    }
 
     if (clusters_centroids.size() > 0)
     {
-      pub_cloud_clusters.publish(cloud_clusters_publish);
+      if (show_cluster_voxels)
+      {
+        cloud_clusters_publish.header.stamp = ros::Time(0);
+        cloud_clusters_publish.header.frame_id = frame_id;
+
+        pub_cloud_clusters.publish(cloud_clusters_publish);
+      }
 
       centroid_clusters_publish.header.stamp = ros::Time(0);
       centroid_clusters_publish.header.frame_id = frame_id;
@@ -351,90 +680,299 @@ void SmobexExplorerActionSkill::executeCB(const smobex_explorer_action_skill_msg
 
     size_t total_clusters = clusters_centroids.size();
 
-    size_t poses_by_cluster = n_poses / total_clusters;
+    ROS_INFO_STREAM("Number of clusters: " << total_clusters);
 
-    if (poses_by_cluster < 1)
+    if (anytime)
     {
-      poses_by_cluster = 1;
+      ROS_INFO_STREAM("Sampling until the deadline, " << (deadline - ros::Time::now()).toSec() << " secs left");
     }
 
-    ROS_INFO_STREAM("Number of clusters: " << total_clusters);
-    ROS_INFO_STREAM("Poses by cluster: " << poses_by_cluster);
+    std::vector<tf::Pose> candidate_poses;
+    std::vector<float> candidate_scores;
+
+    bool searched = view_search.rounds > 0;
+
+    std::vector<tf::Point> centers(total_clusters);
 
     for (size_t cluster_idx = 0; cluster_idx < total_clusters; cluster_idx++)
     {
-      observation_point = clusters_centroids[cluster_idx];
-      ROS_INFO_STREAM("Obervating towards: " << observation_point);
-      // poses_vector.clear();
+      tf::pointMsgToTF(clusters_centroids[cluster_idx], centers[cluster_idx]);
+    }
+
+    // with a time budget, batches of up to n_poses candidates are sampled and scored until the deadline and the
+    // best so far is at hand from the first batch on. without, one batch of n_poses
+    ros::Time eval_start = ros::Time::now();
+    size_t batch_size = std::max(n_poses, 1);
+    float best_so_far = -1;
+
+    // a probe batch of one chunk gives the first rate. the search stops itself at the deadline
+    if (anytime && !searched)
+    {
+      batch_size = std::min<size_t>(batch_size, anytime_chunk);
+    }
+
+    while (true)
+    {
+      size_t poses_by_cluster = batch_size / total_clusters;
 
-      for (size_t pose_idx = 0; pose_idx < poses_by_cluster; pose_idx++)
+      if (poses_by_cluster < 1)
       {
-        // bool set_target;
-        aPose one_pose;
+        poses_by_cluster = 1;
+      }
+
+      ROS_INFO_STREAM("Poses by cluster: " << poses_by_cluster);
+
+      std::vector<std::vector<tf::Pose> > cluster_views;
+      std::vector<std::vector<float> > cluster_scores;
+      std::vector<float> searched_scores;
+
+      if (searched)
+      {
+        ros::Time search_start = ros::Time::now();
+
+        int best_view = view_search.search(view_sampler, centers, batch_size, evaluate_until_deadline);
+
+        ROS_INFO_STREAM("Cross entropy search of " << view_search.poses.size() << " poses in " << view_search.rounds
+                                                   << " rounds took " << (ros::Time::now() - search_start).toSec()
+                                                   << " secs, best " << (best_view < 0 ? 0 : view_search.scores[best_view]));
+
+        cluster_views.assign(total_clusters, std::vector<tf::Pose>());
+        cluster_scores.assign(total_clusters, std::vector<float>());
+
+        for (size_t view_idx = 0; view_idx < view_search.poses.size(); view_idx++)
+        {
+          cluster_views[view_search.components[view_idx]].push_back(view_search.poses[view_idx]);
+          cluster_scores[view_search.components[view_idx]].push_back(view_search.scores[view_idx]);
+        }
+      }
+      else if (use_sampler)
+      {
+        view_sampler.sample(centers, poses_by_cluster, cluster_views);
+      }
+
+      // sampling (and the orientation search) stops at the deadline too, the searched views are scored already
+      for (size_t cluster_idx = 0; cluster_idx < total_clusters && (searched || !past_deadline()); cluster_idx++)
+      {
+        observation_point = clusters_centroids[cluster_idx];
+        ROS_INFO_STREAM("Obervating towards: " << observation_point);
+        // poses_vector.clear();
+
+        size_t cluster_poses = searched || use_sampler ? cluster_views[cluster_idx].size() : poses_by_cluster;
+
+        for (size_t pose_idx = 0; pose_idx < cluster_poses && (searched || !past_deadline()); pose_idx++)
+        {
+          // bool set_target;
+          aPose one_pose;
+          tf::Pose candidate;
+
+          if (searched || use_sampler)
+          {
+            candidate = cluster_views[cluster_idx][pose_idx];
+
+            target_pose.header.frame_id = move_group.getPlanningFrame();
+            target_pose.header.stamp = ros::Time::now();
+            tf::poseTFToMsg(candidate, target_pose.pose);
+          }
+          else
+          {
+            for (int try_idx = 0; try_idx < std::max(reachability_tries, 1); try_idx++)
+            {
+              target_pose = move_group.getRandomPose();
+              target_pose.pose.position.x = abs(target_pose.pose.position.x);
+
+              const geometry_msgs::Point &origin = target_pose.pose.position;
+
+              if (reachability_map.reachable(origin.x, origin.y, origin.z, observation_point.x - origin.x,
+                                             observation_point.y - origin.y, observation_point.z - origin.z))
+              {
+                break;
+              }
+            }
+
+            quat_orient = getOrientation(target_pose, observation_point);
+            target_pose.pose.orientation = quat_orient;
+
+            tf::poseMsgToTF(target_pose.pose, candidate);
+          }
+
+          if (searched)
+          {
+            // scored already
+            searched_scores.push_back(cluster_scores[cluster_idx][pose_idx]);
+          }
+          else if (orientations_per_origin > 1)
+          {
+            // one visibility pass for this origin, then orientations around the cluster direction cost O(1) each
+            pose_test.buildVisibilityMap(octomap::pointTfToOctomap(candidate.getOrigin()), visibility_map);
+
+            tf::Quaternion look_at = candidate.getRotation();
+            tf::Quaternion best_orientation = look_at;
+            float best_orientation_score = pose_test.evalOrientation(visibility_map, look_at);
+
+            for (int orient_idx = 1; orient_idx < orientations_per_origin; orient_idx++)
+            {
+              tf::Quaternion offset;
+              offset.setRPY(((double)rand() / RAND_MAX - 0.5) * height_FOV, ((double)rand() / RAND_MAX - 0.5) * width_FOV,
+                            ((double)rand() / RAND_MAX - 0.5) * 2 * M_PI);
+
+              tf::Quaternion orientation = look_at * offset;
+
+              tf::Vector3 view_direction = tf::Matrix3x3(orientation).getColumn(2);
+
+              if (!reachability_map.reachable(candidate.getOrigin().x(), candidate.getOrigin().y(),
+                                              candidate.getOrigin().z(), view_direction.x(), view_direction.y(),
+                                              view_direction.z()))
+              {
+                continue;
+              }
+
+              float orientation_score = pose_test.evalOrientation(visibility_map, orientation);
+
+              if (orientation_score > best_orientation_score)
+              {
+                best_orientation_score = orientation_score;
+                best_orientation = orientation;
+              }
+            }
+
+            best_orientation.normalize();
+            candidate.setRotation(best_orientation);
+            tf::quaternionTFToMsg(best_orientation, target_pose.pose.orientation);
+          }
+          candidate_poses.push_back(candidate);
+
+          one_pose.pose = target_pose;
+          one_pose.arrow_id = ++arrow_id;
+
+          poses_vector.push_back(one_pose);
+          all_poses.markers.push_back(poseArrow(target_pose, frame_id, arrow_id));
+        }
+      }
+
+      std::vector<float> batch_scores;
+
+      if (searched)
+      {
+        batch_scores = searched_scores;
+      }
+      else
+      {
+        std::vector<tf::Pose> batch_poses(candidate_poses.begin() + candidate_scores.size(), candidate_poses.end());
+
+        ROS_INFO_STREAM("Evaluating " << batch_poses.size() << " poses...");
+
+        ros::Time batch_start = ros::Time::now();
+
+        batch_scores = evaluate_until_deadline(batch_poses);
+
+        ROS_INFO_STREAM("Evaluation took " << (ros::Time::now() - batch_start).toSec() << " secs.");
+      }
+
+      candidate_scores.insert(candidate_scores.end(), batch_scores.begin(), batch_scores.end());
+
+      for (size_t pose_idx = 0; pose_idx < batch_scores.size(); pose_idx++)
+      {
+        best_so_far = std::max(best_so_far, batch_scores[pose_idx]);
+      }
 
-        target_pose = move_group.getRandomPose();
-        target_pose.pose.position.x = abs(target_pose.pose.position.x);
+      double elapsed = std::max((ros::Time::now() - eval_start).toSec(), 1e-6);
+      float evaluation_rate = n_scored / elapsed;
 
-        quat_orient = getOrientation(target_pose, observation_point);
-        target_pose.pose.orientation = quat_orient;
+      double remaining = (deadline - ros::Time::now()).toSec();
 
-        ROS_INFO_STREAM("Cluster " << cluster_idx + 1 << " of " << total_clusters << " Pose " << pose_idx + 1 << " of " << poses_by_cluster);
+      feedback(anytime ? std::min(100.0, 100 * (1 - remaining / time_budget)) : 100, n_scored, evaluation_rate,
+               best_so_far);
 
-        tf::poseMsgToTF(target_pose.pose, pose_test.view_pose);
+      // the next batch is cut to what the rate says fits before the deadline, the chunks stop it if the rate was
+      // too optimistic
+      double next_size = std::min<double>(std::max(n_poses, 1), floor(evaluation_rate * remaining));
 
-        arrow.header.stamp = ros::Time::now();
-        arrow.header.frame_id = frame_id;
+      if (!anytime || next_size < 1 || past_deadline())
+      {
+        break;
+      }
 
-        arrow.id = ++arrow_id;
+      batch_size = next_size;
+    }
 
-        arrow.type = visualization_msgs::Marker::ARROW;
-        arrow.action = visualization_msgs::Marker::ADD;
+    // the pooled candidates compete with the new ones
+    for (size_t pool_idx = 0; pool_idx < pooled_poses.size(); pool_idx++)
+    {
+      aPose one_pose;
 
-        arrow.pose.position = target_pose.pose.position;
+      one_pose.pose.header.frame_id = move_group.getPlanningFrame();
+      one_pose.pose.header.stamp = ros::Time::now();
+      tf::poseTFToMsg(pooled_poses[pool_idx], one_pose.pose.pose);
+      one_pose.arrow_id = ++arrow_id;
 
-        tf::quaternionMsgToTF(target_pose.pose.orientation, q_new);
+      candidate_poses.push_back(pooled_poses[pool_idx]);
+      candidate_scores.push_back(pooled_scores[pool_idx]);
 
-        q_rot.setRPY(0, -M_PI / 2, 0);
-        q_new = q_new * q_rot;
-        q_new.normalize();
+      poses_vector.push_back(one_pose);
+      all_poses.markers.push_back(poseArrow(one_pose.pose, frame_id, arrow_id));
+    }
 
-        tf::quaternionTFToMsg(q_new, q_arrow);
-        arrow.pose.orientation = q_arrow;
+    if (executing)
+    {
+      execution.join();
+      executing = false;
 
-        arrow.scale.x = 0.10;
-        arrow.scale.y = 0.02;
-        arrow.scale.z = 0.02;
+      move_group.clearPoseTargets();
 
-        pose_test.evalPose();
+      // the view was not taken, so the prediction does not even rank. the refresh below replaces the predicted
+      // maps with the real ones and every candidate is scored again
+      size_t n_validate = execute_success ? std::max(pipeline_validate_k, 0) : candidate_scores.size();
 
-        ROS_INFO_STREAM("Score: " << pose_test.score);
+      if (!execute_success)
+      {
+        ROS_WARN("The move to the last view failed, dropping the predicted map.");
+      }
 
-        arrow.color = pose_test.score_color;
+      waitMapSettled(settled_monitor, settle_timeout);
 
-        // if (pose_test.score > best_score)
-        // {
-        //   best_score = pose_test.score;
-        //   best_pose = target_pose;
-        //   best_arrow_id = arrow_id;
+      pose_test.requestMaps();
+      unknown_cloud = refreshUnknown(pose_test, frame_id, n);
 
-        //   single_view_boxes = pose_test.discoveredBoxesVis(frame_id);
-        // }
+      // the prediction only ranks, the real map scores the best of them again and drops the others
+      std::vector<size_t> order(candidate_scores.size());
+
+      for (size_t pose_idx = 0; pose_idx < order.size(); pose_idx++)
+      {
+        order[pose_idx] = pose_idx;
+      }
+
+      std::sort(order.begin(), order.end(), evaluatePose::compareValueIndex(candidate_scores));
+
+      std::vector<tf::Pose> validate_poses;
+
+      for (size_t k = 0; k < order.size() && k < n_validate && candidate_scores[order[k]] >= 0; k++)
+      {
+        validate_poses.push_back(candidate_poses[order[k]]);
+      }
 
-        one_pose.score = pose_test.score;
-        one_pose.pose = target_pose;
-        one_pose.arrow_id = arrow_id;
-        // one_pose.boxes = pose_test.discoveredBoxesVis(frame_id);
+      std::vector<float> validated_scores = pose_test.evalPoses(validate_poses);
 
-        poses_vector.push_back(one_pose);
+      ROS_INFO_STREAM("Validated " << validate_poses.size() << " predicted poses, best predicted "
+                                   << (order.empty() ? 0 : candidate_scores[order[0]]) << ", now "
+                                   << (validated_scores.empty() ? 0 : validated_scores[0]));
 
-        all_poses.markers.push_back(arrow);
-        pub_arrows.publish(all_poses);
+      candidate_scores.assign(candidate_scores.size(), -1);
 
-        ROS_INFO("---------");
-        ros::spinOnce();
+      for (size_t k = 0; k < validated_scores.size(); k++)
+      {
+        candidate_scores[order[k]] = validated_scores[k];
       }
     }
 
+    for (size_t pose_idx = 0; pose_idx < poses_vector.size(); pose_idx++)
+    {
+      poses_vector[pose_idx].score = candidate_scores[pose_idx];
+      all_poses.markers[poses_vector[pose_idx].arrow_id].color = evaluatePose::scoreColor(std::max(candidate_scores[pose_idx], 0.0f));
+    }
+
+    pub_arrows.publish(all_poses);
+    ros::spinOnce();
+
     ROS_INFO("Sorting...");
 
     std::sort(poses_vector.begin(), poses_vector.end(), cmp_aPose);
@@ -449,43 +987,81 @@ void SmobexExplorerActionSkill::executeCB(const smobex_explorer_action_skill_msg
     move_group.setPlanningTime(0.5);
     move_group.setNumPlanningAttempts(5);
 
-    do
+    if (view_planner)
     {
-      sorted_pose_idx++;
+      std::vector<geometry_msgs::PoseStamped> targets(poses_vector.size());
 
-      best_pose = poses_vector[sorted_pose_idx].pose;
-
-      ROS_INFO_STREAM("Planning " << sorted_pose_idx << " ...");
-
-      // set_target = move_group.setJointValueTarget(best_pose, end_effector_link);
-      move_group.setPathConstraints(constraints);
-      set_target = move_group.setPoseTarget(best_pose, end_effector_link);
-      set_plan = (move_group.plan(my_plan) == moveit::planning_interface::MoveItErrorCode::SUCCESS);
-
-      // std::vector<geometry_msgs::Pose> waypoints;
-      // waypoints.push_back(best_pose.pose);
-
-      // moveit_msgs::RobotTrajectory trajectory;
-      // set_target = (move_group.computeCartesianPath(waypoints, 0.005, 0.0, trajectory, true) > 0.95);
-      // my_plan.trajectory_ = trajectory;
-      // set_plan = true;
+      for (size_t pose_idx = 0; pose_idx < poses_vector.size(); pose_idx++)
+      {
+        targets[pose_idx] = poses_vector[pose_idx].pose;
+      }
 
-      ROS_INFO("Target (pose goal) %s", set_target ? "SUCCESS" : "FAILED");
-      ROS_INFO("Plan (pose goal) %s", set_plan ? "SUCCESS" : "FAILED");
+      sorted_pose_idx = view_planner->plan(targets, constraints, my_plan);
 
-      if (sorted_pose_idx == poses_vector.size() - 1)
+      if (sorted_pose_idx < 0)
       {
         ROS_INFO("Couldn't plan for any pose...");
         this->set_aborted();
         return;
       }
 
-    } while ((set_target == false) || (set_plan == false));
+      best_pose = poses_vector[sorted_pose_idx].pose;
+    }
+    else
+    {
+      do
+      {
+        sorted_pose_idx++;
+
+        best_pose = poses_vector[sorted_pose_idx].pose;
+
+        ROS_INFO_STREAM("Planning " << sorted_pose_idx << " ...");
+
+        // set_target = move_group.setJointValueTarget(best_pose, end_effector_link);
+        move_group.setPathConstraints(constraints);
+        set_target = move_group.setPoseTarget(best_pose, end_effector_link);
+        set_plan = (move_group.plan(my_plan) == moveit::planning_interface::MoveItErrorCode::SUCCESS);
+
+        // std::vector<geometry_msgs::Pose> waypoints;
+        // waypoints.push_back(best_pose.pose);
+
+        // moveit_msgs::RobotTrajectory trajectory;
+        // set_target = (move_group.computeCartesianPath(waypoints, 0.005, 0.0, trajectory, true) > 0.95);
+        // my_plan.trajectory_ = trajectory;
+        // set_plan = true;
+
+        ROS_INFO("Target (pose goal) %s", set_target ? "SUCCESS" : "FAILED");
+        ROS_INFO("Plan (pose goal) %s", set_plan ? "SUCCESS" : "FAILED");
+
+        if (sorted_pose_idx == poses_vector.size() - 1)
+        {
+          ROS_INFO("Couldn't plan for any pose...");
+          this->set_aborted();
+          return;
+        }
+
+      } while ((set_target == false) || (set_plan == false));
+    }
+
+    // the ones that did not plan will not plan from the same place next time, the chosen one is taken
+    for (int pose_idx = 0; pool_size > 0 && pose_idx <= sorted_pose_idx; pose_idx++)
+    {
+      tf::Pose pooled;
+      tf::poseMsgToTF(poses_vector[pose_idx].pose.pose, pooled);
+
+      candidate_pool.erase(pooled);
+    }
 
     tf::poseMsgToTF(best_pose.pose, pose_test.view_pose);
     pose_test.evalPose();
 
     best_score = poses_vector[sorted_pose_idx].score;
+
+    // skipped by the bound or the coarse stage, the evaluation above is the only score it has
+    if (best_score < 0)
+    {
+      best_score = pose_test.score;
+    }
     best_arrow_id = poses_vector[sorted_pose_idx].arrow_id;
     // single_view_boxes = poses_vector[sorted_pose_idx].boxes;
     single_view_boxes = pose_test.discoveredBoxesVis(frame_id);
@@ -504,9 +1080,17 @@ void SmobexExplorerActionSkill::executeCB(const smobex_explorer_action_skill_msg
     ROS_WARN("MOVING!!!");
     ROS_INFO_STREAM("Moving towards score " << best_score);
 
-    bool success = (move_group.execute(my_plan) == moveit::planning_interface::MoveItErrorCode::SUCCESS);
+    if (pipelined && best_score > threshold)
+    {
+      execution = boost::thread(boost::bind(&executePlan, boost::ref(move_group), my_plan, boost::ref(execute_success)));
+      executing = true;
 
-    ROS_INFO("Execute (best pose goal) %s", success ? "SUCCESS" : "FAILED");
+      pose_test.predictView();
+    }
+    else
+    {
+      executePlan(move_group, my_plan, execute_success);
+    }
 
     ROS_INFO("---------");
 
@@ -527,7 +1111,12 @@ void SmobexExplorerActionSkill::executeCB(const smobex_explorer_action_skill_msg
     poses_vector.clear();
     clusters_centroids.clear();
 
-    ros::Duration(5).sleep(); //Give time for map to update
+    if (!executing)
+    {
+      waitMapSettled(settled_monitor, settle_timeout);
+
+      pose_test.requestMaps();
+    }
 
   } //while (best_score > threshold);
 
@@ -568,6 +1157,17 @@ void SmobexExplorerActionSkill::set_aborted(std::string outcome)
   ROS_INFO("%s: Aborted", action_name_.c_str());
   as_.setAborted(result_);
 }
+// the progress of the anytime evaluation, as the candidates scored so far and how fast
+void SmobexExplorerActionSkill::feedback(float percentage, int n_evaluated, float evaluation_rate, float best_score)
+{
+  feedback_.n_evaluated = n_evaluated;
+  feedback_.evaluation_rate = evaluation_rate;
+  feedback_.best_score = best_score;
+  ROS_INFO("%s: %d poses evaluated, %f poses/sec, best %f.", action_name_.c_str(), n_evaluated, evaluation_rate,
+           best_score);
+  feedback(percentage);
+}
+
 void SmobexExplorerActionSkill::feedback(float percentage)
 {
   feedback_.percentage = percentage;